@@ -0,0 +1,302 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "tempfile.h"
+#include "lock.h"
+#include "mrutils.h"
+#include "admit.h"
+
+/**
+ * @file
+ *
+ * Admission control: whether a compile goes to the cluster or stays on
+ * the master.
+ *
+ * Going remote only pays while the cluster has map slots to spare.
+ * Once jobs queue up on the JobTracker, a unit waits there for minutes
+ * that a local compile would have taken seconds for.  So every mrcc
+ * process looks at a capacity probe before it submits:
+ *
+ *  - the TaskTrackers, times MRCC_MAP_SLOTS_PER_NODE (default 2) map
+ *    slots each, unless MRCC_ADMIT_SLOTS gives the map slots directly;
+ *  - the jobs running and queued on the JobTracker;
+ *  - the recent end-to-end time of remote and of local compiles.
+ *
+ * The probe is kept in the state file "capacity" and refreshed by one
+ * process at a time once it is MRCC_ADMIT_TTL ms old (default 5000);
+ * the others go on with the old values meanwhile, or wait for it if
+ * there are none.  Each probe that
+ * finds no queued jobs halves the lead of the remote time over the
+ * local one, so that a slow spell is not held against the cluster
+ * forever.
+ *
+ * A compile is admitted remote if the JobTracker has no queued jobs,
+ * remote compiles are not MRCC_ADMIT_LATENCY times (default 4) slower
+ * than local ones, and, outside batch mode, fewer than one single job
+ * per map slot is already in flight.  Otherwise it runs locally if one
+ * of MRCC_LOCAL_SLOTS (default the number of CPUs) local slots is free,
+ * and else it is held: a single job waits for a remote slot, a batch
+ * unit goes to the spool and leaves with the next batch.
+ *
+ * The thresholds are not tuned yet, and only the jobs that wait on the
+ * JobTracker count as queued, not the units of ours that are still
+ * being uploaded, so all of this is off unless MRCC_ADMIT=1.
+ **/
+
+struct capacity {
+    long time_ms;       /* of the probe, 0 for never */
+    int trackers;
+    int running;        /* jobs on the JobTracker */
+    int queued;
+    long remote_ms;     /* moving averages of the end-to-end time */
+    long local_ms;
+};
+
+
+static long admit_now_ms(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+
+static void admit_read(FILE *fp, struct capacity *c)
+{
+    memset(c, 0, sizeof *c);
+    rewind(fp);
+    if (fscanf(fp, "%ld %d %d %d %ld %ld", &c->time_ms, &c->trackers,
+               &c->running, &c->queued, &c->remote_ms, &c->local_ms) != 6)
+        memset(c, 0, sizeof *c);
+}
+
+
+static void admit_write(FILE *fp, const struct capacity *c)
+{
+    rewind(fp);
+    fprintf(fp, "%ld %d %d %d %ld %ld\n", c->time_ms, c->trackers,
+            c->running, c->queued, c->remote_ms, c->local_ms);
+    fflush(fp);
+    ftruncate(fileno(fp), ftell(fp));
+}
+
+
+/*
+ * ask the JobTracker, and store the answer with the latencies that were
+ * recorded meanwhile
+ */
+static void admit_refresh(struct capacity *c)
+{
+    struct capacity probe;
+    int lock_fd;
+    FILE *fp;
+
+    memset(&probe, 0, sizeof probe);
+    if (mr_probe_trackers(&probe.trackers) != 0
+        || mr_probe_jobs(&probe.running, &probe.queued) != 0) {
+        /* keep the old values, and do not try again before the ttl */
+        probe = *c;
+    }
+
+    if (mrcc_open_state("capacity", &lock_fd, &fp) != 0)
+        return;
+    admit_read(fp, c);
+    c->time_ms = admit_now_ms();
+    c->trackers = probe.trackers;
+    c->running = probe.running;
+    c->queued = probe.queued;
+    /* nothing goes remote while it looks slow, so forget a slow spell
+     * bit by bit once the queue is gone */
+    if (c->queued == 0 && c->remote_ms > c->local_ms)
+        c->remote_ms = (c->remote_ms + c->local_ms) / 2;
+    admit_write(fp, c);
+    mrcc_close_state(lock_fd, fp);
+
+    rs_trace("cluster probe: %d trackers, %d jobs running, %d queued",
+             c->trackers, c->running, c->queued);
+}
+
+
+/*
+ * get the cluster capacity, probing it if the cached one is too old
+ */
+static int admit_probe(struct capacity *c)
+{
+    char *lock_dir, *fname;
+    int lock_fd, probe_fd = -1;
+    int ttl = getenv_int("MRCC_ADMIT_TTL", 5000);
+    int pass;
+    FILE *fp;
+    int ret;
+
+    for (pass = 0; pass < 2; pass++) {
+        if ((ret = mrcc_open_state("capacity", &lock_fd, &fp)))
+            return ret;
+        admit_read(fp, c);
+        mrcc_close_state(lock_fd, fp);
+
+        if (admit_now_ms() - c->time_ms < ttl)
+            break;
+        if (pass == 1) {
+            admit_refresh(c);
+            break;
+        }
+
+        /* only one process probes, the others take the stale values;
+         * if there are none yet, they wait for the probe */
+        if ((ret = get_lock_dir(&lock_dir)))
+            return ret;
+        if (asprintf(&fname, "%s/capacity_probe", lock_dir) == -1)
+            return EXIT_OUT_OF_MEMORY;
+        ret = mrcc_lock_file(fname, c->time_ms == 0, &probe_fd);
+        free(fname);
+        if (ret == EXIT_BUSY)
+            return 0;
+        if (ret)
+            return ret;
+    }
+
+    mrcc_unlock(probe_fd);
+    return 0;
+}
+
+
+static int admit_map_slots(const struct capacity *c)
+{
+    int slots = getenv_int("MRCC_ADMIT_SLOTS", 0);
+
+    if (slots > 0)
+        return slots;
+    return c->trackers * getenv_int("MRCC_MAP_SLOTS_PER_NODE", 2);
+}
+
+
+/**
+ * Decide where the compile of this process runs.
+ *
+ * @p batch says whether it would go remote as a batch unit.  The slot
+ * this process was admitted to, remote or local, is returned in
+ * @p slot_fd, or -1; release it with mrcc_unlock() when the compile is
+ * done.
+ **/
+enum admit_route admit_route(int batch, int *slot_fd)
+{
+    struct capacity c;
+    char *lock_dir;
+    int map_slots, local_slots, ratio;
+    const char *why = NULL;
+
+    *slot_fd = -1;
+    if (!getenv_bool("MRCC_ADMIT", 0)
+        || get_lock_dir(&lock_dir) != 0
+        || admit_probe(&c) != 0)
+        return ADMIT_REMOTE;
+
+    map_slots = admit_map_slots(&c);
+    ratio = getenv_int("MRCC_ADMIT_LATENCY", 4);
+
+    if (c.queued > 0)
+        why = "jobs are queued on the JobTracker";
+    else if (ratio > 0 && c.remote_ms > 0 && c.local_ms > 0
+             && c.remote_ms > c.local_ms * ratio)
+        why = "remote compiles are slow";
+    else if (!batch && map_slots > 0
+             && mrcc_lock_slot(lock_dir, "remote", map_slots, 0,
+                               slot_fd) != 0)
+        why = "every map slot has a job of ours";
+    else
+        return ADMIT_REMOTE;
+
+    local_slots = getenv_int("MRCC_LOCAL_SLOTS",
+                             (int) sysconf(_SC_NPROCESSORS_ONLN));
+    if (mrcc_lock_slot(lock_dir, "local", local_slots, 0, slot_fd) == 0) {
+        rs_log_info("%s, compiling locally", why);
+        return ADMIT_LOCAL;
+    }
+
+    rs_trace("%s, and the local slots are busy: waiting for the cluster",
+             why);
+    if (!batch && map_slots > 0)
+        mrcc_lock_slot(lock_dir, "remote", map_slots, 1, slot_fd);
+    return ADMIT_REMOTE;
+}
+
+
+/**
+ * Add the end-to-end time of a compile to the moving average of its
+ * route, which admit_route() compares.
+ **/
+void admit_note_time(enum admit_route route, long msec)
+{
+    struct capacity c;
+    long *avg;
+    int lock_fd;
+    FILE *fp;
+
+    if (!getenv_bool("MRCC_ADMIT", 0)
+        || mrcc_open_state("capacity", &lock_fd, &fp) != 0)
+        return;
+    admit_read(fp, &c);
+    avg = route == ADMIT_REMOTE ? &c.remote_ms : &c.local_ms;
+    /* weight 1/4 for the new one */
+    *avg = *avg ? (*avg * 3 + msec) / 4 : msec;
+    admit_write(fp, &c);
+    mrcc_close_state(lock_fd, fp);
+}
+
+
+/**
+ * Print the cached capacity, for "mrcc --stats".
+ **/
+int admit_show_stats(FILE *out)
+{
+    struct capacity c;
+    int lock_fd;
+    FILE *fp;
+    int ret;
+
+    if ((ret = mrcc_open_state("capacity", &lock_fd, &fp)))
+        return ret;
+    admit_read(fp, &c);
+    mrcc_close_state(lock_fd, fp);
+
+    if (c.time_ms == 0) {
+        fprintf(out, "cluster not probed yet\n");
+        return 0;
+    }
+    fprintf(out, "cluster probed %lds ago: %d trackers, %d map slots, "
+            "%d jobs running, %d queued\n",
+            (admit_now_ms() - c.time_ms) / 1000, c.trackers,
+            admit_map_slots(&c), c.running, c.queued);
+    fprintf(out, "  compiles take %ldms remote, %ldms local on average\n",
+            c.remote_ms, c.local_ms);
+    return 0;
+}
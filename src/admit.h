@@ -0,0 +1,16 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_ADMIT_H
+# define _HEADER_ADMIT_H
+
+enum admit_route {
+    ADMIT_REMOTE = 0,
+    ADMIT_LOCAL = 1
+};
+
+enum admit_route admit_route(int batch, int *slot_fd);
+void admit_note_time(enum admit_route route, long msec);
+int admit_show_stats(FILE *out);
+
+#endif //_HEADER_ADMIT_H
@@ -169,6 +169,71 @@ int argv_append(char **argv, char *toadd)
     return 0;
 }
 
+/**
+ * Whether the compiler @p cc is GCC, going by its name.  "cc" and "c++"
+ * are taken to be, as they are on the systems mrcc runs on, unless
+ * @p strict is set.
+ **/
+int cc_is_gcc(const char *cc, int strict)
+{
+    cc = find_basename(cc);
+    return strstr(cc, "gcc") != NULL || strstr(cc, "g++") != NULL
+        || (!strict && (str_equal(cc, "cc") || str_equal(cc, "c++")));
+}
+
+
+/**
+ * Whether the option @p a takes the next word as its value, as in
+ * "-I dir" or "-include foo.h", so that the value is not mistaken for
+ * an input.
+ **/
+int arg_takes_value(const char *a)
+{
+    static const char *const opts[] = {
+        "-D", "-U", "-I", "-L", "-l", "-MF", "-MT", "-MQ", "-A",
+        "-include", "-imacros", "-iprefix", "-iwithprefix",
+        "-iwithprefixbefore", "-isystem", "-idirafter", "-iquote",
+        "-isysroot", "-imultilib", "--sysroot", "--param", "-aux-info",
+        "-Xpreprocessor", "-Xassembler", "-Xlinker", "-dumpbase",
+        "-dumpdir", "-auxbase", NULL
+    };
+    int i;
+
+    for (i = 0; opts[i]; i++)
+        if (!strcmp(a, opts[i]))
+            return 1;
+    return 0;
+}
+
+
+/**
+ * The language given with -x for @p input_file in @p argv, which is
+ * the last one before it, or NULL if there is none, or it is "none".
+ **/
+const char *input_language(char **argv, const char *input_file)
+{
+    const char *lang = NULL;
+    int i;
+
+    for (i = 1; argv[i]; i++) {
+        if (!strcmp(argv[i], "-x")) {
+            if ((lang = argv[++i]) == NULL)
+                break;
+        } else if (str_startswith("-x", argv[i])) {
+            lang = argv[i] + 2;
+        } else if (argv[i][0] == '-') {
+            if (arg_takes_value(argv[i]) && argv[i+1])
+                i++;
+        } else if (!strcmp(argv[i], input_file)) {
+            break;
+        }
+    }
+    if (lang && !strcmp(lang, "none"))
+        lang = NULL;
+    return lang;
+}
+
+
 static void note_compiled(const char *input_file, const char *output_file)
 {
     const char *input_base, *output_base;
@@ -199,6 +264,7 @@ int scan_args(char *argv[], char **input_file, char **output_file, char ***ret_n
     int seen_opt_c = 0, seen_opt_s = 0;
     int i;
     char *a;
+    const char *lang = NULL, *input_lang = NULL;
     int ret;
 
      /* allow for -o foo.o */
@@ -248,6 +314,7 @@ int scan_args(char *argv[], char **input_file, char **output_file, char ***ret_n
                 rs_trace("%s implies -E (maybe) and must be local", a);
                 return EXIT_MRCC_FAILED;
             } else if (!strcmp(a, "-march=native")) {
+                /* unless expand_native_options() could resolve it */
                 rs_trace("-march=native generates code for local machine; ""must be local");
                 return EXIT_MRCC_FAILED;
             } else if (!strcmp(a, "-mtune=native")) {
@@ -272,17 +339,36 @@ int scan_args(char *argv[], char **input_file, char **output_file, char ***ret_n
                 // return EXIT_MRCC_FAILED;
             } else if (!strcmp(a, "-fprofile-arcs")
                        || !strcmp(a, "-ftest-coverage")) {
+                /* unlike the other side outputs (see manifest.c), the
+                 * .gcno records the working directory of the compiler,
+                 * and the object the path of its .gcda */
                 rs_log_info("compiler will emit profile info; must be local");
                 return EXIT_MRCC_FAILED;
             } else if (!strcmp(a, "-frepo")) {
                 rs_log_info("compiler will emit .rpo files; must be local");
                 return EXIT_MRCC_FAILED;
             } else if (str_startswith("-x", a)) {
-                rs_log_info("gcc's -x handling is complex; running locally");
-                return EXIT_MRCC_FAILED;
+                /* the input is compiled like a source with the extension
+                 * of the language, see input_language() */
+                lang = a[2] ? a + 2 : argv[++i];
+                if (lang == NULL) {
+                    rs_log_info("-x without a language; running locally");
+                    return EXIT_MRCC_FAILED;
+                }
+                if (!strcmp(lang, "none")) {
+                    lang = NULL;
+                } else if (!lang_source_exten(lang)) {
+                    rs_log_info("gcc's -x %s is not distributed; running "
+                                "locally", lang);
+                    return EXIT_MRCC_FAILED;
+                }
             } else if (str_startswith("-dr", a)) {
                 rs_log_info("gcc's debug option %s may write extra files; ""running locally", a);
                 return EXIT_MRCC_FAILED;
+            } else if (arg_takes_value(a)) {
+                /* and the value is no input */
+                if (argv[i+1])
+                    i++;
             } else if (!strcmp(a, "-c")) {
                 seen_opt_c = 1;
             } else if (!strcmp(a, "-o")) {
@@ -294,13 +380,15 @@ int scan_args(char *argv[], char **input_file, char **output_file, char ***ret_n
                 goto GOT_OUTPUT;
             }
         } else {
-            if (is_source(a)) {
+            if (lang || is_source(a)) {
                 rs_trace("found input file \"%s\"", a);
                 if (*input_file) {
+                    /* split_build() takes those apart beforehand */
                     rs_log_info("do we have two inputs?  i give up");
                     return EXIT_MRCC_FAILED;
                 }
                 *input_file = a;
+                input_lang = lang;
             } else if (str_endswith(".o", a)) {
               GOT_OUTPUT:
                 rs_trace("found object/output file \"%s\"", a);
@@ -327,7 +415,8 @@ int scan_args(char *argv[], char **input_file, char **output_file, char ***ret_n
         return EXIT_MRCC_FAILED;
     }
 
-    if (source_needs_local(*input_file))
+    if (source_needs_local(*input_file)
+        || (input_lang && source_needs_local(lang_source_exten(input_lang))))
         return EXIT_MRCC_FAILED;
 
     if (!*output_file) {
@@ -486,6 +575,9 @@ int strip_dasho(char **from, char ***out_argv)
  * remotely, it is possible that omitting these options will make
  * failure more obvious and avoid false success.
  *
+ * -x goes too: the extension of the preprocessed source tells the
+ * language.
+ *
  * Giving -L on a compile-only command line is a bit wierd, but it is
  * observed to happen in Makefiles that are not strict about CFLAGS vs
  * LDFLAGS, etc.
@@ -531,7 +623,8 @@ int strip_local_args(char **from, char ***out_argv)
             || str_equal("-iwithprefix", from[from_i])
             || str_equal("-isystem", from[from_i])
             || str_equal("-iwithprefixbefore", from[from_i])
-            || str_equal("-idirafter", from[from_i])) {
+            || str_equal("-idirafter", from[from_i])
+            || str_equal("-x", from[from_i])) {
             /* skip next word, being option argument */
             if (from[from_i+1])
                 from_i++;
@@ -545,7 +638,8 @@ int strip_local_args(char **from, char ***out_argv)
                  || str_startswith("-L", from[from_i])
                  || str_startswith("-MF", from[from_i])
                  || str_startswith("-MT", from[from_i])
-                 || str_startswith("-MQ", from[from_i])) {
+                 || str_startswith("-MQ", from[from_i])
+                 || str_startswith("-x", from[from_i])) {
             /* Something like "-DNDEBUG" or
              * "-Wp,-MD,.deps/nsinstall.pp".  Just skip this word */
             ;
@@ -11,6 +11,9 @@ int copy_argv(char **from, char ***out, int delta);
 int find_compiler(char **argv, char ***out_argv);
 
 int argv_append(char **argv, char *toadd);
+int cc_is_gcc(const char *cc, int strict);
+int arg_takes_value(const char *a);
+const char *input_language(char **argv, const char *input_file);
 int scan_args(char *argv[], char **input_file, char **output_file, char ***ret_newargv);
 int expand_preprocessor_options(char ***argv_ptr);
 void free_argv(char **argv);
@@ -0,0 +1,411 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "files.h"
+#include "args.h"
+#include "hash.h"
+#include "basedir.h"
+
+/**
+ * @file
+ *
+ * Preprocessed sources that do not depend on where the tree is checked
+ * out, so that two checkouts of the same code, such as those of CI
+ * agents and developers, share the entries of the node caches (see
+ * mapcache.c) and the identical compiles (see coalesce.c).
+ *
+ * The .i names the files it came from in its line markers,
+ *     # 12 "/home/alice/src/include/foo.h" 2
+ * and with -g in one for the working directory, which ends up as the
+ * compilation dir of the debug info.  With MRCC_BASE_DIR set to a
+ * directory above the working directory, the tee of cpp (see tee.c)
+ * when it is on, or else base_normalize(), rewrites the paths of the
+ * markers that are below it as relative ones: the working directory
+ * becomes ".", and the rest of the base dir the "../.." that leads there
+ * from the working directory.
+ *
+ * base_expand_options() gives the compiler the same rewrite as
+ *     -fdebug-prefix-map=BASE=../.. -fdebug-prefix-map=CWD=.
+ * which holds for the local compiles as well, so that a local object
+ * has the same debug info as a remote one, and as the same two
+ * -fmacro-prefix-map options for cpp, which expands __FILE__, and so
+ * assert(), with them.  Those take GCC 8 or clang 10; MRCC_BASE_MACROS=0
+ * leaves them out for older compilers, whose .i then still names the
+ * checkout in the strings of __FILE__.  GCC tries the last map
+ * first, as is done here.  It matches plain prefixes, so that it maps
+ * /home/alice/src2 with the map of /home/alice/src as well; the markers
+ * are only rewritten for paths in the directories themselves, and the
+ * compiler on the node maps the others as it would here.
+ *
+ * The maps name the checkout, so coalesce.c leaves their directories
+ * out of its key, see base_map_target().
+ *
+ * Commands with prefix maps of their own, compilers that are neither
+ * GCC nor clang, and working directories outside MRCC_BASE_DIR are left
+ * alone.
+ **/
+
+/*
+ * whether @p cc takes -fdebug-prefix-map, going by its name
+ */
+static int base_cc_ok(const char *cc)
+{
+    return cc_is_gcc(cc, 0) || strstr(find_basename(cc), "clang") != NULL;
+}
+
+
+/*
+ * the working directory the way the compiler names it: $PWD if that is
+ * where we are, as GCC's getpwd() does
+ */
+static char *base_getcwd(void)
+{
+    const char *pwd = getenv("PWD");
+    struct stat st_pwd, st_dot;
+
+    if (pwd && pwd[0] == '/' && stat(pwd, &st_pwd) == 0
+        && stat(".", &st_dot) == 0 && st_pwd.st_dev == st_dot.st_dev
+        && st_pwd.st_ino == st_dot.st_ino)
+        return strdup(pwd);
+    return getcwd(NULL, 0);
+}
+
+
+void base_map_free(struct base_map *m)
+{
+    free(m->cwd);
+    free(m->base);
+    free(m->up);
+    m->cwd = m->base = m->up = NULL;
+}
+
+
+/*
+ * Set up @p m from MRCC_BASE_DIR and the working directory.  Returns
+ * EXIT_GONE if the working directory is not below the base dir.
+ */
+static int base_map_init(struct base_map *m)
+{
+    const char *env = getenv("MRCC_BASE_DIR");
+    size_t len, up_len;
+    char *p;
+    int n;
+
+    m->cwd = m->base = m->up = NULL;
+    if (env == NULL || env[0] != '/')
+        return EXIT_GONE;
+    if ((m->base = strdup(env)) == NULL || (m->cwd = base_getcwd()) == NULL) {
+        base_map_free(m);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    for (len = strlen(m->base); len > 1 && m->base[len - 1] == '/'; len--)
+        m->base[len - 1] = '\0';
+
+    if (!str_startswith(m->base, m->cwd)
+        || (m->cwd[len] != '/' && m->cwd[len] != '\0')
+        || strpbrk(m->cwd, "\"\\\n") || str_equal(m->base, "/")) {
+        base_map_free(m);
+        return EXIT_GONE;
+    }
+
+    for (n = 0, p = m->cwd + len; *p; p++) {
+        if (*p == '/' && p[1] != '/' && p[1] != '\0')
+            n++;
+    }
+    up_len = n ? 3 * n - 1 : 1;
+    if ((m->up = malloc(up_len + 1)) == NULL) {
+        base_map_free(m);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    if (n == 0) {
+        strcpy(m->up, ".");
+    } else {
+        for (p = m->up; n > 0; n--, p += 3)
+            memcpy(p, "../", 3);
+        m->up[up_len] = '\0';
+    }
+    return 0;
+}
+
+
+/*
+ * whether @p argv maps prefixes of file names itself
+ */
+static int base_has_maps(char **argv)
+{
+    int i;
+
+    for (i = 1; argv[i]; i++) {
+        if (str_startswith("-fdebug-prefix-map=", argv[i])
+            || str_startswith("-fmacro-prefix-map=", argv[i])
+            || str_startswith("-ffile-prefix-map=", argv[i]))
+            return 1;
+    }
+    return 0;
+}
+
+
+/*
+ * the prefix map option of @p from to @p to, for the debug info or the
+ * macros as @p kind says
+ */
+static char *base_map_option(const char *kind, const char *from,
+                             const char *to)
+{
+    char *opt;
+
+    if (asprintf(&opt, "-f%s-prefix-map=%s=%s", kind, from, to) == -1)
+        return NULL;
+    return opt;
+}
+
+
+/**
+ * Whether the compile @p argv got its prefix maps from
+ * base_expand_options(), in which case @p m is set up for
+ * base_marker(), and has to be freed with base_map_free().
+ **/
+int base_map_for(char **argv, struct base_map *m)
+{
+    char *opt;
+    int i, found = 0;
+
+    if (!base_cc_ok(argv[0]) || base_map_init(m) != 0)
+        return 0;
+    if ((opt = base_map_option("debug", m->cwd, ".")) != NULL) {
+        for (i = 1; argv[i] && !found; i++)
+            found = str_equal(argv[i], opt);
+        free(opt);
+    }
+    if (!found)
+        base_map_free(m);
+    return found;
+}
+
+
+/**
+ * With MRCC_BASE_DIR above the working directory, map the paths below
+ * it to relative ones in the debug info and the macros of the compile
+ * @p *argv_ptr, see base_normalize().  Returns nonzero only if out of
+ * memory; otherwise the command is left as it was.
+ *
+ * The argv array pointed to by argv_ptr when this function is called
+ * must have been dynamically allocated.  It remains the caller's
+ * responsibility to deallocate it.
+ **/
+int base_expand_options(char ***argv_ptr)
+{
+    static const char *const kinds[] = { "debug", "macro" };
+    char **argv = *argv_ptr;
+    char **new_argv;
+    char *opts[4];
+    struct base_map m;
+    int n_kinds, n = 0, i, ret = 0;
+
+    if (!base_cc_ok(argv[0]) || base_has_maps(argv))
+        return 0;
+    if ((ret = base_map_init(&m)) != 0)
+        return ret == EXIT_OUT_OF_MEMORY ? ret : 0;
+
+    n_kinds = getenv_bool("MRCC_BASE_MACROS", 1) ? 2 : 1;
+    for (i = 0; i < n_kinds && ret == 0; i++) {
+        /* the last one is tried first */
+        if (!str_equal(m.cwd, m.base)
+            && (opts[n++] = base_map_option(kinds[i], m.base, m.up)) == NULL)
+            ret = EXIT_OUT_OF_MEMORY;
+        else if ((opts[n++] = base_map_option(kinds[i], m.cwd, ".")) == NULL)
+            ret = EXIT_OUT_OF_MEMORY;
+    }
+    if (ret == 0 && copy_argv(argv, &new_argv, n) != 0)
+        ret = EXIT_OUT_OF_MEMORY;
+    if (ret != 0) {
+        while (n > 0)
+            free(opts[--n]);
+        base_map_free(&m);
+        return ret;
+    }
+    for (i = 0; i < n; i++)
+        argv_append(new_argv, opts[i]);
+    free_argv(argv);
+    *argv_ptr = new_argv;
+    rs_trace("paths below %s are relative to %s", m.base, m.cwd);
+    base_map_free(&m);
+    return 0;
+}
+
+
+/*
+ * whether @p line is a line marker, "# LINENUM "FILENAME" FLAGS"
+ */
+static int base_is_marker(const char *line)
+{
+    if (line[0] != '#')
+        return 0;
+    if (str_startswith("#line ", line))
+        line += 5;
+    else
+        line++;
+    while (*line == ' ')
+        line++;
+    return isdigit((unsigned char) *line);
+}
+
+
+/*
+ * whether @p path starts with the directory @p dir of length @p len
+ */
+static int base_in_dir(const char *path, const char *dir, size_t len)
+{
+    return strncmp(path, dir, len) == 0
+        && (path[len] == '/' || path[len] == '"');
+}
+
+
+/**
+ * The line @p line of a .i as base_normalize() rewrites it, or NULL if
+ * it stays as it is.
+ **/
+char *base_marker(const struct base_map *m, const char *line)
+{
+    const char *path;
+    size_t cwd_len = strlen(m->cwd), base_len = strlen(m->base);
+    char *out;
+    int n;
+
+    if (!base_is_marker(line) || (path = strchr(line, '"')) == NULL
+        || path[1] != '/')
+        return NULL;
+    path++;
+    n = path - line;
+    if (base_in_dir(path, m->cwd, cwd_len)) {
+        if (asprintf(&out, "%.*s.%s", n, line, path + cwd_len) == -1)
+            return NULL;
+    } else if (base_in_dir(path, m->base, base_len)) {
+        if (asprintf(&out, "%.*s%s%s", n, line, m->up,
+                     path + base_len) == -1)
+            return NULL;
+    } else {
+        return NULL;
+    }
+    return out;
+}
+
+
+/**
+ * If @p arg is one of the prefix maps of @p m, the part of it that does
+ * not depend on the checkout, "=TO"; otherwise NULL.
+ **/
+const char *base_map_target(const struct base_map *m, const char *arg)
+{
+    size_t len;
+
+    if (str_startswith("-fdebug-prefix-map=", arg)
+        || str_startswith("-fmacro-prefix-map=", arg))
+        arg += strlen("-fdebug-prefix-map=");
+    else
+        return NULL;
+    if (str_startswith(m->cwd, arg) && str_equal(arg + strlen(m->cwd), "=."))
+        return arg + strlen(m->cwd);
+    len = strlen(m->base);
+    if (strncmp(arg, m->base, len) == 0 && arg[len] == '='
+        && str_equal(arg + len + 1, m->up))
+        return arg + len;
+    return NULL;
+}
+
+
+/**
+ * If the compile @p argv got its prefix maps from base_expand_options(),
+ * rewrite the line markers of the preprocessed source @p cpp_fname the
+ * same way, and hash it on the way into @p digest, which must have
+ * space for HASH_HEX_LEN + 1 chars; otherwise @p digest is set to "".
+ * The .i is replaced rather than written to.
+ **/
+int base_normalize(char **argv, const char *cpp_fname, char *digest)
+{
+    struct base_map m;
+    struct hash_state hs;
+    char *tmp_fname, *line = NULL, *marker;
+    size_t line_size = 0;
+    ssize_t len;
+    FILE *in, *out;
+    int ret = 0;
+
+    digest[0] = '\0';
+    if (!base_map_for(argv, &m))
+        return 0;
+
+    if (asprintf(&tmp_fname, "%s.base", cpp_fname) == -1) {
+        base_map_free(&m);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    if ((in = fopen(cpp_fname, "r")) == NULL) {
+        rs_log_error("failed to open %s: %s", cpp_fname, strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+    if ((out = fopen(tmp_fname, "w")) == NULL) {
+        rs_log_error("failed to create %s: %s", tmp_fname, strerror(errno));
+        fclose(in);
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+    hash_init(&hs);
+    while ((len = getline(&line, &line_size, in)) != -1) {
+        if (strlen(line) == (size_t) len
+            && (marker = base_marker(&m, line)) != NULL) {
+            fputs(marker, out);
+            hash_update(&hs, marker, strlen(marker));
+            free(marker);
+        } else {
+            fwrite(line, 1, len, out);
+            hash_update(&hs, line, len);
+        }
+    }
+    free(line);
+    fclose(in);
+    if (fclose(out) != 0) {
+        rs_log_error("failed to write %s", tmp_fname);
+        ret = EXIT_IO_ERROR;
+    } else if (rename(tmp_fname, cpp_fname) == -1) {
+        rs_log_error("rename %s to %s failed: %s",
+                     tmp_fname, cpp_fname, strerror(errno));
+        ret = EXIT_IO_ERROR;
+    } else {
+        hash_final_hex(&hs, digest);
+    }
+    if (ret != 0)
+        unlink(tmp_fname);
+
+  out:
+    free(tmp_fname);
+    base_map_free(&m);
+    return ret;
+}
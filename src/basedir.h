@@ -0,0 +1,20 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_BASEDIR_H
+# define _HEADER_BASEDIR_H
+
+struct base_map {
+    char *cwd;          /* as the compiler sees it */
+    char *base;
+    char *up;           /* from cwd to base */
+};
+
+int base_expand_options(char ***argv_ptr);
+int base_map_for(char **argv, struct base_map *m);
+void base_map_free(struct base_map *m);
+char *base_marker(const struct base_map *m, const char *line);
+const char *base_map_target(const struct base_map *m, const char *arg);
+int base_normalize(char **argv, const char *cpp_fname, char *digest);
+
+#endif //_HEADER_BASEDIR_H
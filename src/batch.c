@@ -0,0 +1,1331 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "files.h"
+#include "tempfile.h"
+#include "cleanup.h"
+#include "lock.h"
+#include "netfsutils.h"
+#include "mrutils.h"
+#include "remote.h"
+#include "hash.h"
+#include "io.h"
+#include "pack.h"
+#include "resdb.h"
+#include "batch.h"
+
+/**
+ * @file
+ *
+ * Batch mode: many compiles, one MapReduce job.
+ *
+ * Starting a streaming job costs seconds, which is more than most
+ * compiles.  With MRCC_BATCH=1 every mrcc process drops its unit into a
+ * spool directory (~/.mrcc/batch) instead of starting its own job.  One
+ * of the waiting processes becomes the leader: it waits a short window
+ * for more units to arrive, takes everything in the spool, packs the
+ * units into map splits and runs one job for all of them.  It then
+ * writes a .done record for every unit, which is what the other
+ * processes are waiting for.  The object files come back through the
+ * net fs as usual.
+ *
+ * So only the leaders run a hadoop client; the others sleep in inotify
+ * on the spool until their .done record appears, or a new unit shows up
+ * that may need a leader.  Without inotify they poll every
+ * MRCC_BATCH_POLL ms.
+ *
+ * The job input has one line per map split, and NLineInputFormat gives
+ * every map task exactly one line.  Units of a split are separated by
+ * tabs; see batch_unit_format() for the unit record.
+ *
+ * The job takes as long as its slowest map task, so the splits are
+ * balanced on the expected compile time of their units, longest units
+ * first, see batch_pack().  The expected peak memory of each split stays
+ * under MRCC_BATCH_TASK_MEM (MB).  mrcc-map runs the units of a split
+ * in parallel and limits the map tasks on a node to what the node's
+ * memory can hold at that budget, see mapbatch.c.
+ *
+ * Predictions are wrong and nodes differ in speed.  With
+ * MRCC_BATCH_STEAL=1 a split is only where a map task starts: units are
+ * claimed through claim files in the batch's claim directory on the net
+ * fs, and a task that runs out of work of its own takes unclaimed units
+ * of the others.
+ *
+ * Units with the same preprocessed input, such as the PIC and non-PIC
+ * compiles of libtool, ship that input once and run in the same map
+ * task, see batch_share_inputs().
+ *
+ * The summary of a batch tells how many inputs the mappers found in
+ * their node cache.
+ *
+ * A small unit is not worth two net fs files and their name node round
+ * trips.  Inputs up to MRCC_BATCH_INLINE KB (default 256, 0 to turn it
+ * off) travel inside the unit record, base64 encoded, and the mapper
+ * sends the object of such a unit back in its output record if it is
+ * not bigger than that either.  The leader then writes the object to
+ * the unit's local output name, where get_result_fs() finds it.
+ *
+ * The inputs of the other units are not put to the net fs one by one
+ * either: the leader packs them into one file (see pack.c) and the units
+ * point at their slice.  Each map task puts its objects into one pack of
+ * its own, which the leader unpacks.  Either way the net fs sees a few
+ * files per batch instead of a few per unit.
+ *
+ * NLineInputFormat splits carry no block locations, so Hadoop places
+ * those map tasks anywhere and they pull their input over the network.
+ * With MRCC_BATCH_LOCAL=1 every split becomes a file of its own in the
+ * job input directory instead, with one unit per line and every input
+ * inline.  Each file is one split of the plain text input format, with
+ * the locations of its block, so the scheduler can run the map task
+ * where its data is.  Work stealing needs the whole batch in one file
+ * and is off in this mode.
+ **/
+
+struct batch {
+    char *dir;                  /* this batch's directory in the spool */
+    int n;
+    struct batch_unit **units;
+    char **recs;                /* buffers the units point into */
+    int *reported;
+};
+
+static const char *batch_unit_suffix = ".unit";
+static const char *batch_done_suffix = ".done";
+
+
+int batch_enabled(void)
+{
+    return getenv_bool("MRCC_BATCH", 0);
+}
+
+/*
+ * memory budget of one map task
+ */
+long batch_task_mem_kb(void)
+{
+    return getenv_int("MRCC_BATCH_TASK_MEM", 2048) * 1024L;
+}
+
+/*
+ * largest file that is sent inline in the job records, in bytes
+ */
+long batch_inline_max(void)
+{
+    return getenv_int("MRCC_BATCH_INLINE", 256) * 1024L;
+}
+
+/*
+ * whether cpp_fname goes to the mapper inside its unit record, instead of
+ * in the batch's input pack
+ */
+int batch_inline_input(const char *cpp_fname)
+{
+    struct stat st;
+
+    return batch_enabled() && stat(cpp_fname, &st) == 0
+        && st.st_size <= batch_inline_max();
+}
+
+
+/**
+ * Read the whole of @p fname into a new base64 string.
+ **/
+int batch_encode_file(const char *fname, char **b64_ret)
+{
+    FILE *fp;
+    struct stat st;
+    char *buf;
+    size_t len;
+
+    if ((fp = fopen(fname, "rb")) == NULL) {
+        rs_log_error("failed to open %s: %s", fname, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    if (fstat(fileno(fp), &st) == -1
+        || (buf = malloc(st.st_size + 1)) == NULL) {
+        fclose(fp);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    len = fread(buf, 1, st.st_size, fp);
+    fclose(fp);
+
+    *b64_ret = base64_encode(buf, len);
+    free(buf);
+    return *b64_ret ? 0 : EXIT_OUT_OF_MEMORY;
+}
+
+
+/**
+ * Write @p len chars of base64 @p b64, decoded, to @p fname.  The file
+ * is renamed into place, so it is complete if it exists at all.
+ **/
+int batch_decode_file(const char *b64, size_t len, const char *fname)
+{
+    char *buf = NULL, *tmp_fname = NULL;
+    size_t buf_len;
+    FILE *fp;
+    int ret = 0;
+
+    if ((buf = malloc(len / 4 * 3 + 1)) == NULL
+        || asprintf(&tmp_fname, "%s.%d.tmp", fname, (int) getpid()) == -1) {
+        free(buf);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    if (base64_decode(b64, len, buf, &buf_len) != 0) {
+        rs_log_error("bad inline data for %s", fname);
+        ret = EXIT_PROTOCOL_ERROR;
+    } else if ((fp = fopen(tmp_fname, "wb")) == NULL) {
+        rs_log_error("failed to create %s: %s", tmp_fname, strerror(errno));
+        ret = EXIT_IO_ERROR;
+    } else {
+        fwrite(buf, 1, buf_len, fp);
+        if (fclose(fp) != 0 || rename(tmp_fname, fname) == -1) {
+            rs_log_error("failed to write %s: %s", fname, strerror(errno));
+            unlink(tmp_fname);
+            ret = EXIT_IO_ERROR;
+        }
+    }
+
+    free(buf);
+    free(tmp_fname);
+    return ret;
+}
+
+
+/*
+ * Parse a unit record, in place.
+ *
+ * A record is a list of "name=value" attributes followed by the compiler
+ * command line, all separated by single spaces:
+ *
+ *     key=KEY h=DIGEST isize=N mem=KB cost=MS
+ *     i=CPP_FNAME o=OUT_FNAME data=BASE64 pk=OFFSET,LENGTH db=DUMPBASE
+ *     pch=DIGEST keep=1 mods=NAME=DIGEST,... tc=FINGERPRINT
+ *     cc -c ...
+ *
+ * Attribute names are lower case letters.  The command line starts at the
+ * first word that is not an attribute; it always starts with the compiler
+ * name, which has no '='.  Unknown attributes are skipped so that old
+ * mappers can read records from newer masters.
+ */
+int batch_unit_parse(char *rec, struct batch_unit *u)
+{
+    char *p, *end, *eq;
+
+    memset(u, 0, sizeof *u);
+    u->split = -1;
+
+    for (p = rec; *p; p = end) {
+        while (*p == ' ')
+            p++;
+        for (eq = p; *eq >= 'a' && *eq <= 'z'; eq++)
+            ;
+        if (eq == p || *eq != '=') {
+            u->argv = p;
+            break;
+        }
+        *eq = '\0';
+        if ((end = strchr(eq + 1, ' ')) != NULL)
+            *end++ = '\0';
+        else
+            end = eq + 1 + strlen(eq + 1);
+
+        if (str_equal(p, "key"))
+            u->key = eq + 1;
+        else if (str_equal(p, "h"))
+            u->digest = eq + 1;
+        else if (str_equal(p, "i"))
+            u->cpp_fname = eq + 1;
+        else if (str_equal(p, "o"))
+            u->out_fname = eq + 1;
+        else if (str_equal(p, "data"))
+            u->data = eq + 1;
+        else if (str_equal(p, "same"))
+            u->same = eq + 1;
+        else if (str_equal(p, "db"))
+            u->dumpbase = eq + 1;
+        else if (str_equal(p, "pch"))
+            u->pch = eq + 1;
+        else if (str_equal(p, "keep"))
+            u->keep = atoi(eq + 1);
+        else if (str_equal(p, "mods"))
+            u->mods = eq + 1;
+        else if (str_equal(p, "tc"))
+            u->tc = eq + 1;
+        else if (str_equal(p, "pk"))
+            u->packed = sscanf(eq + 1, "%ld,%ld",
+                               &u->pack_off, &u->pack_len) == 2;
+        else if (str_equal(p, "isize"))
+            u->isize = atol(eq + 1);
+        else if (str_equal(p, "mem"))
+            u->mem_kb = atol(eq + 1);
+        else if (str_equal(p, "cost"))
+            u->cost_ms = atol(eq + 1);
+    }
+
+    if (u->cpp_fname == NULL || u->out_fname == NULL
+        || u->argv == NULL || *u->argv == '\0') {
+        rs_log_error("bad unit record");
+        return EXIT_PROTOCOL_ERROR;
+    }
+    return 0;
+}
+
+
+int batch_unit_format(FILE *fp, const struct batch_unit *u)
+{
+    if (u->key)
+        fprintf(fp, "key=%s ", u->key);
+    if (u->digest)
+        fprintf(fp, "h=%s ", u->digest);
+    fprintf(fp, "isize=%ld mem=%ld cost=%ld i=%s o=%s ",
+            u->isize, u->mem_kb, u->cost_ms,
+            u->cpp_fname, u->out_fname);
+    if (u->data)
+        fprintf(fp, "data=%s ", u->data);
+    if (u->same)
+        fprintf(fp, "same=%s ", u->same);
+    if (u->packed)
+        fprintf(fp, "pk=%ld,%ld ", u->pack_off, u->pack_len);
+    if (u->dumpbase)
+        fprintf(fp, "db=%s ", u->dumpbase);
+    if (u->pch)
+        fprintf(fp, "pch=%s ", u->pch);
+    if (u->keep)
+        fputs("keep=1 ", fp);
+    if (u->mods)
+        fprintf(fp, "mods=%s ", u->mods);
+    if (u->tc)
+        fprintf(fp, "tc=%s ", u->tc);
+    fputs(u->argv, fp);
+    return ferror(fp) ? EXIT_IO_ERROR : 0;
+}
+
+
+static int cmp_unit_cost_desc(const void *a, const void *b)
+{
+    const struct batch_unit *ua = *(struct batch_unit * const *) a;
+    const struct batch_unit *ub = *(struct batch_unit * const *) b;
+
+    if (ua->cost_ms != ub->cost_ms)
+        return ua->cost_ms < ub->cost_ms ? 1 : -1;
+    if (ua->mem_kb != ub->mem_kb)
+        return ua->mem_kb < ub->mem_kb ? 1 : -1;
+    return 0;
+}
+
+/**
+ * Pack @p units into map splits of about equal expected compile time,
+ * longest processing time first: the units are sorted by expected cost
+ * and each goes to the least loaded split that still has room for it.
+ * A split takes at most @p split_units units whose expected peak memory
+ * adds up to at most @p task_mem_kb; when no split has room a new one is
+ * opened.  A unit bigger than the budget gets a split of its own.
+ *
+ * There are at least @p min_splits splits, and at least as many as the
+ * unit and memory limits need, so the first units spread out across the
+ * mappers instead of piling up in the first split.
+ *
+ * Sets the split of every unit and returns the number of splits; the
+ * load of the most loaded split goes to @p max_load.  @p units is
+ * reordered, longest first, which is also the order in which mrcc-map
+ * should start them.
+ **/
+int batch_pack(struct batch_unit **units, int n,
+               long task_mem_kb, int split_units, int min_splits,
+               long *max_load)
+{
+    long *split_mem, *split_load;
+    long total_mem = 0;
+    int *split_n;
+    int n_splits;
+    int i, s, least;
+
+    *max_load = 0;
+    if (n == 0)
+        return 0;
+    if (split_units < 1)
+        split_units = 1;
+
+    split_mem = calloc(n, sizeof *split_mem);
+    split_load = calloc(n, sizeof *split_load);
+    split_n = calloc(n, sizeof *split_n);
+    if (!split_mem || !split_load || !split_n) {
+        free(split_mem);
+        free(split_load);
+        free(split_n);
+        return -1;
+    }
+
+    for (i = 0; i < n; i++)
+        total_mem += units[i]->mem_kb;
+    n_splits = (n + split_units - 1) / split_units;
+    if (task_mem_kb > 0 && (total_mem + task_mem_kb - 1) / task_mem_kb > n_splits)
+        n_splits = (int) ((total_mem + task_mem_kb - 1) / task_mem_kb);
+    if (min_splits > n_splits)
+        n_splits = min_splits;
+    if (n_splits > n)
+        n_splits = n;
+
+    qsort(units, n, sizeof *units, cmp_unit_cost_desc);
+
+    for (i = 0; i < n; i++) {
+        least = -1;
+        for (s = 0; s < n_splits; s++) {
+            if (split_n[s] >= split_units)
+                continue;
+            if (split_n[s] > 0
+                && split_mem[s] + units[i]->mem_kb > task_mem_kb)
+                continue;
+            if (least == -1 || split_load[s] < split_load[least])
+                least = s;
+        }
+        if (least == -1)
+            least = n_splits++;
+
+        units[i]->split = least;
+        split_mem[least] += units[i]->mem_kb;
+        split_load[least] += units[i]->cost_ms;
+        split_n[least]++;
+    }
+
+    for (s = 0; s < n_splits; s++) {
+        rs_trace("split %d: %d units, %ld KB, %ldms",
+                 s, split_n[s], split_mem[s], split_load[s]);
+        if (split_load[s] > *max_load)
+            *max_load = split_load[s];
+    }
+
+    free(split_mem);
+    free(split_load);
+    free(split_n);
+    return n_splits;
+}
+
+
+/*
+ * write a small file so that readers see either nothing or all of it
+ */
+static int write_file_atomic(const char *fname, const char *content)
+{
+    char *tmp_fname = NULL;
+    FILE *fp;
+    int ret = 0;
+
+    if (asprintf(&tmp_fname, "%s.%d.tmp", fname, (int) getpid()) == -1)
+        return EXIT_OUT_OF_MEMORY;
+
+    if ((fp = fopen(tmp_fname, "w")) == NULL) {
+        rs_log_error("failed to create %s: %s", tmp_fname, strerror(errno));
+        free(tmp_fname);
+        return EXIT_IO_ERROR;
+    }
+    fputs(content, fp);
+    if (fclose(fp) != 0 || rename(tmp_fname, fname) == -1) {
+        rs_log_error("failed to write %s: %s", fname, strerror(errno));
+        unlink(tmp_fname);
+        ret = EXIT_IO_ERROR;
+    }
+    free(tmp_fname);
+    return ret;
+}
+
+
+/*
+ * read a whole file into a new '\0' terminated buffer
+ */
+static int read_file_str(const char *fname, char **buf_ret)
+{
+    FILE *fp;
+    struct stat st;
+    char *buf;
+    size_t len;
+
+    if ((fp = fopen(fname, "r")) == NULL)
+        return EXIT_NO_SUCH_FILE;
+    if (fstat(fileno(fp), &st) == -1
+        || (buf = malloc(st.st_size + 1)) == NULL) {
+        fclose(fp);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    len = fread(buf, 1, st.st_size, fp);
+    fclose(fp);
+    buf[len] = '\0';
+    /* records are single lines */
+    if (len > 0 && buf[len - 1] == '\n')
+        buf[len - 1] = '\0';
+
+    *buf_ret = buf;
+    return 0;
+}
+
+
+static int spool_fname(const char *spool, const char *cpp_fname,
+                       const char *suffix, char **fname_ret)
+{
+    if (asprintf(fname_ret, "%s/%s%s", spool, find_basename(cpp_fname),
+                 suffix) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    return 0;
+}
+
+
+static int batch_add_unit(struct batch *b, char *rec)
+{
+    struct batch_unit *u;
+    void *p;
+
+    if ((u = malloc(sizeof *u)) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    if (batch_unit_parse(rec, u) != 0) {
+        free(u);
+        return EXIT_PROTOCOL_ERROR;
+    }
+
+    if ((p = realloc(b->units, (b->n + 1) * sizeof *b->units)) == NULL) {
+        free(u);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    b->units = p;
+    if ((p = realloc(b->recs, (b->n + 1) * sizeof *b->recs)) == NULL) {
+        free(u);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    b->recs = p;
+
+    b->units[b->n] = u;
+    b->recs[b->n] = rec;
+    b->n++;
+    return 0;
+}
+
+
+static void batch_free(struct batch *b)
+{
+    int i;
+
+    for (i = 0; i < b->n; i++) {
+        free(b->units[i]);
+        free(b->recs[i]);
+    }
+    free(b->units);
+    free(b->recs);
+    free(b->reported);
+    free(b->dir);
+}
+
+
+/*
+ * the directory of the batch @p b, in the spool @p spool
+ */
+static int batch_make_dir(const char *spool, struct batch *b)
+{
+    if (asprintf(&b->dir, "%s/batch_XXXXXX", spool) == -1) {
+        b->dir = NULL;
+        return EXIT_OUT_OF_MEMORY;
+    }
+    if (mkdtemp(b->dir) == NULL) {
+        rs_log_error("mkdtemp %s failed: %s", b->dir, strerror(errno));
+        free(b->dir);
+        b->dir = NULL;
+        return EXIT_IO_ERROR;
+    }
+    return add_cleanup(b->dir);
+}
+
+
+/*
+ * Wait for the batch window, then move every pending unit of the spool
+ * into a new batch directory.  Called with the leader lock held.
+ */
+static int batch_collect(const char *spool, struct batch *b)
+{
+    DIR *d;
+    struct dirent *de;
+    char *from = NULL, *to = NULL, *rec;
+    int ret = 0;
+
+    poll(NULL, 0, getenv_int("MRCC_BATCH_WINDOW", 500));
+
+    if ((d = opendir(spool)) == NULL) {
+        rs_log_error("opendir %s failed: %s", spool, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    while ((de = readdir(d)) != NULL) {
+        if (!str_endswith(batch_unit_suffix, de->d_name))
+            continue;
+        /* no directory for a batch that turns out empty */
+        if (b->dir == NULL && (ret = batch_make_dir(spool, b)))
+            break;
+        if (asprintf(&from, "%s/%s", spool, de->d_name) == -1
+            || asprintf(&to, "%s/%s", b->dir, de->d_name) == -1) {
+            ret = EXIT_OUT_OF_MEMORY;
+            break;
+        }
+        /* the owner may have given up on it just now */
+        if (rename(from, to) == 0) {
+            add_cleanup(to);
+            if (read_file_str(to, &rec) == 0 && batch_add_unit(b, rec) != 0)
+                free(rec);
+        }
+        free(from);
+        free(to);
+        from = to = NULL;
+    }
+    closedir(d);
+
+    if (b->dir)
+        rs_trace("collected %d units into %s", b->n, b->dir);
+    return ret;
+}
+
+
+static int batch_write_input(struct batch *b, int n_splits, char *input)
+{
+    FILE *fp;
+    int s, i, first;
+    int ret = 0;
+
+    if ((fp = fopen(input, "w")) == NULL) {
+        rs_log_error("failed to create %s: %s", input, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    for (s = 0; s < n_splits && ret == 0; s++) {
+        first = 1;
+        for (i = 0; i < b->n && ret == 0; i++) {
+            if (b->units[i]->split != s)
+                continue;
+            if (!first)
+                fputc('\t', fp);
+            ret = batch_unit_format(fp, b->units[i]);
+            first = 0;
+        }
+        fputc('\n', fp);
+    }
+    if (fclose(fp) != 0 && ret == 0)
+        ret = EXIT_IO_ERROR;
+    return ret;
+}
+
+
+/*
+ * Write the data-local job input: one file per split, one unit per line,
+ * every input inline.
+ */
+static int batch_write_local_input(struct batch *b, int n_splits,
+                                   const char *input_dir)
+{
+    struct batch_unit *u;
+    char *fname, *data;
+    FILE *fp = NULL;
+    int s, i;
+    int ret = 0;
+
+    if (mkdir(input_dir, 0777) == -1) {
+        rs_log_error("mkdir %s failed: %s", input_dir, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    for (s = 0; s < n_splits && ret == 0; s++) {
+        if (asprintf(&fname, "%s/split_%05d", input_dir, s) == -1)
+            return EXIT_OUT_OF_MEMORY;
+        if ((fp = fopen(fname, "w")) == NULL) {
+            rs_log_error("failed to create %s: %s", fname, strerror(errno));
+            free(fname);
+            return EXIT_IO_ERROR;
+        }
+        add_cleanup(fname);
+        free(fname);
+
+        for (i = 0; i < b->n && ret == 0; i++) {
+            u = b->units[i];
+            if (u->split != s)
+                continue;
+            data = NULL;
+            if (u->data == NULL && u->same == NULL
+                && (ret = batch_encode_file(u->cpp_fname, &data)) == 0)
+                u->data = data;
+            if (ret == 0)
+                ret = batch_unit_format(fp, u);
+            fputc('\n', fp);
+            if (data) {
+                u->data = NULL;
+                free(data);
+            }
+        }
+        if (fclose(fp) != 0 && ret == 0)
+            ret = EXIT_IO_ERROR;
+    }
+    return ret;
+}
+
+
+static int batch_report(const char *spool, const char *cpp_fname,
+                        int status, long mem_kb, long msec)
+{
+    char *fname, *content;
+    int ret;
+
+    if ((ret = spool_fname(spool, cpp_fname, batch_done_suffix, &fname)))
+        return ret;
+    if (asprintf(&content, "%d %ld %ld\n", status, mem_kb, msec) == -1) {
+        free(fname);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    ret = write_file_atomic(fname, content);
+    free(content);
+    free(fname);
+    return ret;
+}
+
+
+/*
+ * Find the units whose preprocessed input is the same as that of an
+ * earlier unit, as the PIC and non-PIC compiles of libtool mostly are:
+ * -DPIC is a local option, and -fPIC only matters if the source looks at
+ * __PIC__.  Such a variant drops its own input and takes the earlier
+ * unit's, in the same split.
+ *
+ * The variants are moved behind the other units, and their cost and
+ * memory are lent to the unit they share with for packing; returns the
+ * number of the others.  batch_place_variants() undoes the loan.
+ */
+static int batch_share_inputs(struct batch *b)
+{
+    struct batch_unit *u, *first;
+    int n_first = 0;
+    int i, j;
+
+    for (i = 0; i < b->n; i++) {
+        u = b->units[i];
+        first = NULL;
+        for (j = 0; u->digest && j < n_first; j++) {
+            if (b->units[j]->digest
+                && str_equal(b->units[j]->digest, u->digest)) {
+                first = b->units[j];
+                break;
+            }
+        }
+        if (first == NULL) {
+            b->units[i] = b->units[n_first];
+            b->units[n_first++] = u;
+            continue;
+        }
+        rs_trace("%s shares the input of %s", u->cpp_fname,
+                 first->cpp_fname);
+        u->same = (char *) find_basename(first->cpp_fname);
+        u->data = NULL;
+        first->cost_ms += u->cost_ms;
+        first->mem_kb += u->mem_kb;
+    }
+    return n_first;
+}
+
+
+/*
+ * put the variants into the splits of the units they share with
+ */
+static void batch_place_variants(struct batch *b, int n_first)
+{
+    struct batch_unit *u, *first;
+    int i, j;
+
+    for (i = n_first; i < b->n; i++) {
+        u = b->units[i];
+        for (j = 0; j < n_first; j++) {
+            first = b->units[j];
+            if (str_equal(find_basename(first->cpp_fname), u->same))
+                break;
+        }
+        u->split = first->split;
+        first->cost_ms -= u->cost_ms;
+        first->mem_kb -= u->mem_kb;
+    }
+}
+
+
+/*
+ * Pack the inputs of the units that do not carry them inline into one
+ * file, put it to the net fs, and point the units at their slices.
+ */
+static int batch_put_inputs(struct batch *b, const char *pack,
+                            const char *fs_pack, char *digest,
+                            int *n_packed)
+{
+    struct pack_writer w;
+    struct batch_unit *u;
+    int i;
+    int ret;
+
+    *n_packed = 0;
+    for (i = 0; i < b->n; i++) {
+        if (b->units[i]->data == NULL && b->units[i]->same == NULL)
+            break;
+    }
+    if (i == b->n)
+        return 0;
+
+    add_cleanup(pack);
+    if ((ret = pack_create(pack, &w)))
+        return ret;
+    for (i = 0; i < b->n; i++) {
+        u = b->units[i];
+        if (u->data || u->same)
+            continue;
+        if ((ret = pack_add_file(&w, find_basename(u->cpp_fname),
+                                 u->cpp_fname, &u->pack_off,
+                                 &u->pack_len))) {
+            pack_finish(&w);
+            return ret;
+        }
+        u->packed = 1;
+        (*n_packed)++;
+    }
+    if ((ret = pack_finish(&w)) || (ret = hash_file_hex(pack, digest)))
+        return ret;
+
+    if (put_file_fs((char *) pack, (char *) fs_pack) != 0) {
+        rs_log_error("put batch inputs \"%s\" to net fs failed", pack);
+        return EXIT_PUT_CPP_FS_FAILED;
+    }
+    add_cleanup_fs((char *) fs_pack);
+    return 0;
+}
+
+
+/*
+ * Fetch an output pack of a map task and unpack the objects of all
+ * units that point into it.
+ */
+static void batch_get_outputs(struct batch *b, const char *fs_opack_dir,
+                              char **opacks, int *status, int first)
+{
+    char *fs_opack = NULL, *opack = NULL;
+    const char *name = opacks[first];
+    long off, len;
+    int fd = -1;
+    int i;
+    int ret;
+
+    if (asprintf(&fs_opack, "%s/%s", fs_opack_dir, name) == -1
+        || asprintf(&opack, "%s/%s", b->dir, name) == -1) {
+        ret = EXIT_OUT_OF_MEMORY;
+    } else {
+        add_cleanup(opack);
+        if (get_file_fs(fs_opack, opack) != 0) {
+            rs_log_error("get output pack \"%s\" failed", fs_opack);
+            ret = EXIT_GET_CPP_FS_FAILED;
+        } else if ((fd = open(opack, O_RDONLY)) == -1) {
+            ret = EXIT_IO_ERROR;
+        } else {
+            ret = 0;
+        }
+    }
+
+    for (i = first; i < b->n; i++) {
+        if (opacks[i] == NULL || !str_equal(opacks[i], name))
+            continue;
+        if (ret == 0 && status[i] == 0) {
+            if (pack_lookup(fd, find_basename(b->units[i]->out_fname),
+                            &off, &len) != 0
+                || pack_extract(fd, off, len, b->units[i]->out_fname) != 0)
+                status[i] = EXIT_PROTOCOL_ERROR;
+        } else if (status[i] == 0) {
+            status[i] = ret;
+        }
+        /* done with this one */
+        if (i != first) {
+            free(opacks[i]);
+            opacks[i] = NULL;
+        }
+    }
+
+    if (fd != -1)
+        close(fd);
+    if (opack)
+        unlink(opack);
+    free(opack);
+    free(fs_opack);
+}
+
+
+/*
+ * Read the mapper records, one line per unit:
+ *     CPP_FNAME <tab> STATUS <tab> PEAK_RSS_KB <tab> MSEC <tab> CACHE_HIT
+ *     [<tab> OBJECT_BASE64 | <tab> @OUTPUT_PACK]
+ * deliver the objects that came inline or in output packs, and pass the
+ * results on to the waiting processes.
+ */
+static int batch_results(const char *spool, struct batch *b,
+                         const char *results, const char *fs_opack_dir,
+                         int *n_failed, int *n_hits)
+{
+    FILE *fp;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+    char *cpp_fname, *p, *data;
+    struct resdb_entry *e = NULL;
+    int *status = NULL;
+    char **opacks = NULL;
+    int hit, i, j;
+
+    *n_failed = 0;
+    *n_hits = 0;
+    e = calloc(b->n, sizeof *e);
+    status = calloc(b->n, sizeof *status);
+    opacks = calloc(b->n, sizeof *opacks);
+    if (!e || !status || !opacks)
+        goto out;
+    for (i = 0; i < b->n; i++)
+        status[i] = EXIT_MAPPER_FAILED;
+
+    if ((fp = fopen(results, "r")) != NULL) {
+        while ((len = getline(&line, &line_size, fp)) != -1) {
+            if (len > 0 && line[len - 1] == '\n')
+                line[--len] = '\0';
+            cpp_fname = line;
+            if ((p = strchr(line, '\t')) == NULL)
+                continue;
+            *p++ = '\0';
+            for (i = 0; i < b->n; i++) {
+                if (!b->reported[i]
+                    && str_equal(b->units[i]->cpp_fname, cpp_fname))
+                    break;
+            }
+            hit = 0;
+            if (i == b->n || sscanf(p, "%d %ld %ld %d", &status[i],
+                                    &e[i].mem_kb, &e[i].msec, &hit) < 3)
+                continue;
+
+            b->reported[i] = 1;
+            *n_hits += hit;
+
+            /* the object came inline or in a pack */
+            for (data = p, j = 0; data && j < 4; j++) {
+                if ((data = strchr(data, '\t')) != NULL)
+                    data++;
+            }
+            if (status[i] != 0 || data == NULL || *data == '\0')
+                continue;
+            if (*data == '@') {
+                if ((opacks[i] = strdup(data + 1)) == NULL)
+                    status[i] = EXIT_OUT_OF_MEMORY;
+            } else if (batch_decode_file(data, strlen(data),
+                                         b->units[i]->out_fname) != 0) {
+                status[i] = EXIT_PROTOCOL_ERROR;
+            }
+        }
+        free(line);
+        fclose(fp);
+    }
+
+    for (i = 0; i < b->n; i++) {
+        if (opacks[i])
+            batch_get_outputs(b, fs_opack_dir, opacks, status, i);
+    }
+
+out:
+    /* no news is bad news */
+    for (i = 0; i < b->n; i++) {
+        if (!status || !e) {
+            batch_report(spool, b->units[i]->cpp_fname,
+                         EXIT_OUT_OF_MEMORY, 0, 0);
+            (*n_failed)++;
+            continue;
+        }
+        batch_report(spool, b->units[i]->cpp_fname,
+                     status[i], e[i].mem_kb, e[i].msec);
+        if (status[i] != 0) {
+            (*n_failed)++;
+        } else if (b->units[i]->key) {
+            e[i].isize = b->units[i]->isize;
+            resdb_record(b->units[i]->key, &e[i]);
+        }
+    }
+
+    for (i = 0; opacks && i < b->n; i++)
+        free(opacks[i]);
+    free(opacks);
+    free(status);
+    free(e);
+    return 0;
+}
+
+
+static int batch_run(const char *spool, struct batch *b)
+{
+    char *input = NULL, *fs_input = NULL;
+    char *out_dir = NULL, *fs_out_dir = NULL;
+    char *results = NULL, *results_crc = NULL;
+    char *pack = NULL, *fs_pack = NULL, *fs_opack_dir = NULL;
+    char *fs_claim_dir = NULL;
+    char *cmdenv = NULL;
+    char digest[HASH_HEX_LEN + 1];
+    char summary[256];
+    struct timeval before, after, delta;
+    int n_splits = 0, n_failed = 0, n_hits = 0, n_packed = 0, n_first;
+    int local = getenv_bool("MRCC_BATCH_LOCAL", 0);
+    long max_load = 0;
+    int ret;
+
+    gettimeofday(&before, NULL);
+
+    if ((b->reported = calloc(b->n, sizeof *b->reported)) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+
+    n_first = batch_share_inputs(b);
+    n_splits = batch_pack(b->units, n_first, batch_task_mem_kb(),
+                          getenv_int("MRCC_BATCH_SPLIT_UNITS", 4),
+                          getenv_int("MRCC_BATCH_MAPS", 0), &max_load);
+    if (n_splits < 0) {
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+    batch_place_variants(b, n_first);
+
+    if (asprintf(&input, "%s/input", b->dir) == -1
+        || asprintf(&out_dir, "%s/out", b->dir) == -1
+        || asprintf(&results, "%s/results", b->dir) == -1
+        || asprintf(&results_crc, "%s/.results.crc", b->dir) == -1
+        || asprintf(&pack, "%s/input.pack", b->dir) == -1) {
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+    if ((fs_input = name_local_to_fs(input)) == NULL
+        || (fs_out_dir = name_local_to_fs(out_dir)) == NULL
+        || (fs_pack = name_local_to_fs(pack)) == NULL
+        || asprintf(&fs_opack_dir, "%s.packs", fs_out_dir) == -1) {
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+
+    if (!local
+        && (ret = batch_put_inputs(b, pack, fs_pack, digest, &n_packed)))
+        goto out;
+    if (n_packed > 0
+        && ((ret = mr_cmdenv(&cmdenv, "MRCC_BATCH_PACK", fs_pack))
+            || (ret = mr_cmdenv(&cmdenv, "MRCC_BATCH_PACK_DIGEST",
+                                   digest))))
+        goto out;
+    if ((ret = mr_cmdenv(&cmdenv, "MRCC_BATCH_OPACKS", fs_opack_dir)))
+        goto out;
+    add_cleanup_fs(fs_opack_dir);
+
+    add_cleanup(input);
+    if ((ret = local ? batch_write_local_input(b, n_splits, input)
+                     : batch_write_input(b, n_splits, input)))
+        goto out;
+    if (put_file_fs(input, fs_input) != 0) {
+        rs_log_error("put batch input \"%s\" to net fs failed", input);
+        ret = EXIT_PUT_CONFIG_FS_FAILED;
+        goto out;
+    }
+    add_cleanup_fs(fs_input);
+
+    if (!local && getenv_bool("MRCC_BATCH_STEAL", 0)) {
+        if (asprintf(&fs_claim_dir, "%s.claim", fs_input) == -1
+            || (ret = mr_cmdenv(&cmdenv, "MRCC_BATCH_QUEUE", fs_input))
+            || (ret = mr_cmdenv(&cmdenv, "MRCC_BATCH_CLAIMS",
+                                   fs_claim_dir))) {
+            ret = EXIT_OUT_OF_MEMORY;
+            goto out;
+        }
+        add_cleanup_fs(fs_claim_dir);
+    }
+
+    if ((ret = local ? mr_exec_batch_local(fs_input, fs_out_dir, cmdenv)
+                     : mr_exec_batch(fs_input, fs_out_dir, n_splits,
+                                     cmdenv)) != 0)
+        rs_log_warning("batch job %s returned %d", b->dir, ret);
+
+    add_cleanup(results);
+    add_cleanup(results_crc);
+    if (getmerge_file_fs(fs_out_dir, results) != 0)
+        rs_log_error("get batch results of %s failed", b->dir);
+    ret = 0;
+
+out:
+    /* whatever happened, nobody is left waiting */
+    batch_results(spool, b, ret == 0 ? results : "", fs_opack_dir,
+                  &n_failed, &n_hits);
+
+    gettimeofday(&after, NULL);
+    timeval_subtract(&delta, &after, &before);
+    snprintf(summary, sizeof summary,
+             "batch %s: %d units in %d splits, %d failed, %ld.%03lds "
+             "(slowest split expected %ldms), node cache hits %d/%d, "
+             "%d shared inputs",
+             find_basename(b->dir), b->n, n_splits, n_failed,
+             (long) delta.tv_sec, (long) delta.tv_usec / 1000, max_load,
+             n_hits, b->n, b->n - n_first);
+    mrcc_job_summary_clear();
+    mrcc_job_summary_append(summary);
+    mrcc_job_summary();
+
+    free(input);
+    free(fs_input);
+    free(out_dir);
+    free(fs_out_dir);
+    free(pack);
+    free(fs_pack);
+    free(fs_opack_dir);
+    free(fs_claim_dir);
+    free(cmdenv);
+    free(results);
+    free(results_crc);
+    return ret;
+}
+
+
+/*
+ * Be the leader for one batch, if our unit @p unit_fname is still in the
+ * spool and nobody else is collecting right now.  @p ran is set if a
+ * batch ran; otherwise our unit is in the batch of another leader, or
+ * will be, and there is nothing to do but wait.
+ */
+static int batch_try_lead(const char *spool, const char *unit_fname,
+                          int *ran)
+{
+    struct batch b;
+    char *lock_dir, *lock_fname;
+    int lock_fd;
+    int ret;
+
+    *ran = 0;
+    /* another leader took it; collecting would find nothing of ours */
+    if (access(unit_fname, F_OK) == -1)
+        return 0;
+    if ((ret = get_lock_dir(&lock_dir)))
+        return ret;
+    if (asprintf(&lock_fname, "%s/batch_leader", lock_dir) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    ret = mrcc_lock_file(lock_fname, 0, &lock_fd);
+    free(lock_fname);
+    if (ret)
+        return ret;
+
+    memset(&b, 0, sizeof b);
+    ret = batch_collect(spool, &b);
+
+    /* let the next batch start collecting while this one runs */
+    mrcc_unlock(lock_fd);
+
+    if (ret == 0 && b.n > 0) {
+        ret = batch_run(spool, &b);
+        *ran = 1;
+    }
+    batch_free(&b);
+    return ret;
+}
+
+
+/*
+ * watch the spool for records renamed into place, or return -1
+ */
+static int batch_watch_spool(const char *spool)
+{
+    int fd;
+
+    if ((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+        rs_trace("inotify_init1 failed: %s", strerror(errno));
+        return -1;
+    }
+    if (inotify_add_watch(fd, spool, IN_MOVED_TO) == -1) {
+        rs_trace("inotify_add_watch %s failed: %s", spool, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+/*
+ * Sleep until our done record @p done_name or a new unit appears in the
+ * spool, or for at most @p timeout_ms.
+ */
+static void batch_wait_spool(int watch_fd, const char *done_name,
+                             int timeout_ms)
+{
+    struct pollfd pfd;
+    struct timeval start, now, delta;
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev;
+    ssize_t len;
+    char *p;
+    int left;
+
+    if (watch_fd == -1) {
+        poll(NULL, 0, timeout_ms);
+        return;
+    }
+
+    gettimeofday(&start, NULL);
+    pfd.fd = watch_fd;
+    pfd.events = POLLIN;
+    for (left = timeout_ms; left > 0; ) {
+        if (poll(&pfd, 1, left) <= 0)
+            return;
+        while ((len = read(watch_fd, buf, sizeof buf)) > 0) {
+            for (p = buf; p < buf + len; p += sizeof *ev + ev->len) {
+                ev = (const struct inotify_event *) p;
+                if (ev->len == 0)
+                    continue;
+                if (str_equal(ev->name, done_name)
+                    || str_endswith(batch_unit_suffix, ev->name))
+                    return;
+            }
+        }
+        gettimeofday(&now, NULL);
+        timeval_subtract(&delta, &now, &start);
+        left = timeout_ms - (delta.tv_sec * 1000 + delta.tv_usec / 1000);
+    }
+}
+
+
+/**
+ * Compile one unit as part of a batch.  The preprocessed input is sent
+ * by the leader; the object is left at @p out_fname, or on the net fs.
+ *
+ * @returns 0 if the unit was compiled successfully, otherwise nonzero,
+ * in which case the caller falls back to a local compile.
+ **/
+int batch_compile(char *argv_str, char *cpp_fname, char *out_fname,
+                  const char *key, const struct remote_job *job)
+{
+    char *spool, *fs_cpp_fname;
+    char *unit_fname = NULL, *done_fname = NULL, *rec = NULL;
+    struct batch_unit u;
+    struct resdb_entry e;
+    struct stat st;
+    FILE *fp;
+    size_t rec_len;
+    time_t deadline;
+    int watch_fd = -1, poll_ms, ran;
+    int status = EXIT_MAPPER_FAILED;
+    long mem_kb = 0, msec = 0;
+    int ret;
+
+    /* a tab or newline would break the job input format */
+    if (strpbrk(argv_str, "\t\n")) {
+        rs_trace("cannot batch \"%s\"; running a job of its own", argv_str);
+        /* the input was left for the leader to put */
+        if ((fs_cpp_fname = name_local_to_fs(cpp_fname)) == NULL)
+            return EXIT_OUT_OF_MEMORY;
+        ret = put_file_fs(cpp_fname, fs_cpp_fname);
+        free(fs_cpp_fname);
+        if (ret != 0)
+            return EXIT_PUT_CPP_FS_FAILED;
+        return mr_exec(argv_str, cpp_fname, out_fname, job);
+    }
+
+    memset(&u, 0, sizeof u);
+    if ((ret = get_batch_dir(&spool)))
+        return ret;
+    if ((ret = spool_fname(spool, cpp_fname, batch_unit_suffix, &unit_fname))
+        || (ret = spool_fname(spool, cpp_fname, batch_done_suffix,
+                              &done_fname)))
+        goto out;
+
+    u.key = (char *) key;
+    u.digest = (char *) job->digest;
+    u.dumpbase = (char *) job->dumpbase;
+    u.pch = (char *) job->pch;
+    u.keep = job->keep;
+    u.mods = (char *) job->mods;
+    u.tc = (char *) job->tc;
+    u.cpp_fname = cpp_fname;
+    u.out_fname = out_fname;
+    u.argv = argv_str;
+    u.isize = (stat(cpp_fname, &st) == 0) ? (long) st.st_size : 0;
+    if (batch_inline_input(cpp_fname)
+        && (ret = batch_encode_file(cpp_fname, &u.data)))
+        goto out;
+    if (key && resdb_lookup(key, &e) == 0) {
+        u.mem_kb = e.mem_kb;
+        u.cost_ms = resdb_scale_msec(&e, u.isize);
+    } else {
+        u.mem_kb = resdb_estimate_mem_kb(u.isize);
+        u.cost_ms = resdb_estimate_msec(u.isize);
+    }
+
+    if ((fp = open_memstream(&rec, &rec_len)) == NULL) {
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+    batch_unit_format(fp, &u);
+    fputc('\n', fp);
+    fclose(fp);
+
+    /* remove them when we exit, so a dead client leaves nothing behind;
+     * the leader may deliver an inline object to out_fname */
+    if ((ret = add_cleanup(unit_fname)) || (ret = add_cleanup(done_fname))
+        || (u.data && (ret = add_cleanup(out_fname))))
+        goto out;
+    /* watch before the unit is there, so that no record is missed */
+    watch_fd = batch_watch_spool(spool);
+    poll_ms = getenv_int("MRCC_BATCH_POLL", watch_fd == -1 ? 100 : 1000);
+    if ((ret = write_file_atomic(unit_fname, rec)))
+        goto out;
+    rs_trace("queued unit %s (%ld KB, %ldms expected)",
+             unit_fname, u.mem_kb, u.cost_ms);
+
+    deadline = time(NULL) + getenv_int("MRCC_BATCH_TIMEOUT", 3600);
+    while (1) {
+        free(rec);
+        rec = NULL;
+        if (read_file_str(done_fname, &rec) == 0) {
+            sscanf(rec, "%d %ld %ld", &status, &mem_kb, &msec);
+            unlink(done_fname);
+            break;
+        }
+        if (time(NULL) > deadline) {
+            rs_log_error("timeout waiting for batch to compile %s", cpp_fname);
+            unlink(unit_fname);
+            break;
+        }
+        if ((ret = batch_try_lead(spool, unit_fname, &ran)) != 0 || !ran)
+            batch_wait_spool(watch_fd, find_basename(done_fname), poll_ms);
+    }
+
+    rs_trace("batch compile of %s: status %d, %ld KB, %ldms",
+             cpp_fname, status, mem_kb, msec);
+    ret = status == 0 ? 0 : EXIT_MAPPER_FAILED;
+
+out:
+    if (watch_fd != -1)
+        close(watch_fd);
+    free(u.data);
+    free(rec);
+    free(unit_fname);
+    free(done_fname);
+    return ret;
+}
@@ -0,0 +1,62 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_BATCH_H
+# define _HEADER_BATCH_H
+
+/**
+ * One compile unit of a batch.
+ *
+ * The same record is used in the spool on the master and in the job
+ * input read by mrcc-map, see batch_unit_format().  Strings point into
+ * the buffer the record was parsed from.
+ **/
+struct batch_unit {
+    char *key;          /* resource database key */
+    char *cpp_fname;    /* preprocessed input, same name on every node */
+    char *out_fname;    /* object file, same name on every node */
+    char *argv;         /* compiler command line, as a string */
+    char *digest;       /* content hash of cpp_fname, or NULL */
+    char *data;         /* content of cpp_fname in base64, or NULL if
+                           it is on the net fs */
+    char *same;         /* cpp_fname is a copy of the input of this
+                           unit of the split (its base name), or NULL */
+    char *dumpbase;     /* the compile has side outputs named after
+                           this, see manifest.c, or NULL */
+    char *pch;          /* content hash of the precompiled header
+                           cpp_fname loads, see pch.c, or NULL */
+    int keep;           /* the object stays on the net fs, see rlink.c */
+    char *mods;         /* the C++ modules of the unit, see modules.c,
+                           or NULL */
+    char *tc;           /* fingerprint of the toolchain to compile with,
+                           see toolchain.c, or NULL */
+    int packed;         /* cpp_fname is in the batch's input pack, */
+    long pack_off;      /* at this offset */
+    long pack_len;
+    long isize;         /* size of cpp_fname */
+    long mem_kb;        /* expected peak RSS of the compiler */
+    long cost_ms;       /* expected compile time */
+    int split;          /* map split the unit is packed into */
+};
+
+int batch_enabled(void);
+long batch_task_mem_kb(void);
+long batch_inline_max(void);
+int batch_inline_input(const char *cpp_fname);
+
+int batch_encode_file(const char *fname, char **b64_ret);
+int batch_decode_file(const char *b64, size_t len, const char *fname);
+
+struct remote_job;
+
+int batch_compile(char *argv_str, char *cpp_fname, char *out_fname,
+                  const char *key, const struct remote_job *job);
+
+int batch_unit_parse(char *rec, struct batch_unit *u);
+int batch_unit_format(FILE *fp, const struct batch_unit *u);
+
+int batch_pack(struct batch_unit **units, int n,
+               long task_mem_kb, int split_units, int min_splits,
+               long *max_load);
+
+#endif //_HEADER_BATCH_H
@@ -0,0 +1,209 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "cleanup.h"
+#include "io.h"
+#include "pack.h"
+#include "rlink.h"
+#include "bundle.h"
+
+/**
+ * @file
+ *
+ * Bundles: inputs of a remote command that are several files, not one
+ * preprocessed source, such as the bitcode modules of a ThinLTO backend
+ * (see lto.c).
+ *
+ * A bundle is a pack (see pack.c) of the files under the names the
+ * command uses for them, which have to be relative and stay below the
+ * working directory.  It goes to the nodes in place of the .i, named
+ * with the ".bundle" extension, and the mapper extracts it into a
+ * directory of its own and runs the command there.  Stubs of objects
+ * on the net fs among the files are replaced by their objects there.
+ **/
+
+static const char bundle_exten[] = ".bundle";
+
+
+/**
+ * Whether the name @p fname can be used in a bundle.
+ **/
+int bundle_name_ok(const char *fname)
+{
+    const char *p;
+
+    if (fname[0] == '/' || fname[0] == '\0' || strpbrk(fname, " \t\n"))
+        return 0;
+    for (p = fname; p; p = strchr(p, '/')) {
+        if (*p == '/')
+            p++;
+        if (str_startswith("../", p) || str_equal(p, ".."))
+            return 0;
+    }
+    return 1;
+}
+
+
+/**
+ * Whether @p fname is a bundle, by its name.
+ **/
+int is_bundle(const char *fname)
+{
+    return str_endswith(bundle_exten, fname);
+}
+
+
+/**
+ * Write the bundle @p bundle_fname of the files @p files, a NULL
+ * terminated list in which the same name may come more than once.
+ **/
+int bundle_create(const char *bundle_fname, char **files)
+{
+    struct pack_writer w;
+    long off, len;
+    int i, j;
+    int ret;
+
+    if ((ret = pack_create(bundle_fname, &w)))
+        return ret;
+    for (i = 0; ret == 0 && files[i]; i++) {
+        for (j = 0; j < i; j++)
+            if (str_equal(files[i], files[j]))
+                break;
+        if (j < i)
+            continue;
+        if (!bundle_name_ok(files[i])) {
+            rs_log_error("cannot bundle \"%s\"", files[i]);
+            ret = EXIT_MRCC_FAILED;
+        } else {
+            ret = pack_add_file(&w, files[i], files[i], &off, &len);
+        }
+    }
+    if (pack_finish(&w) != 0 && ret == 0)
+        ret = EXIT_IO_ERROR;
+    if (ret == 0)
+        rs_trace("bundled %d files into %s", i, bundle_fname);
+    return ret;
+}
+
+
+/*
+ * create the directories of @p path from @p from on, and have them
+ * removed at exit
+ */
+static int bundle_mkdirs(char *path, char *from)
+{
+    char *slash;
+    int ret = 0;
+
+    for (slash = strchr(from, '/'); slash && ret == 0;
+         slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        if (mkdir(path, 0777) == 0) {
+            ret = add_cleanup(path);
+        } else if (errno != EEXIST) {
+            rs_log_error("failed to create %s: %s", path, strerror(errno));
+            ret = EXIT_IO_ERROR;
+        }
+        *slash = '/';
+    }
+    return ret;
+}
+
+
+struct bundle_extract {
+    const char *bundle_fname;
+    const char *dir;
+};
+
+/* pack_foreach() callback: extract one file of the bundle */
+static int bundle_extract_member(int fd, const char *name, long off,
+                                 long len, void *arg)
+{
+    struct bundle_extract *x = arg;
+    char *dst;
+    int ret;
+
+    if (!bundle_name_ok(name)) {
+        rs_log_error("bad name \"%s\" in %s", name, x->bundle_fname);
+        return EXIT_PROTOCOL_ERROR;
+    }
+    if (asprintf(&dst, "%s/%s", x->dir, name) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    if ((ret = bundle_mkdirs(dst, dst + strlen(x->dir) + 1)) == 0
+        && (ret = add_cleanup(dst)) == 0)
+        ret = pack_extract(fd, off, len, dst);
+    /* the objects that stayed on the net fs, see rlink.c */
+    if (ret == 0 && is_obj_stub(dst))
+        ret = rlink_unstub(dst, 1);
+    free(dst);
+    return ret;
+}
+
+/**
+ * Extract the bundle @p bundle_fname into a new directory, whose name
+ * is returned in @p dir_ret.  The directory and the files are removed
+ * at exit.
+ **/
+int bundle_extract(const char *bundle_fname, char **dir_ret)
+{
+    struct bundle_extract x;
+    char *dir;
+    int fd;
+    int ret;
+
+    if (asprintf(&dir, "%s.x", bundle_fname) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    if (mkdir(dir, 0777) == -1 && errno != EEXIST) {
+        rs_log_error("failed to create %s: %s", dir, strerror(errno));
+        free(dir);
+        return EXIT_IO_ERROR;
+    }
+    if ((ret = add_cleanup(dir))) {
+        free(dir);
+        return ret;
+    }
+    if ((fd = open(bundle_fname, O_RDONLY|O_BINARY)) == -1) {
+        rs_log_error("failed to open %s: %s", bundle_fname, strerror(errno));
+        free(dir);
+        return EXIT_IO_ERROR;
+    }
+
+    x.bundle_fname = bundle_fname;
+    x.dir = dir;
+    ret = pack_foreach(fd, bundle_extract_member, &x);
+
+    close(fd);
+    if (ret == 0)
+        *dir_ret = dir;
+    else
+        free(dir);
+    return ret;
+}
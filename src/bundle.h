@@ -0,0 +1,12 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_BUNDLE_H
+# define _HEADER_BUNDLE_H
+
+int bundle_name_ok(const char *fname);
+int is_bundle(const char *fname);
+int bundle_create(const char *bundle_fname, char **files);
+int bundle_extract(const char *bundle_fname, char **dir_ret);
+
+#endif //_HEADER_BUNDLE_H
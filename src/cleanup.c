@@ -168,3 +168,17 @@ void cleanup_tempfiles(void)
     cleanup_tempfiles_inner(0);
 }
 
+
+/**
+ * Forget the files to delete on exit, without deleting them: a child
+ * forked to do some work of its own leaves those of its parent to the
+ * parent.
+ */
+void forget_cleanups(void)
+{
+    while (n_cleanups > 0) {
+        n_cleanups--;
+        free(cleanups[n_cleanups]);
+        cleanups[n_cleanups] = NULL;
+    }
+}
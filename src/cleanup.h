@@ -11,4 +11,6 @@ void cleanup_tempfiles_from_signal_handler(void);
 
 void cleanup_tempfiles(void);
 
+void forget_cleanups(void);
+
 #endif //_HEADER_CLEAN_UP_H
@@ -0,0 +1,223 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "tempfile.h"
+#include "lock.h"
+#include "io.h"
+#include "hash.h"
+#include "basedir.h"
+#include "toolchain.h"
+#include "coalesce.h"
+
+/**
+ * @file
+ *
+ * Single-flight compiles: when several mrcc processes on the master
+ * compile the same preprocessed source with the same command at the
+ * same time, as the same file built for several targets or parallel
+ * builds of one tree do, only the first ships and compiles it.
+ *
+ * The key is the hash of the compiler command, with the input and
+ * output names left out, of the .i digest, and of the digest of the
+ * precompiled header the .i loads, if any, see pch.c.  The prefix maps
+ * of MRCC_BASE_DIR are in it without the directories they map, so that
+ * two checkouts of the same code compile once, see basedir.c.  Whoever does the work
+ * holds the lock file "coalesce_KEY" in the lock dir for the whole
+ * compile, and copies the object to KEY.o in the coalesce dir before
+ * letting go.  The others block on the lock and then copy the object
+ * out, if it was published after they started waiting; otherwise the
+ * first one failed, and they go on to do the work themselves.
+ *
+ * Objects older than COALESCE_KEEP seconds are removed by the next
+ * publisher.  MRCC_COALESCE=0 turns coalescing off.
+ **/
+
+#define COALESCE_KEEP       60
+
+
+/*
+ * hash the compiler, the command, with the input and output names
+ * replaced, the preprocessed source and its precompiled header
+ *
+ * The compiler is named in the command only as the shell finds it, so
+ * the driver it is goes in too, see tc_driver(): builds with different
+ * PATHs, or before and after an upgrade, must not share objects.
+ */
+static int coalesce_key(char **argv, const char *input_fname,
+                        const char *output_fname, const char *digest,
+                        const char *pch, char *key)
+{
+    struct hash_state st;
+    struct base_map m;
+    char cc[HASH_HEX_LEN + 1];
+    char *driver;
+    const char *arg;
+    int mapped;
+    int i;
+    int ret;
+
+    if ((ret = tc_driver(argv[0], &driver, cc)))
+        return ret;
+    free(driver);
+    mapped = base_map_for(argv, &m);
+    hash_init(&st);
+    hash_update(&st, cc, strlen(cc) + 1);
+    for (i = 0; argv[i]; i++) {
+        if (str_equal(argv[i], input_fname))
+            arg = "<input>";
+        else if (str_equal(argv[i], output_fname))
+            arg = "<output>";
+        else if (!mapped || (arg = base_map_target(&m, argv[i])) == NULL)
+            arg = argv[i];
+        /* with the '\0', so that "-a b" and "-ab" differ */
+        hash_update(&st, arg, strlen(arg) + 1);
+    }
+    hash_update(&st, digest, strlen(digest) + 1);
+    if (pch)
+        hash_update(&st, pch, strlen(pch));
+    hash_final_hex(&st, key);
+    if (mapped)
+        base_map_free(&m);
+    return 0;
+}
+
+
+static int coalesce_result_fname(const struct coalesce *c, char **fname)
+{
+    char *dir;
+    int ret;
+
+    if ((ret = get_coalesce_dir(&dir)))
+        return ret;
+    if (asprintf(fname, "%s/%s.o", dir, c->key) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    return 0;
+}
+
+
+/**
+ * Join the compile of @p argv, whose preprocessed source has the hash
+ * @p digest and loads the precompiled header with hash @p pch, or NULL,
+ * to an identical one that is running.
+ *
+ * If there was one and it succeeded, its object has been copied to
+ * @p output_fname and @p *done is set.  Otherwise this process does the
+ * work and has to call coalesce_end() afterwards.
+ **/
+int coalesce_begin(char **argv, char *input_fname, char *output_fname,
+                   const char *digest, const char *pch, struct coalesce *c,
+                   int *done)
+{
+    char *lock_dir, *fname;
+    struct stat st;
+    time_t start;
+    int ret;
+
+    *done = 0;
+    c->lock_fd = -1;
+    if (!getenv_bool("MRCC_COALESCE", 1) || digest == NULL)
+        return 0;
+
+    /* a compiler that is not there is not coalesced */
+    if (coalesce_key(argv, input_fname, output_fname, digest, pch, c->key))
+        return 0;
+    if ((ret = get_lock_dir(&lock_dir)))
+        return ret;
+    if (asprintf(&fname, "%s/coalesce_%s", lock_dir, c->key) == -1)
+        return EXIT_OUT_OF_MEMORY;
+
+    start = time(NULL);
+    ret = mrcc_lock_file(fname, 0, &c->lock_fd);
+    if (ret == EXIT_BUSY) {
+        rs_log_info("an identical compile of \"%s\" is running, waiting "
+                    "for it", input_fname);
+        ret = mrcc_lock_file(fname, 1, &c->lock_fd);
+        if (ret == 0) {
+            free(fname);
+            if ((ret = coalesce_result_fname(c, &fname)))
+                return ret;
+            if (stat(fname, &st) == 0 && st.st_mtime >= start
+                && copy_file(fname, output_fname) == 0) {
+                rs_log_info("took the object of the identical compile");
+                mrcc_unlock(c->lock_fd);
+                c->lock_fd = -1;
+                *done = 1;
+            }
+        }
+    }
+    free(fname);
+    return ret;
+}
+
+
+/*
+ * remove the objects nobody can be waiting for any more
+ */
+static void coalesce_sweep(void)
+{
+    char *dir, *fname;
+    struct dirent *de;
+    struct stat st;
+    time_t now = time(NULL);
+    DIR *d;
+
+    if (get_coalesce_dir(&dir) != 0 || (d = opendir(dir)) == NULL)
+        return;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.'
+            || asprintf(&fname, "%s/%s", dir, de->d_name) == -1)
+            continue;
+        if (stat(fname, &st) == 0 && now - st.st_mtime > COALESCE_KEEP)
+            unlink(fname);
+        free(fname);
+    }
+    closedir(d);
+}
+
+
+/**
+ * Finish a compile started with coalesce_begin(): if it produced
+ * @p output_fname, hand it to whoever is waiting, and let them go.
+ **/
+void coalesce_end(struct coalesce *c, char *output_fname, int ok)
+{
+    char *fname;
+
+    if (c->lock_fd == -1)
+        return;
+    if (ok && coalesce_result_fname(c, &fname) == 0) {
+        coalesce_sweep();
+        copy_file(output_fname, fname);
+        free(fname);
+    }
+    mrcc_unlock(c->lock_fd);
+    c->lock_fd = -1;
+}
@@ -0,0 +1,17 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_COALESCE_H
+# define _HEADER_COALESCE_H
+
+struct coalesce {
+    int lock_fd;
+    char key[HASH_HEX_LEN + 1];
+};
+
+int coalesce_begin(char **argv, char *input_fname, char *output_fname,
+                   const char *digest, const char *pch, struct coalesce *c,
+                   int *done);
+void coalesce_end(struct coalesce *c, char *output_fname, int ok);
+
+#endif //_HEADER_COALESCE_H
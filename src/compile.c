@@ -29,7 +29,7 @@
 #include "exec.h"
 #include "compile.h"
 //#include "state.h"
-//#include "lock.h"
+#include "lock.h"
 #include "utils.h"
 #include "args.h"
 #include "tempfile.h"
@@ -37,6 +37,12 @@
 #include "remote.h"
 #include "stringutils.h"
 #include "io.h"
+#include "batch.h"
+#include "admit.h"
+#include "manifest.h"
+#include "native.h"
+#include "basedir.h"
+#include "tee.h"
 
 
 struct hostdef mrcc_local = {
@@ -77,6 +83,140 @@ struct hostdef *hostdef_local = &mrcc_local;
 
 
 
+/*
+ * the extension that stands for the language of @p input_fname: that of
+ * its -x, if it has one, or its own
+ */
+static const char *input_exten(char **argv, char *input_fname)
+{
+    const char *lang = input_language(argv, input_fname);
+
+    return lang ? lang_source_exten(lang) : find_extension(input_fname);
+}
+
+
+/**
+ * Whether to preprocess @p input_fname only partly, with
+ * -fdirectives-only: the master only includes the headers and decides
+ * the conditionals, which is much cheaper than a full cc -E, and the
+ * worker expands the macros when it compiles with -fpreprocessed
+ * -fdirectives-only.  The output keeps every #define, so it is bigger.
+ *
+ * Opt in with MRCC_DIRECTIVES_ONLY=1; it needs GCC 4.3 or later on both
+ * sides.
+ **/
+static int cpp_directives_only(char **argv, char *input_fname)
+{
+    const char *exten = input_exten(argv, input_fname);
+
+    /* the assembler does not expand macros */
+    if (!getenv_bool("MRCC_DIRECTIVES_ONLY", 0) || exten == NULL
+        || is_preprocessed(exten) || is_assembler(exten))
+        return 0;
+
+    /* other compilers do not know the option, or not for -fpreprocessed */
+    if (!cc_is_gcc(argv[0], 0))
+        return 0;
+
+    for (; *argv; argv++) {
+        /* these need the full preprocessor on the master */
+        if (str_equal(*argv, "-traditional-cpp")
+            || str_equal(*argv, "-traditional")
+            || str_equal(*argv, "-C") || str_equal(*argv, "-CC"))
+            return 0;
+        /* the module declarations are found in the full output */
+        if (str_equal(*argv, "-fmodules-ts") || str_equal(*argv, "-fmodules"))
+            return 0;
+    }
+    return 1;
+}
+
+
+/**
+ * Whether to preprocess @p input_fname with -fpch-preprocess, so that a
+ * precompiled header it uses is loaded by the worker rather than
+ * expanded here, see pch.c.  The nodes need the compiler of the master
+ * to load it, so this is on by default only where that is shipped to
+ * them, with MRCC_TOOLCHAIN=1; MRCC_PCH=1 or 0 decides otherwise.
+ **/
+static int cpp_pch_preprocess(char **argv, char *input_fname)
+{
+    const char *exten = input_exten(argv, input_fname);
+
+    if (!getenv_bool("MRCC_PCH", getenv_bool("MRCC_TOOLCHAIN", 0))
+        || exten == NULL
+        || is_preprocessed(exten) || is_assembler(exten))
+        return 0;
+    return cc_is_gcc(argv[0], 0);
+}
+
+
+/**
+ * Whether the compile writes side outputs next to the object: a .dwo
+ * with -gsplit-dwarf, a .su with -fstack-usage, a .ci with
+ * -fcallgraph-info.  If so, @p *dumpbase is set to what names them on
+ * the worker as they would be named here, see manifest.c; otherwise it
+ * is NULL.
+ *
+ * Returns EXIT_MRCC_FAILED if the side outputs can only be had from a
+ * local compile: with compilers other than GCC, which has to be 11 or
+ * later on the nodes; with names of their own given on the command
+ * line; with MRCC_REMOTE_SIDE_OUTPUTS=0; or for a .dwo outside the
+ * working directory, whose name is recorded in the object.
+ **/
+static int remote_dumpbase(char **argv, char *output_fname, char **dumpbase)
+{
+    const char *base, *dot, *dir = "./";
+    int side = 0, dwo = 0;
+    int len, i;
+
+    *dumpbase = NULL;
+    for (i = 0; argv[i]; i++) {
+        if (str_equal(argv[i], "-gsplit-dwarf"))
+            side = dwo = 1;
+        else if (str_equal(argv[i], "-fstack-usage")
+                 || str_startswith("-fcallgraph-info", argv[i]))
+            side = 1;
+    }
+    if (!side)
+        return 0;
+
+    if (!getenv_bool("MRCC_REMOTE_SIDE_OUTPUTS", 1) || !cc_is_gcc(argv[0], 0)
+        || strpbrk(output_fname, " \t\n\"';")) {
+        rs_log_info("side outputs of %s are made locally", output_fname);
+        return EXIT_MRCC_FAILED;
+    }
+    for (i = 0; argv[i]; i++) {
+        if (str_startswith("-dumpbase", argv[i])
+            || str_startswith("-dumpdir", argv[i])
+            || str_startswith("-auxbase", argv[i])) {
+            rs_log_info("%s names the side outputs; must be local", argv[i]);
+            return EXIT_MRCC_FAILED;
+        }
+    }
+
+    /* GCC names them after the object, without its extension */
+    base = find_basename(output_fname);
+    dot = strrchr(base, '.');
+    len = (dot && dot != base) ? dot - base : (int) strlen(base);
+
+    if (base != output_fname && output_fname[0] != '/'
+        && strstr(output_fname, "..") == NULL) {
+        /* the same relative name, in the scratch dir on the worker */
+        len += base - output_fname;
+        base = output_fname;
+        dir = "";
+    } else if (base != output_fname && dwo) {
+        rs_log_info("%s would not find its .dwo; must be local",
+                    output_fname);
+        return EXIT_MRCC_FAILED;
+    }
+    if (asprintf(dumpbase, "%s%.*s", dir, len, base) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    return 0;
+}
+
+
 /**
  * If the input filename is a plain source file rather than a
  * preprocessed source file, then preprocess it to a temporary file
@@ -92,26 +232,30 @@ int cpp_maybe(char **argv, char *input_fname, char **cpp_fname,
 {
     char **cpp_argv;
     int ret;
-    char *input_exten;
+    const char *exten;
     const char *output_exten;
 
     *cpp_pid = 0;
 
-    if (is_preprocessed(input_fname)) {
+    /* with -x, the extension of the language names the output */
+    if ((exten = input_exten(argv, input_fname)) == NULL) {
+        rs_log_error("no extension on \"%s\"", input_fname);
+        return EXIT_MRCC_FAILED;
+    }
+
+    if (is_preprocessed(exten)) {
         /* TODO: Perhaps also consider the option that says not to use cpp.
          * Would anyone do that? */
         rs_trace("input is already preprocessed");
 
-        /* already preprocessed, great. */
-        if (!(*cpp_fname = strdup(input_fname))) {
-            rs_log_error("couldn't duplicate string");
-            return EXIT_OUT_OF_MEMORY;
-        }
-        return 0;
+        /* already preprocessed, great.  But it is shipped under its own
+         * name, which has to be unique on the nodes, like ours are. */
+        if ((ret = make_tmpnam("mrcc", exten, cpp_fname)))
+            return ret;
+        return copy_file(input_fname, *cpp_fname);
     }
 
-    input_exten = find_extension(input_fname);
-    output_exten = preproc_exten(input_exten);
+    output_exten = preproc_exten(exten);
     if ((ret = make_tmpnam("mrcc", output_exten, cpp_fname)))
         return ret;
 
@@ -130,8 +274,32 @@ int cpp_maybe(char **argv, char *input_fname, char **cpp_fname,
         || (ret = set_action_opt(cpp_argv, "-E")))
         return ret;
 
+    if (cpp_directives_only(argv, input_fname)) {
+        char **dir_argv;
+
+        if ((ret = copy_argv(cpp_argv, &dir_argv, 1)))
+            return ret;
+        argv_append(dir_argv, strdup("-fdirectives-only"));
+        free(cpp_argv);
+        cpp_argv = dir_argv;
+    } else if (cpp_pch_preprocess(argv, input_fname)) {
+        /* not with -fdirectives-only, which gives the worker the
+         * #include of the header as it is */
+        char **pch_argv;
+
+        if ((ret = copy_argv(cpp_argv, &pch_argv, 1)))
+            return ret;
+        argv_append(pch_argv, strdup("-fpch-preprocess"));
+        free(cpp_argv);
+        cpp_argv = pch_argv;
+    }
+
     /* FIXME: cpp_argv is leaked */
 
+    /* the .i is hashed as it is written, see tee.c */
+    if (tee_enabled())
+        return tee_spawn_cpp(cpp_argv, argv, *cpp_fname, cpp_pid);
+
     return spawn_child(cpp_argv, cpp_pid,
                            "/dev/null", *cpp_fname, NULL);
 }
@@ -181,6 +349,16 @@ static int compile_local(char *argv[], char *input_name)
 
 
 
+static long elapsed_msec(struct timeval *since)
+{
+    struct timeval now, delta;
+
+    gettimeofday(&now, NULL);
+    timeval_subtract(&delta, &now, since);
+    return delta.tv_sec * 1000L + delta.tv_usec / 1000;
+}
+
+
 /**
  * Execute the commands in argv remotely or locally as appropriate.
  *
@@ -233,12 +411,10 @@ static int build_somewhere(char *argv[], int sg_level, int *status)
     static int _scan_includes = 0;
 
 
-    char *input_fname = NULL, *output_fname, *cpp_fname, *deps_fname = NULL;
-    char **files;
+    char *input_fname = NULL, *output_fname, *cpp_fname;
     char **server_side_argv = NULL;
     int server_side_argv_deep_copied = 0;
     char *server_stderr_fname = NULL;
-    int needs_dotd = 0;
     //int sets_dotd_target = 0;
     pid_t cpp_pid = 0;
     int cpu_lock_fd = -1, local_cpu_lock_fd = -1;
@@ -247,6 +423,11 @@ static int build_somewhere(char *argv[], int sg_level, int *status)
     struct hostdef *host = NULL;
     char *_discrepancy_filename = NULL;
     char **new_argv;
+    char *dumpbase = NULL;
+    struct remote_job job = { NULL };
+    int admit_fd = -1;
+    int timed_local = 0;
+    struct timeval start;
 
     if ((ret = expand_preprocessor_options(&argv)) != 0)
         goto clean_up;
@@ -261,6 +442,14 @@ static int build_somewhere(char *argv[], int sg_level, int *status)
 
     /* FIXME: this may leak memory for argv. */
 
+    /* before scan_args(), which keeps -march=native local */
+    if ((ret = expand_native_options(&argv)) != 0)
+        goto clean_up;
+
+    /* local and remote objects get the same relative paths */
+    if ((ret = base_expand_options(&argv)) != 0)
+        goto clean_up;
+
     ret = scan_args(argv, &input_fname, &output_fname, &new_argv);
     free_argv(argv);
     argv = new_argv;
@@ -270,6 +459,9 @@ static int build_somewhere(char *argv[], int sg_level, int *status)
         goto lock_local;
     }
 
+    if ((ret = remote_dumpbase(argv, output_fname, &dumpbase)) != 0)
+        goto lock_local;
+
     if ((ret = make_tmpnam("mrcc_server_stderr", ".txt",
                                &server_stderr_fname))) {
         /* So we are failing locally to make a temp file to store the
@@ -294,23 +486,55 @@ static int build_somewhere(char *argv[], int sg_level, int *status)
         goto unlock_and_clean_up;
     }
 
-    if (1) {
-        files = NULL;
+    gettimeofday(&start, NULL);
+    if (admit_route(batch_enabled(), &admit_fd) == ADMIT_LOCAL) {
+        timed_local = 1;
+        goto run_local;
+    }
 
+    if (1) {
         if ((ret = cpp_maybe(argv, input_fname, &cpp_fname, &cpp_pid) != 0))
             goto fallback;
 
         if ((ret = strip_local_args(argv, &server_side_argv)))
             goto fallback;
+
+        /* the worker finishes what cpp left */
+        if (cpp_directives_only(argv, input_fname)) {
+            char **full_argv;
+
+            if ((ret = copy_argv(server_side_argv, &full_argv, 2)))
+                goto fallback;
+            argv_append(full_argv, strdup("-fpreprocessed"));
+            argv_append(full_argv, strdup("-fdirectives-only"));
+            free(server_side_argv);
+            server_side_argv = full_argv;
+            server_side_argv_deep_copied = 1;
+        }
+
+        /* and names the side outputs as they would be named here */
+        if (dumpbase) {
+            char **db_argv;
+
+            if ((ret = copy_argv(server_side_argv, &db_argv, 2)))
+                goto fallback;
+            argv_append(db_argv, strdup("-dumpbase"));
+            argv_append(db_argv, strdup(dumpbase));
+            if (server_side_argv_deep_copied)
+                free_argv(server_side_argv);
+            else
+                free(server_side_argv);
+            server_side_argv = db_argv;
+            server_side_argv_deep_copied = 1;
+        }
     }
 
+    job.dumpbase = dumpbase;
     if ((ret = compile_remote(server_side_argv,
                                   input_fname,
                                   cpp_fname,
-                                  files,
                                   output_fname,
-                                  needs_dotd ? deps_fname : NULL,
-                                  server_stderr_fname,
+                                  &job,
                                   cpp_pid, local_cpu_lock_fd,
                                   host, status)) != 0) {
         /* Returns zero if we successfully ran the compiler, even if
@@ -329,6 +553,8 @@ static int build_somewhere(char *argv[], int sg_level, int *status)
     cpu_lock_fd = -1;
     */
     ret = critique_status(*status, "compile", input_fname, host, 1);
+    if (ret == 0)
+        admit_note_time(ADMIT_REMOTE, elapsed_msec(&start));
     if (ret == 0) {
         /* Try to copy the server-side errors on stderr.
          * If that fails, even though the compilation succeeded,
@@ -392,6 +618,8 @@ static int build_somewhere(char *argv[], int sg_level, int *status)
     /* At this point, we can abandon the remote errors. */
 
     rs_log_warning("failed to distribute, running locally instead");
+    timed_local = 1;
+    gettimeofday(&start, NULL);
 
   lock_local:
     // lock_local(&cpu_lock_fd);
@@ -400,6 +628,8 @@ static int build_somewhere(char *argv[], int sg_level, int *status)
     /* Either compile locally, after remote failure, or simply do other cc tasks
        as assembling, linking, etc. */
     ret = compile_local(argv, input_fname);
+    if (timed_local && ret == 0)
+        admit_note_time(ADMIT_LOCAL, elapsed_msec(&start));
 //    if (remote_ret != 0 && remote_ret != ret) {
         /* Oops! it seems what we did remotely is not the same as what we did
           locally. We normally send email in such situations (if emailing is
@@ -425,6 +655,7 @@ static int build_somewhere(char *argv[], int sg_level, int *status)
     }
 
   clean_up:
+    mrcc_unlock(admit_fd);
     free_argv(argv);
     if (server_side_argv_deep_copied) {
         if (server_side_argv != NULL) {
@@ -434,6 +665,7 @@ static int build_somewhere(char *argv[], int sg_level, int *status)
         free(server_side_argv);
     }
     free(_discrepancy_filename);
+    free(dumpbase);
     return ret;
 }
 
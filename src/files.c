@@ -176,6 +176,20 @@ int is_preprocessed(const char *sfile)
     }
 }
 
+/**
+ * Is this an assembler source, plain (.s) or to be preprocessed (.S)?
+ **/
+int is_assembler(const char *sfile)
+{
+    const char *dot;
+    dot = find_extension_const(sfile);
+    if (!dot)
+        return 0;
+
+    return !strcmp(dot, ".s") || !strcmp(dot, ".S");
+}
+
+
 /* Some files should always be built locally... */
 int source_needs_local(const char *filename)
 {
@@ -188,10 +202,48 @@ int source_needs_local(const char *filename)
         return EXIT_MRCC_FAILED;
     }
 
+#ifdef ENABLE_REMOTE_ASSEMBLE
+    if (is_assembler(filename) && !getenv_bool("MRCC_REMOTE_ASSEMBLE", 1)) {
+        rs_trace("remote assembly is turned off: %s", filename);
+        return EXIT_MRCC_FAILED;
+    }
+#endif
+
     return 0;
 }
 
 
+#ifdef ENABLE_REMOTE_ASSEMBLE
+/**
+ * Does the (preprocessed) assembler source @p fname read other files
+ * itself?  The assembler's .include and .incbin take files from the
+ * master that are not shipped with the source, so it must be local.
+ **/
+int asm_needs_local(const char *fname)
+{
+    FILE *fp;
+    char *line = NULL, *p;
+    size_t line_size = 0;
+    int ret = 0;
+
+    if ((fp = fopen(fname, "r")) == NULL)
+        return EXIT_NO_SUCH_FILE;
+    while (ret == 0 && getline(&line, &line_size, fp) != -1) {
+        for (p = line; *p == ' ' || *p == '\t'; p++)
+            ;
+        if (str_startswith(".include", p) || str_startswith(".incbin", p)) {
+            rs_log_info("%s reads other files with %.8s; must be local",
+                        fname, p);
+            ret = EXIT_MRCC_FAILED;
+        }
+    }
+    free(line);
+    fclose(fp);
+    return ret;
+}
+#endif
+
+
 static int set_file_extension(const char *sfile, const char *new_ext, char **ofile)
 {
     char *dot, *o;
@@ -244,6 +296,44 @@ int output_from_source(const char *sfile, const char *out_extn, char **ofile)
 }
 
 
+/**
+ * The extension of sources in the language @p lang, as given to gcc's
+ * -x, so that an input under -x can be handled like one with that
+ * extension.
+ *
+ * @returns the extension (e.g. ".c"), or NULL for languages that are
+ * not distributed.
+ **/
+const char * lang_source_exten(const char *lang)
+{
+    if (!strcmp(lang, "c")) {
+        return ".c";
+    } else if (!strcmp(lang, "c++")) {
+        return ".cc";
+    } else if (!strcmp(lang, "objective-c")) {
+        return ".m";
+    } else if (!strcmp(lang, "objective-c++")) {
+        return ".mm";
+    } else if (!strcmp(lang, "cpp-output")) {
+        return ".i";
+    } else if (!strcmp(lang, "c++-cpp-output")) {
+        return ".ii";
+    } else if (!strcmp(lang, "objective-c-cpp-output")) {
+        return ".mi";
+    } else if (!strcmp(lang, "objective-c++-cpp-output")) {
+        return ".mii";
+#ifdef ENABLE_REMOTE_ASSEMBLE
+    } else if (!strcmp(lang, "assembler")) {
+        return ".s";
+    } else if (!strcmp(lang, "assembler-with-cpp")) {
+        return ".S";
+#endif
+    } else {
+        return NULL;
+    }
+}
+
+
 /**
  * If you preprocessed a file with extension @p e, what would you get?
  *
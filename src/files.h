@@ -12,10 +12,15 @@ const char * find_extension_const(const char *sfile);
 int is_source(const char *sfile);
 int is_object(const char *filename);
 int is_preprocessed(const char *sfile);
+int is_assembler(const char *sfile);
 int source_needs_local(const char *filename);
+#ifdef ENABLE_REMOTE_ASSEMBLE
+int asm_needs_local(const char *fname);
+#endif
 int output_from_source(const char *sfile, const char *out_extn, char **ofile);
 
 const char * preproc_exten(const char *e);
+const char * lang_source_exten(const char *lang);
 
 
 #endif //_HEADER_FILES_H
@@ -0,0 +1,212 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "hash.h"
+
+/*
+ * 64 bit xxHash (XXH64).  It is only used to name things (resource
+ * records, cache entries), so it needs to be fast and stable rather than
+ * cryptographically strong.  The input is taken 32 bytes at a time, in
+ * four independent lanes of 8 bytes, which keeps up with the
+ * preprocessor and the disk; see tee.c, which hashes the output of cpp
+ * as it is written.
+ *
+ * The digests are kept: they name resource records, the node cache, the
+ * marks of shipped PCHs, toolchains and native answers, and coalesced
+ * compiles.  Changing the function renames all of them, so masters and
+ * mappers have to be upgraded together, and whatever was stored under
+ * the old names is simply missed.  test/hash_check.c pins it to the
+ * reference vectors of XXH64.
+ */
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+typedef unsigned long long u64;
+
+static inline u64 rotl64(u64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/* little endian whatever the host, so digests agree across nodes */
+static inline u64 read64(const unsigned char *p)
+{
+    return (u64) p[0] | (u64) p[1] << 8 | (u64) p[2] << 16
+        | (u64) p[3] << 24 | (u64) p[4] << 32 | (u64) p[5] << 40
+        | (u64) p[6] << 48 | (u64) p[7] << 56;
+}
+
+static inline u64 read32(const unsigned char *p)
+{
+    return (u64) p[0] | (u64) p[1] << 8 | (u64) p[2] << 16
+        | (u64) p[3] << 24;
+}
+
+static inline u64 xxh_round(u64 acc, u64 input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline u64 xxh_merge(u64 acc, u64 val)
+{
+    acc ^= xxh_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+/*
+ * run the lanes over the 32 byte stripes of p, up to end
+ */
+static const unsigned char *xxh_stripes(struct hash_state *st,
+                                        const unsigned char *p,
+                                        const unsigned char *end)
+{
+    u64 v1 = st->v[0], v2 = st->v[1], v3 = st->v[2], v4 = st->v[3];
+
+    for (; p + 32 <= end; p += 32) {
+        v1 = xxh_round(v1, read64(p));
+        v2 = xxh_round(v2, read64(p + 8));
+        v3 = xxh_round(v3, read64(p + 16));
+        v4 = xxh_round(v4, read64(p + 24));
+    }
+    st->v[0] = v1;
+    st->v[1] = v2;
+    st->v[2] = v3;
+    st->v[3] = v4;
+    return p;
+}
+
+void hash_init(struct hash_state *st)
+{
+    st->v[0] = PRIME64_1 + PRIME64_2;
+    st->v[1] = PRIME64_2;
+    st->v[2] = 0;
+    st->v[3] = -PRIME64_1;
+    st->total_len = 0;
+    st->buf_len = 0;
+}
+
+void hash_update(struct hash_state *st, const void *buf, size_t len)
+{
+    const unsigned char *p = buf, *end = p + len;
+    size_t fill;
+
+    st->total_len += len;
+    if (st->buf_len + len < sizeof st->buf) {
+        memcpy(st->buf + st->buf_len, p, len);
+        st->buf_len += len;
+        return;
+    }
+    if (st->buf_len) {
+        fill = sizeof st->buf - st->buf_len;
+        memcpy(st->buf + st->buf_len, p, fill);
+        xxh_stripes(st, st->buf, st->buf + sizeof st->buf);
+        p += fill;
+        st->buf_len = 0;
+    }
+    p = xxh_stripes(st, p, end);
+    memcpy(st->buf, p, end - p);
+    st->buf_len = end - p;
+}
+
+/**
+ * The digest of what was hashed with @p st.
+ **/
+u64 hash_final(struct hash_state *st)
+{
+    const unsigned char *p = st->buf, *end = p + st->buf_len;
+    u64 h;
+
+    if (st->total_len >= sizeof st->buf) {
+        h = rotl64(st->v[0], 1) + rotl64(st->v[1], 7)
+            + rotl64(st->v[2], 12) + rotl64(st->v[3], 18);
+        h = xxh_merge(h, st->v[0]);
+        h = xxh_merge(h, st->v[1]);
+        h = xxh_merge(h, st->v[2]);
+        h = xxh_merge(h, st->v[3]);
+    } else {
+        h = st->v[2] + PRIME64_5;
+    }
+    h += st->total_len;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        h ^= read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+/*
+ * write the digest as HASH_HEX_LEN hex chars plus '\0' to hex
+ */
+void hash_final_hex(struct hash_state *st, char *hex)
+{
+    snprintf(hex, HASH_HEX_LEN + 1, "%016llx", hash_final(st));
+}
+
+void hash_str_hex(const char *s, char *hex)
+{
+    struct hash_state st;
+
+    hash_init(&st);
+    hash_update(&st, s, strlen(s));
+    hash_final_hex(&st, hex);
+}
+
+/*
+ * digest of the content of a file, to name it in content addressed caches
+ */
+int hash_file_hex(const char *fname, char *hex)
+{
+    struct hash_state st;
+    char buf[65536];
+    ssize_t n;
+    int fd;
+
+    if ((fd = open(fname, O_RDONLY)) == -1) {
+        rs_log_error("failed to open %s: %s", fname, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    hash_init(&st);
+    while ((n = read(fd, buf, sizeof buf)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            rs_log_error("failed to read %s: %s", fname, strerror(errno));
+            close(fd);
+            return EXIT_IO_ERROR;
+        }
+        hash_update(&st, buf, n);
+    }
+    close(fd);
+    hash_final_hex(&st, hex);
+    return 0;
+}
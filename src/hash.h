@@ -0,0 +1,25 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_HASH_H
+# define _HEADER_HASH_H
+
+// length of a hex digest, without the terminating '\0'
+#define HASH_HEX_LEN 16
+
+struct hash_state {
+    unsigned long long v[4];
+    unsigned long long total_len;
+    unsigned char buf[32];      /* the part of a stripe that is not run */
+    size_t buf_len;
+};
+
+void hash_init(struct hash_state *st);
+void hash_update(struct hash_state *st, const void *buf, size_t len);
+unsigned long long hash_final(struct hash_state *st);
+void hash_final_hex(struct hash_state *st, char *hex);
+
+void hash_str_hex(const char *s, char *hex);
+int hash_file_hex(const char *fname, char *hex);
+
+#endif //_HEADER_HASH_H
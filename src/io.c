@@ -28,6 +28,7 @@
 #include "utils.h"
 #include "io.h"
 #include "trace.h"
+#include "stringutils.h"
 
 /*
  * Calls select() to block until the specified fd becomes writeable
@@ -201,3 +202,72 @@ int copy_file_to_fd(const char *in_fname, int out_fd)
 }
 
 
+
+
+/*
+ * copy a file; the copy is renamed into place, so it is complete if it
+ * exists at all
+ */
+int copy_file(const char *from, const char *to)
+{
+    char buf[65536];
+    char *tmp_fname;
+    ssize_t n;
+    int ifd, ofd;
+    int ret = 0;
+
+    if ((ifd = open(from, O_RDONLY|O_BINARY)) == -1) {
+        rs_log_error("failed to open %s: %s", from, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    if (asprintf(&tmp_fname, "%s.%d.tmp", to, (int) getpid()) == -1) {
+        close(ifd);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    if ((ofd = open(tmp_fname, O_WRONLY|O_CREAT|O_TRUNC|O_BINARY, 0666)) == -1) {
+        rs_log_error("failed to create %s: %s", tmp_fname, strerror(errno));
+        close(ifd);
+        free(tmp_fname);
+        return EXIT_IO_ERROR;
+    }
+    while ((n = read(ifd, buf, sizeof buf)) != 0) {
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 || (ret = writex(ofd, buf, n)) != 0) {
+            ret = EXIT_IO_ERROR;
+            break;
+        }
+    }
+    close(ifd);
+    if (mrcc_close(ofd) != 0)
+        ret = EXIT_IO_ERROR;
+    if (ret == 0 && rename(tmp_fname, to) == -1) {
+        rs_log_error("rename %s to %s failed: %s", tmp_fname, to,
+                     strerror(errno));
+        ret = EXIT_IO_ERROR;
+    }
+    if (ret)
+        unlink(tmp_fname);
+    free(tmp_fname);
+    return ret;
+}
+
+
+/*
+ * move a file, also across file systems
+ */
+int move_file(const char *from, const char *to)
+{
+    int ret;
+
+    if (rename(from, to) == 0)
+        return 0;
+    if (errno != EXDEV) {
+        rs_log_error("rename %s to %s failed: %s", from, to, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+
+    if ((ret = copy_file(from, to)) == 0)
+        unlink(from);
+    return ret;
+}
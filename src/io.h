@@ -19,4 +19,7 @@ int open_read(const char *fname, int *ifd, off_t *fsize);
 
 int copy_file_to_fd(const char *in_fname, int out_fd);
 
+int copy_file(const char *from, const char *to);
+int move_file(const char *from, const char *to);
+
 #endif //_HEADER_IO_H
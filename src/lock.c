@@ -0,0 +1,199 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "tempfile.h"
+#include "lock.h"
+
+/**
+ * @file
+ *
+ * Cooperative locking between mrcc processes, on the master and on the
+ * map nodes.
+ *
+ * Locks are taken with flock() on files that are never deleted, so the
+ * kernel releases them when the process holding them exits, however it
+ * exits.  There is no need to clean up stale lock files.
+ **/
+
+
+/**
+ * Open (and create if needed) the lock file @p fname.
+ **/
+int mrcc_open_lockfile(const char *fname, int *plockfd)
+{
+    /* Create if it doesn't exist.  We don't actually do anything with
+     * the file except lock it. */
+    *plockfd = open(fname, O_WRONLY|O_CREAT, 0666);
+    if (*plockfd == -1 && errno != EEXIST) {
+        rs_log_error("failed to create %s: %s", fname, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Lock an open lock file.
+ *
+ * @returns 0 if locked, EXIT_BUSY if @p block is false and somebody
+ * else holds it, or another error.
+ **/
+static int sys_lock(int fd, int block)
+{
+    while (flock(fd, LOCK_EX | (block ? 0 : LOCK_NB)) == -1) {
+        if (errno == EINTR)
+            continue;
+        if (errno == EWOULDBLOCK)
+            return EXIT_BUSY;
+        rs_log_error("flock(%d) failed: %s", fd, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    return 0;
+}
+
+
+/**
+ * Take an exclusive lock on @p fname.  On success the open lock file
+ * is returned in @p lock_fd; pass it to mrcc_unlock() to release.
+ **/
+int mrcc_lock_file(const char *fname, int block, int *lock_fd)
+{
+    int ret;
+
+    if ((ret = mrcc_open_lockfile(fname, lock_fd)))
+        return ret;
+
+    if ((ret = sys_lock(*lock_fd, block))) {
+        close(*lock_fd);
+        *lock_fd = -1;
+        return ret;
+    }
+
+    rs_trace("got lock %s on fd%d", fname, *lock_fd);
+    return 0;
+}
+
+
+/**
+ * Take one of @p n_slots lock files "DIR/NAME_0" ... "DIR/NAME_{n-1}".
+ * This bounds the number of processes doing the same thing at once,
+ * across every process sharing @p dir.
+ *
+ * If @p block is set, poll until a slot comes free.
+ **/
+int mrcc_lock_slot(const char *dir, const char *name,
+                   int n_slots, int block, int *lock_fd)
+{
+    char *fname = NULL;
+    int i;
+    int ret;
+
+    if (n_slots < 1)
+        n_slots = 1;
+
+    while (1) {
+        for (i = 0; i < n_slots; i++) {
+            if (asprintf(&fname, "%s/%s_%d", dir, name, i) == -1)
+                return EXIT_OUT_OF_MEMORY;
+            ret = mrcc_lock_file(fname, 0, lock_fd);
+            free(fname);
+            if (ret == 0)
+                return 0;
+            if (ret != EXIT_BUSY)
+                return ret;
+        }
+        if (!block)
+            return EXIT_BUSY;
+        poll(NULL, 0, 100);
+    }
+}
+
+
+void mrcc_unlock(int lock_fd)
+{
+    if (lock_fd == -1)
+        return;
+
+    rs_trace("release lock fd%d", lock_fd);
+    /* All our current locks can just be closed */
+    if (close(lock_fd)) {
+        rs_log_error("close failed: %s", strerror(errno));
+    }
+}
+
+
+/**
+ * Lock the state file @p name, shared by all mrcc processes of the
+ * user, and open it for update.  The lock is a file of the same name
+ * in the lock dir; the data is in the state dir.
+ *
+ * The caller rewrites the file in place; mrcc_close_state() releases it.
+ **/
+int mrcc_open_state(const char *name, int *lock_fd, FILE **fp)
+{
+    char *lock_dir, *state_dir, *fname;
+    int fd;
+    int ret;
+
+    if ((ret = get_lock_dir(&lock_dir)) || (ret = get_state_dir(&state_dir)))
+        return ret;
+
+    if (asprintf(&fname, "%s/%s", lock_dir, name) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    ret = mrcc_lock_file(fname, 1, lock_fd);
+    free(fname);
+    if (ret)
+        return ret;
+
+    if (asprintf(&fname, "%s/%s", state_dir, name) == -1) {
+        mrcc_unlock(*lock_fd);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    if ((fd = open(fname, O_RDWR|O_CREAT, 0666)) == -1
+        || (*fp = fdopen(fd, "r+")) == NULL) {
+        rs_log_error("failed to open %s: %s", fname, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        free(fname);
+        mrcc_unlock(*lock_fd);
+        return EXIT_IO_ERROR;
+    }
+    free(fname);
+    return 0;
+}
+
+
+void mrcc_close_state(int lock_fd, FILE *fp)
+{
+    fclose(fp);
+    mrcc_unlock(lock_fd);
+}
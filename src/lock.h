@@ -0,0 +1,19 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_LOCK_H
+# define _HEADER_LOCK_H
+
+int mrcc_open_lockfile(const char *fname, int *plockfd);
+
+int mrcc_lock_file(const char *fname, int block, int *lock_fd);
+
+int mrcc_lock_slot(const char *dir, const char *name,
+                   int n_slots, int block, int *lock_fd);
+
+void mrcc_unlock(int lock_fd);
+
+int mrcc_open_state(const char *name, int *lock_fd, FILE **fp);
+void mrcc_close_state(int lock_fd, FILE *fp);
+
+#endif //_HEADER_LOCK_H
@@ -0,0 +1,457 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "files.h"
+#include "args.h"
+#include "exec.h"
+#include "cleanup.h"
+#include "tempfile.h"
+#include "admit.h"
+#include "batch.h"
+#include "remote.h"
+#include "bundle.h"
+#include "rlink.h"
+#include "lto.h"
+
+/**
+ * @file
+ *
+ * Links with ThinLTO, "mrcc-ld clang -flto=thin -fuse-ld=lld a.o b.o",
+ * whose backends, one per bitcode module, are the expensive part of the
+ * build and would all run on the master.
+ *
+ * The thin link runs locally first, with
+ *     -Wl,--thinlto-index-only=LIST -Wl,--thinlto-emit-imports-files
+ * which writes the modules to LIST, and M.thinlto.bc and M.imports next
+ * to every module M, and stops there.  The backend of M is then
+ *     CC OPTS -c -x ir M -fthinlto-index=M.thinlto.bc -o NATIVE
+ * where OPTS are the code generation options of the link: -O, -g, -m,
+ * -f and the target.  It reads M, its index, and the modules M.imports
+ * names, which go to the cluster as one bundle (see bundle.c), so the
+ * backend runs as a remote compile like any other: through admission
+ * control, the batch, and the node caches.  Every backend is run by a
+ * child of its own, up to MRCC_LTO_JOBS (default 16) at a time, and a
+ * backend that fails remotely runs locally.  The final link then runs
+ * locally, with the native objects in place of the modules.
+ *
+ * Modules named by absolute paths or from outside the working directory
+ * cannot be bundled, their backends run locally.  Links without
+ * -flto=thin, or not by clang, and links that fail anywhere on the way,
+ * run locally as they are; so do all of them with MRCC_LTO=0.  GCC's
+ * -flto has no such split of the backends, and stays local.
+ **/
+
+
+/*
+ * run @p argv here and now, returning its exit code
+ */
+static int lto_run(char **argv)
+{
+    int status;
+    pid_t pid;
+    int ret;
+
+    if ((ret = spawn_child(argv, &pid, NULL, NULL, NULL)) != 0
+        || (ret = collect_child("ld", pid, &status, timeout_null_fd)) != 0)
+        return ret;
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return EXIT_MRCC_FAILED;
+}
+
+
+/*
+ * whether the link @p argv is a thin one we know how to split
+ */
+static int lto_is_thin(char **argv)
+{
+    int i;
+
+    if (strstr(find_basename(argv[0]), "clang") == NULL)
+        return 0;
+    for (i = 1; argv[i]; i++) {
+        if (str_equal(argv[i], "-flto=thin"))
+            return 1;
+    }
+    return 0;
+}
+
+
+/*
+ * the options of the link @p argv that the backends need, in @p opts,
+ * which has space for all of @p argv
+ */
+static void lto_backend_opts(char **argv, char **opts)
+{
+    int i, j = 0;
+
+    for (i = 1; argv[i]; i++) {
+        char *a = argv[i];
+
+        if (str_startswith("-flto", a) || str_startswith("-fuse-ld", a))
+            continue;
+        if ((str_equal(a, "-mllvm") || str_equal(a, "-target")) && argv[i+1]) {
+            opts[j++] = a;
+            opts[j++] = argv[++i];
+        } else if (str_startswith("-O", a) || str_startswith("-g", a)
+                   || str_startswith("-m", a) || str_startswith("-f", a)
+                   || str_startswith("--target=", a)) {
+            opts[j++] = a;
+        }
+    }
+    opts[j] = NULL;
+}
+
+
+/*
+ * Read the lines of @p fname into a NULL terminated list.  A missing
+ * file is an empty list.
+ */
+static int lto_read_list(const char *fname, char ***list_ret)
+{
+    char *line = NULL, **list, **more;
+    size_t line_size = 0;
+    ssize_t len;
+    int n = 0, size = 8;
+    int ret = 0;
+    FILE *fp;
+
+    if ((list = calloc(size + 1, sizeof(char *))) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    *list_ret = list;
+    if ((fp = fopen(fname, "r")) == NULL)
+        return errno == ENOENT ? 0 : EXIT_IO_ERROR;
+    while (ret == 0 && (len = getline(&line, &line_size, fp)) != -1) {
+        if (len > 0 && line[len - 1] == '\n')
+            line[--len] = '\0';
+        if (len == 0)
+            continue;
+        if (n == size) {
+            if ((more = realloc(list, (2 * size + 1) * sizeof(char *)))
+                == NULL) {
+                ret = EXIT_OUT_OF_MEMORY;
+                break;
+            }
+            size *= 2;
+            *list_ret = list = more;
+        }
+        if ((list[n] = strdup(line)) == NULL)
+            ret = EXIT_OUT_OF_MEMORY;
+        else
+            list[++n] = NULL;
+    }
+    free(line);
+    fclose(fp);
+    return ret;
+}
+
+
+/*
+ * the thin link: write the index files of the modules of @p argv, and
+ * return the modules in @p modules
+ */
+static int lto_thin_link(char **argv, char ***modules)
+{
+    char **link_argv, *list_fname, *opt;
+    int ret;
+
+    if ((ret = make_tmpnam("mrcc_lto", ".list", &list_fname)))
+        return ret;
+    if ((ret = copy_argv(argv, &link_argv, 2)))
+        return ret;
+    if (asprintf(&opt, "-Wl,--thinlto-index-only=%s", list_fname) == -1) {
+        free_argv(link_argv);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    argv_append(link_argv, opt);
+    argv_append(link_argv, strdup("-Wl,--thinlto-emit-imports-files"));
+
+    ret = lto_run(link_argv);
+    free_argv(link_argv);
+    if (ret != 0) {
+        rs_log_warning("thin link failed, linking in full");
+        return ret;
+    }
+    return lto_read_list(list_fname, modules);
+}
+
+
+/*
+ * the backend of @p module, writing @p native
+ */
+static int lto_backend_argv(char **argv, char **opts, const char *module,
+                            const char *native, char ***backend_ret)
+{
+    char **backend;
+    char *index;
+    int i, j = 0;
+
+    if ((backend = calloc(argv_len(opts) + 9, sizeof(char *))) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    if (asprintf(&index, "-fthinlto-index=%s.thinlto.bc", module) == -1) {
+        free(backend);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    backend[j++] = strdup(argv[0]);
+    for (i = 0; opts[i]; i++)
+        backend[j++] = strdup(opts[i]);
+    backend[j++] = strdup("-c");
+    backend[j++] = strdup("-x");
+    backend[j++] = strdup("ir");
+    backend[j++] = strdup(module);
+    backend[j++] = index;
+    backend[j++] = strdup("-o");
+    backend[j++] = strdup(native);
+    for (i = 0; i < j; i++) {
+        if (backend[i] == NULL) {
+            free_argv(backend);
+            return EXIT_OUT_OF_MEMORY;
+        }
+    }
+    *backend_ret = backend;
+    return 0;
+}
+
+
+/*
+ * Run the backend @p backend of @p module on the cluster, with the
+ * module, its index and its imports in a bundle.  Runs in a child.
+ */
+static int lto_backend_remote(char **backend, const char *module,
+                              char *native)
+{
+    char **files, **imports = NULL;
+    char *fname, *bundle_fname;
+    int admit_fd = -1;
+    int status = 0;
+    int n, i;
+    int ret;
+
+    if (admit_route(batch_enabled(), &admit_fd) == ADMIT_LOCAL)
+        return EXIT_MRCC_FAILED;
+
+    if (asprintf(&fname, "%s.imports", module) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    ret = lto_read_list(fname, &imports);
+    free(fname);
+    if (ret != 0)
+        return ret;
+
+    n = argv_len(imports);
+    if ((files = calloc(n + 3, sizeof(char *))) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    files[0] = (char *) module;
+    if (asprintf(&files[1], "%s.thinlto.bc", module) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    for (i = 0; i < n; i++)
+        files[i + 2] = imports[i];
+    for (i = 0; files[i]; i++) {
+        if (!bundle_name_ok(files[i])) {
+            rs_log_info("%s cannot go remote, imports %s", module, files[i]);
+            return EXIT_MRCC_FAILED;
+        }
+    }
+
+    if ((ret = make_tmpnam("mrcc", ".bundle", &bundle_fname))
+        || (ret = bundle_create(bundle_fname, files)))
+        return ret;
+
+    if ((ret = compile_remote_bundle(backend, bundle_fname, native,
+                                     &status)) != 0)
+        return ret;
+    return status;
+}
+
+
+/*
+ * wait for one backend, and keep the first failure in @p ret
+ */
+static void lto_wait_one(int *running, int *ret)
+{
+    int status, backend_ret;
+    pid_t pid;
+
+    while ((pid = wait(&status)) == -1 && errno == EINTR)
+        ;
+    if (pid == -1) {
+        rs_log_error("wait failed: %s", strerror(errno));
+        *running = 0;
+        if (*ret == 0)
+            *ret = EXIT_MRCC_FAILED;
+        return;
+    }
+    (*running)--;
+
+    if (WIFEXITED(status))
+        backend_ret = WEXITSTATUS(status);
+    else
+        backend_ret = EXIT_MRCC_FAILED;
+    if (backend_ret != 0 && *ret == 0)
+        *ret = backend_ret;
+}
+
+
+/*
+ * run the backends of @p modules, into @p natives
+ */
+static int lto_backends(char **argv, char **modules, char **natives)
+{
+    char **opts, **backend;
+    int max_jobs, running = 0;
+    int ret = 0;
+    int i;
+    pid_t pid;
+
+    if ((opts = calloc(argv_len(argv) + 1, sizeof(char *))) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    lto_backend_opts(argv, opts);
+    max_jobs = getenv_int("MRCC_LTO_JOBS", 16);
+    if (max_jobs < 1)
+        max_jobs = 1;
+    fflush(NULL);
+
+    for (i = 0; modules[i] && ret == 0; i++) {
+        if (running == max_jobs)
+            lto_wait_one(&running, &ret);
+        if ((ret = make_tmpnam("mrcc_lto", ".o", &natives[i]))
+            || (ret = lto_backend_argv(argv, opts, modules[i], natives[i],
+                                       &backend)))
+            break;
+
+        if ((pid = fork()) == -1) {
+            rs_log_error("failed to fork: %s", strerror(errno));
+            free_argv(backend);
+            ret = EXIT_MRCC_FAILED;
+            break;
+        }
+        if (pid == 0) {
+            /* the parent's files are the parent's */
+            forget_cleanups();
+            if (lto_backend_remote(backend, modules[i], natives[i]) == 0)
+                exit(0);
+            rs_log_warning("backend of %s runs locally", modules[i]);
+            exit(lto_run(backend));
+        }
+        rs_trace("backend of %s is process %d", modules[i], (int) pid);
+        free_argv(backend);
+        running++;
+    }
+    while (running > 0)
+        lto_wait_one(&running, &ret);
+
+    free(opts);
+    return ret;
+}
+
+
+/*
+ * the final link: @p argv with the natives in place of the modules
+ */
+static int lto_final_link(char **argv, char **modules, char **natives)
+{
+    char **link_argv;
+    int i, j, k;
+    int ret;
+
+    if ((link_argv = calloc(argv_len(argv) + 1, sizeof(char *))) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    for (i = j = 0; argv[i]; i++) {
+        if (i > 0 && str_equal(argv[i], "-flto=thin"))
+            continue;
+        link_argv[j] = argv[i];
+        for (k = 0; modules[k]; k++) {
+            if (str_equal(argv[i], modules[k])) {
+                link_argv[j] = natives[k];
+                break;
+            }
+        }
+        j++;
+    }
+    ret = lto_run(link_argv);
+    free(link_argv);
+    return ret;
+}
+
+
+/**
+ * Link @p argv, running the ThinLTO backends on the cluster, unless
+ * @p sg_level says that this is a recursive mrcc (see mrcc.c).  Returns
+ * the exit code of the link.
+ **/
+int lto_link(char **argv, int sg_level)
+{
+    char **modules = NULL, **natives = NULL;
+    char *fname;
+    int n, i;
+    int ret;
+
+    /* objects that stayed on the net fs, see rlink.c */
+    if ((ret = rlink_materialize(argv)))
+        return ret;
+    if (sg_level || !lto_is_thin(argv) || !getenv_bool("MRCC_LTO", 1))
+        return lto_run(argv);
+
+    if (lto_thin_link(argv, &modules) != 0)
+        goto full;
+    n = argv_len(modules);
+    for (i = 0; i < n; i++) {
+        if (asprintf(&fname, "%s.thinlto.bc", modules[i]) == -1)
+            return EXIT_OUT_OF_MEMORY;
+        add_cleanup(fname);
+        free(fname);
+        if (asprintf(&fname, "%s.imports", modules[i]) == -1)
+            return EXIT_OUT_OF_MEMORY;
+        add_cleanup(fname);
+        free(fname);
+    }
+    if (n == 0)
+        goto full;
+
+    rs_log_info("running the backends of %d modules", n);
+    if ((natives = calloc(n + 1, sizeof(char *))) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    if (lto_backends(argv, modules, natives) != 0) {
+        rs_log_warning("ThinLTO backends failed, linking in full");
+        goto full;
+    }
+    ret = lto_final_link(argv, modules, natives);
+    free_argv(modules);
+    free_argv(natives);
+    return ret;
+
+  full:
+    if (modules)
+        free_argv(modules);
+    if (natives)
+        free_argv(natives);
+    return lto_run(argv);
+}
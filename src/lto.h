@@ -0,0 +1,9 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_LTO_H
+# define _HEADER_LTO_H
+
+int lto_link(char **argv, int sg_level);
+
+#endif //_HEADER_LTO_H
@@ -0,0 +1,250 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "files.h"
+#include "cleanup.h"
+#include "io.h"
+#include "pack.h"
+#include "manifest.h"
+
+/**
+ * @file
+ *
+ * Compiles with side outputs: -gsplit-dwarf writes a .dwo, -fstack-usage
+ * a .su, -fcallgraph-info a .ci, all next to the object, named after it
+ * without its extension.
+ *
+ * The master passes the compiler "-dumpbase BASE", where BASE is that
+ * name, relative to the master's working directory, or just "./NAME"
+ * if the object goes elsewhere.  GCC 11 and later name the side outputs
+ * after it, and so does the .dwo name recorded in the object.  The
+ * mapper runs such a compile in a scratch directory of its own, so that
+ * the side outputs land there, and afterwards replaces the object with
+ * a pack (see pack.c) of the object and every file the compiler left in
+ * the directory of BASE.  The index of the pack is the manifest of the
+ * result.  The pack travels like any object would, and the master
+ * unpacks it: the object to the output file, the others next to it.
+ *
+ * Dependency files are not among them, they are written by the
+ * preprocessor on the master.
+ **/
+
+
+/**
+ * Make the scratch directory a compile with side outputs named after
+ * @p dumpbase runs in, with the directories of @p dumpbase in it, and
+ * return its name in @p scratch_ret.  It is removed at exit.
+ **/
+int manifest_prepare(const char *out_fname, const char *dumpbase,
+                     char **scratch_ret)
+{
+    char *scratch, *path, *slash;
+    int ret;
+
+    if (dumpbase[0] == '/' || strstr(dumpbase, "..")) {
+        rs_log_error("bad side output base \"%s\"", dumpbase);
+        return EXIT_PROTOCOL_ERROR;
+    }
+    if (asprintf(&scratch, "%s.aux", out_fname) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    if (asprintf(&path, "%s/%s", scratch, dumpbase) == -1) {
+        free(scratch);
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    /* the compiler does not create them, and the first is the scratch
+     * directory itself */
+    slash = path + strlen(scratch);
+    for (; slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        if (mkdir(path, 0777) == 0) {
+            ret = add_cleanup(path);
+        } else if (errno == EEXIST) {
+            ret = 0;
+        } else {
+            rs_log_error("failed to create %s: %s", path, strerror(errno));
+            ret = EXIT_IO_ERROR;
+        }
+        *slash = '/';
+        if (ret) {
+            free(path);
+            free(scratch);
+            return ret;
+        }
+    }
+
+    free(path);
+    *scratch_ret = scratch;
+    return 0;
+}
+
+
+/**
+ * Replace @p out_fname, just compiled in @p scratch with side outputs
+ * named after @p dumpbase, with the pack of it and the side outputs.
+ **/
+int manifest_pack(const char *out_fname, const char *scratch,
+                  const char *dumpbase)
+{
+    char *dir = NULL, *pack = NULL, *fname;
+    struct pack_writer w;
+    struct dirent *de;
+    struct stat st;
+    long off, len;
+    int n = 0;
+    DIR *d;
+    int ret;
+
+    if (asprintf(&dir, "%s/%.*s", scratch,
+                 (int) (find_basename(dumpbase) - dumpbase), dumpbase) == -1
+        || asprintf(&pack, "%s.manifest", out_fname) == -1) {
+        free(dir);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    if ((ret = pack_create(pack, &w)))
+        goto out;
+    if ((ret = pack_add_file(&w, find_basename(out_fname), out_fname,
+                             &off, &len)))
+        goto finish;
+
+    if ((d = opendir(dir)) == NULL) {
+        rs_log_error("failed to open %s: %s", dir, strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto finish;
+    }
+    while (ret == 0 && (de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.')
+            continue;
+        if (asprintf(&fname, "%s/%s", dir, de->d_name) == -1) {
+            ret = EXIT_OUT_OF_MEMORY;
+            break;
+        }
+        if (stat(fname, &st) == 0 && S_ISREG(st.st_mode)) {
+            if (strpbrk(de->d_name, " \t\n")) {
+                rs_log_error("cannot return side output \"%s\"", fname);
+                ret = EXIT_MRCC_FAILED;
+            } else if ((ret = pack_add_file(&w, de->d_name, fname,
+                                            &off, &len)) == 0) {
+                n++;
+            }
+            unlink(fname);
+        }
+        free(fname);
+    }
+    closedir(d);
+
+  finish:
+    if (pack_finish(&w) != 0 && ret == 0)
+        ret = EXIT_IO_ERROR;
+    if (ret == 0 && rename(pack, out_fname) == -1) {
+        rs_log_error("rename %s to %s failed: %s",
+                     pack, out_fname, strerror(errno));
+        ret = EXIT_IO_ERROR;
+    }
+    if (ret == 0)
+        rs_trace("%s goes back with %d side outputs", out_fname, n);
+    else
+        unlink(pack);
+
+  out:
+    free(dir);
+    free(pack);
+    return ret;
+}
+
+
+struct manifest_unpack {
+    const char *result;
+    const char *output_fname;
+    const char *obj;        /* member that is the object */
+    long obj_off, obj_len;
+};
+
+/* pack_foreach() callback: extract a side output, note the object */
+static int manifest_unpack_member(int fd, const char *name, long off,
+                                  long len, void *arg)
+{
+    struct manifest_unpack *m = arg;
+    int dir_len = find_basename(m->output_fname) - m->output_fname;
+    char *dst;
+    int ret;
+
+    if (str_equal(name, m->obj)) {
+        m->obj_off = off;
+        m->obj_len = len;
+        return 0;
+    }
+    /* nothing but names in the output directory */
+    if (name[0] == '.' || strchr(name, '/')) {
+        rs_log_error("bad side output \"%s\" in %s", name, m->result);
+        return EXIT_PROTOCOL_ERROR;
+    }
+    if (asprintf(&dst, "%.*s%s", dir_len, m->output_fname, name) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    rs_trace("side output %s", dst);
+    ret = pack_extract(fd, off, len, dst);
+    free(dst);
+    return ret;
+}
+
+/**
+ * Unpack the result @p result of a compile with side outputs: the
+ * object to @p output_fname, and the side outputs into its directory.
+ * The object comes last, so that it is not there before them.
+ **/
+int manifest_unpack(const char *result, const char *output_fname)
+{
+    struct manifest_unpack m;
+    int fd;
+    int ret;
+
+    m.result = result;
+    m.output_fname = output_fname;
+    m.obj = find_basename(result);
+    m.obj_off = -1;
+    m.obj_len = 0;
+    if ((fd = open(result, O_RDONLY|O_BINARY)) == -1) {
+        rs_log_error("failed to open %s: %s", result, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+
+    ret = pack_foreach(fd, manifest_unpack_member, &m);
+    if (ret == 0 && m.obj_off == -1) {
+        rs_log_error("no object in %s", result);
+        ret = EXIT_PROTOCOL_ERROR;
+    }
+    if (ret == 0)
+        ret = pack_extract(fd, m.obj_off, m.obj_len, output_fname);
+
+    close(fd);
+    unlink(result);
+    return ret;
+}
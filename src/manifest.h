@@ -0,0 +1,13 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_MANIFEST_H
+# define _HEADER_MANIFEST_H
+
+int manifest_prepare(const char *out_fname, const char *dumpbase,
+                     char **scratch_ret);
+int manifest_pack(const char *out_fname, const char *scratch,
+                  const char *dumpbase);
+int manifest_unpack(const char *result, const char *output_fname);
+
+#endif //_HEADER_MANIFEST_H
@@ -0,0 +1,802 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "files.h"
+#include "tempfile.h"
+#include "cleanup.h"
+#include "lock.h"
+#include "netfsutils.h"
+#include "batch.h"
+#include "mapcache.h"
+#include "pack.h"
+#include "io.h"
+#include "manifest.h"
+#include "pch.h"
+#include "bundle.h"
+#include "rlink.h"
+#include "modules.h"
+#include "toolchain.h"
+#include "mapbatch.h"
+
+/**
+ * @file
+ *
+ * The map side of batch mode, "mrcc-map --batch".
+ *
+ * Every line on stdin has unit records separated by tabs, see batch.c:
+ * one line per task with NLineInputFormat, or one unit per line in
+ * data-local mode.  All units a task gets are its split, and are
+ * compiled in parallel as long as their expected peak memory fits in the
+ * task budget, MRCC_BATCH_TASK_MEM.
+ *
+ * Hadoop knows nothing about that budget, so the map tasks on one node
+ * also take one of the node's memory slots first: the node's physical
+ * memory divided by the task budget, or MRCC_MAP_SLOTS if it is set.
+ *
+ * For every unit one record goes to stdout, which ends up in the job
+ * output for the leader on the master:
+ *     CPP_FNAME <tab> STATUS <tab> PEAK_RSS_KB <tab> MSEC <tab> CACHE_HIT
+ *     [<tab> OBJECT_BASE64 | <tab> @OUTPUT_PACK]
+ * where CACHE_HIT is 1 if the input came from the node cache.  Units
+ * whose input came inline in the record get their object back inline
+ * too, if it is no bigger than MRCC_BATCH_INLINE KB.  The other objects
+ * of the task go into one pack (see pack.c), which is put to the
+ * MRCC_BATCH_OPACKS dir on the net fs when the split is done; their
+ * records only name it.
+ *
+ * Inputs that are not inline are slices of the batch's input pack,
+ * MRCC_BATCH_PACK, which every task fetches once, through the node
+ * cache.  A unit with "same=" has no input of its own: it compiles a
+ * link to that of another unit, which is started first.  A unit with
+ * "db=" has side outputs, and its object goes back as the pack of them
+ * all, see manifest.c.  A unit with "pch=" loads a precompiled header,
+ * which is fetched once for the task, see pch.c.  A unit whose input is
+ * a bundle is compiled in the directory it is extracted to, see
+ * bundle.c.  A unit with "keep=" leaves its object on the net fs and
+ * returns a stub of it, see rlink.c.  A unit with "mods=" gets the
+ * interfaces of the C++ modules it imports, and returns the one it
+ * exports with its object, see modules.c.  A unit with "tc=" compiles
+ * with the toolchain of the master, which is unpacked once per node,
+ * see toolchain.c.
+ *
+ * With MRCC_BATCH_STEAL=1 on the master, the splits are only where a map
+ * task starts.  Every unit has to be claimed before it is compiled, by
+ * creating its claim file on the net fs, which only one task can do.
+ * Each put of a claim is a JVM of its own, so the units of a split are
+ * claimed MAP_CLAIM_UNITS at a time, with one claim file for the run.  A
+ * task that is done with its own split goes on to the units of the
+ * other splits, taking the shortest ones at their tail first, until the
+ * whole batch is claimed.  See map_steal_queue().
+ **/
+
+/* the units of a split that are claimed together when stealing work */
+#define MAP_CLAIM_UNITS     4
+
+struct map_unit {
+    struct batch_unit u;
+    pid_t pid;
+    int started;
+    struct timeval start;
+    int inline_in;      /* the input came inline */
+    char *scratch;      /* where a compile with side outputs runs */
+    char *mod_mapper;   /* module mapper file of a module unit */
+    const char *claim;  /* the claim that covers it when stealing work */
+    int cache_hit;
+    int in_pack;        /* object waits in the output pack */
+    long mem_kb;        /* with these results */
+    long msec;
+};
+
+/* net fs dir for the claim files when stealing work, or NULL */
+static char *claim_dir = NULL;
+
+/* empty local file that is put as a claim */
+static char *claim_token = NULL;
+
+/* the claims tried so far, and whether they are ours */
+static char **claims = NULL;
+static int *claim_rets = NULL;
+static int n_claims = 0;
+
+/* the batch's input pack, once fetched */
+static int in_pack_fd = -1;
+static int in_pack_hit = 0;
+
+/* this task's output pack, while there are objects in it */
+static struct pack_writer out_pack;
+static char *out_pack_fname = NULL;
+
+
+/*
+ * how many map tasks may run at once on this node
+ */
+static int map_node_slots(long task_mem_kb)
+{
+    long pages, page_size;
+    int slots;
+
+    if ((slots = getenv_int("MRCC_MAP_SLOTS", 0)) > 0)
+        return slots;
+
+    pages = sysconf(_SC_PHYS_PAGES);
+    page_size = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || page_size <= 0 || task_mem_kb <= 0)
+        return 1;
+
+    slots = (int) (pages / 1024 * page_size / task_mem_kb);
+    return slots > 0 ? slots : 1;
+}
+
+
+static void map_report(const struct map_unit *mu, int status,
+                       long mem_kb, long msec, const char *data)
+{
+    printf("%s\t%d\t%ld\t%ld\t%d", mu->u.cpp_fname, status, mem_kb, msec,
+           mu->cache_hit);
+    if (data)
+        printf("\t%s", data);
+    putchar('\n');
+    fflush(stdout);
+}
+
+
+/*
+ * Claim a unit for this task, along with the others of its claim.
+ * Returns EXIT_BUSY if another task has them, or EXIT_MAPPER_FAILED if
+ * the net fs failed us, in which case the master compiles them.
+ */
+static int map_claim_unit(struct map_unit *mu)
+{
+    char *fs_claim, **p;
+    int *q;
+    int i;
+    int ret;
+
+    for (i = 0; i < n_claims; i++) {
+        if (str_equal(claims[i], mu->claim))
+            return claim_rets[i];
+    }
+
+    if (asprintf(&fs_claim, "%s/%s", claim_dir, mu->claim) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    if (claim_file_fs(claim_token, fs_claim) == 0) {
+        ret = 0;
+    } else if (test_file_fs(fs_claim) == 0) {
+        ret = EXIT_BUSY;
+    } else {
+        rs_log_error("claim \"%s\" failed", fs_claim);
+        ret = EXIT_MAPPER_FAILED;
+    }
+    rs_trace("claim %s: %s", fs_claim, ret == 0 ? "ours"
+             : ret == EXIT_BUSY ? "taken" : "failed");
+    free(fs_claim);
+
+    if ((p = realloc(claims, (n_claims + 1) * sizeof *claims)) != NULL)
+        claims = p;
+    if ((q = realloc(claim_rets, (n_claims + 1) * sizeof *claim_rets))
+        != NULL)
+        claim_rets = q;
+    if (p && q) {
+        claims[n_claims] = (char *) mu->claim;
+        claim_rets[n_claims++] = ret;
+    }
+    return ret;
+}
+
+
+/*
+ * get the batch's input pack, unless we have it already
+ */
+static int map_get_in_pack(void)
+{
+    char *fname;
+    int ret;
+
+    if (in_pack_fd != -1)
+        return 0;
+    if (getenv("MRCC_BATCH_PACK") == NULL) {
+        rs_log_error("MRCC_BATCH_PACK is not set");
+        return EXIT_BAD_ARGUMENTS;
+    }
+    if ((ret = make_tmpnam("mrcc_pack", ".pack", &fname)))
+        return ret;
+    if (map_cache_get_file(getenv("MRCC_BATCH_PACK_DIGEST"),
+                           getenv("MRCC_BATCH_PACK"), fname,
+                           &in_pack_hit) != 0) {
+        rs_log_error("get input pack \"%s\" failed",
+                     getenv("MRCC_BATCH_PACK"));
+        return EXIT_GET_CPP_FS_FAILED;
+    }
+    if ((in_pack_fd = open(fname, O_RDONLY)) == -1) {
+        rs_log_error("failed to open %s: %s", fname, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    return 0;
+}
+
+
+/*
+ * the index of the unit whose input unit v shares, or -1
+ */
+static int map_find_first(struct map_unit *units, int n, int v)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (i != v && units[i].u.same == NULL
+            && str_equal(find_basename(units[i].u.cpp_fname),
+                         units[v].u.same))
+            return i;
+    }
+    return -1;
+}
+
+
+/*
+ * fetch the input of a unit and start its compiler; @p first is the
+ * unit whose input it shares, if any
+ */
+static int map_start_unit(struct map_unit *mu, struct map_unit *first)
+{
+    char *fs_cpp_fname, *cmd;
+    pid_t pid;
+    int ret;
+
+    if (mu->u.same) {
+        /* whoever compiled that one takes this one too */
+        if (first == NULL || !first->started)
+            return EXIT_BUSY;
+        if (link(first->u.cpp_fname, mu->u.cpp_fname) == -1
+            && (ret = copy_file(first->u.cpp_fname, mu->u.cpp_fname)))
+            return ret;
+        mu->inline_in = first->inline_in;
+        mu->cache_hit = first->cache_hit;
+    } else if (claim_dir && (ret = map_claim_unit(mu)) != 0) {
+        return ret;
+    } else if (mu->u.data) {
+        if ((ret = batch_decode_file(mu->u.data, strlen(mu->u.data),
+                                     mu->u.cpp_fname)))
+            return ret;
+        mu->inline_in = 1;
+    } else if (mu->u.packed) {
+        if ((ret = map_get_in_pack())
+            || (ret = pack_extract(in_pack_fd, mu->u.pack_off,
+                                   mu->u.pack_len, mu->u.cpp_fname)))
+            return ret;
+        mu->cache_hit = in_pack_hit;
+    } else {
+        if ((fs_cpp_fname = name_local_to_fs(mu->u.cpp_fname)) == NULL)
+            return EXIT_OUT_OF_MEMORY;
+        if (map_cache_get_file(mu->u.digest, fs_cpp_fname,
+                               mu->u.cpp_fname, &mu->cache_hit) != 0) {
+            rs_log_error("get cpp from net fs: \"%s\" failed",
+                         mu->u.cpp_fname);
+            free(fs_cpp_fname);
+            return EXIT_GET_CPP_FS_FAILED;
+        }
+        add_cleanup_fs(fs_cpp_fname);
+        free(fs_cpp_fname);
+    }
+
+    if ((ret = add_cleanup(mu->u.cpp_fname))
+        || (ret = add_cleanup(mu->u.out_fname)))
+        return ret;
+    if (mu->u.pch && (ret = pch_fetch(mu->u.pch, mu->u.cpp_fname)))
+        return ret;
+    if (mu->u.dumpbase && (ret = manifest_prepare(mu->u.out_fname,
+                                                  mu->u.dumpbase,
+                                                  &mu->scratch)))
+        return ret;
+    if (mu->u.mods && (ret = mod_fetch(mu->u.mods, mu->u.out_fname,
+                                       &mu->mod_mapper)))
+        return ret;
+    if (!mu->u.dumpbase && is_bundle(mu->u.cpp_fname)
+        && (ret = bundle_extract(mu->u.cpp_fname, &mu->scratch)))
+        return ret;
+
+    cmd = mu->u.argv;
+    if (mu->u.tc && (ret = tc_localize(mu->u.tc, mu->u.argv, &cmd)))
+        return ret;
+
+    rs_trace("compile on map: \"%s\"", cmd);
+    gettimeofday(&mu->start, NULL);
+    pid = fork();
+    if (pid == -1) {
+        rs_log_error("failed to fork: %s", strerror(errno));
+        if (cmd != mu->u.argv)
+            free(cmd);
+        return EXIT_OUT_OF_MEMORY;
+    } else if (pid == 0) {
+        /* stdout carries our records; keep the compiler off it */
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        if (mu->scratch && chdir(mu->scratch) == -1)
+            _exit(EXIT_IO_ERROR);
+        if (mu->mod_mapper)
+            setenv("CXX_MODULE_MAPPER", mu->mod_mapper, 1);
+        execl("/bin/sh", "sh", "-c", cmd, (char *) NULL);
+        _exit(EXIT_COMPILER_MISSING);
+    }
+    if (cmd != mu->u.argv)
+        free(cmd);
+    mu->pid = pid;
+    mu->started = 1;
+    return 0;
+}
+
+
+/*
+ * add the object of a unit to the output pack, creating it if need be
+ */
+static int map_pack_output(struct map_unit *mu)
+{
+    long off, len;
+    int ret;
+
+    if (out_pack_fname == NULL) {
+        if ((ret = make_tmpnam("mrcc_opack", ".pack", &out_pack_fname)))
+            return ret;
+        if ((ret = pack_create(out_pack_fname, &out_pack))) {
+            free(out_pack_fname);
+            out_pack_fname = NULL;
+            return ret;
+        }
+    }
+    if ((ret = pack_add_file(&out_pack, find_basename(mu->u.out_fname),
+                             mu->u.out_fname, &off, &len)))
+        return ret;
+    mu->in_pack = 1;
+    return 0;
+}
+
+
+/*
+ * the name of the output pack on the net fs, in the dir all the tasks of
+ * the batch share: the task attempt, or else the node, makes the local
+ * temp name unique there
+ */
+static char *map_out_pack_name(void)
+{
+    char host[256];
+    const char *task = getenv("mapred_task_id");
+    char *name;
+
+    if (task == NULL || *task == '\0' || strchr(task, '/')) {
+        if (gethostname(host, sizeof host) == -1)
+            strcpy(host, "localhost");
+        host[sizeof host - 1] = '\0';
+        task = host;
+    }
+    if (asprintf(&name, "%s_%s", task, find_basename(out_pack_fname)) == -1)
+        return NULL;
+    return name;
+}
+
+
+/*
+ * put the output pack to net fs and report the units in it
+ */
+static void map_put_outputs(struct map_unit *units, int n)
+{
+    char *fs_pack = NULL, *ref = NULL, *name = NULL;
+    int ret;
+    int i;
+
+    if (out_pack_fname == NULL)
+        return;
+
+    if ((ret = pack_finish(&out_pack)) == 0) {
+        if ((name = map_out_pack_name()) == NULL
+            || asprintf(&fs_pack, "%s/%s", getenv("MRCC_BATCH_OPACKS"),
+                        name) == -1 || asprintf(&ref, "@%s", name) == -1) {
+            ret = EXIT_OUT_OF_MEMORY;
+        } else if (put_file_fs(out_pack_fname, fs_pack) != 0) {
+            rs_log_error("put output pack \"%s\" failed", fs_pack);
+            ret = EXIT_MAPPER_FAILED;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        if (!units[i].in_pack)
+            continue;
+        if (ret)
+            map_report(&units[i], ret, units[i].mem_kb, units[i].msec, NULL);
+        else
+            map_report(&units[i], 0, units[i].mem_kb, units[i].msec, ref);
+        units[i].in_pack = 0;
+    }
+
+    unlink(out_pack_fname);
+    free(out_pack_fname);
+    out_pack_fname = NULL;
+    free(name);
+    free(fs_pack);
+    free(ref);
+}
+
+
+/*
+ * put the object of a finished unit to net fs, or inline it, or pack it,
+ * and report
+ */
+static void map_finish_unit(struct map_unit *mu, int wait_status,
+                            struct rusage *ru)
+{
+    struct timeval now, delta;
+    struct stat st;
+    char *fs_out_fname;
+    char *data = NULL;
+    int status;
+
+    gettimeofday(&now, NULL);
+    timeval_subtract(&delta, &now, &mu->start);
+
+    if (WIFEXITED(wait_status))
+        status = WEXITSTATUS(wait_status);
+    else
+        status = 128 + WTERMSIG(wait_status);
+    rs_trace("compile of %s returned %d", mu->u.cpp_fname, status);
+
+    if (status == 0 && mu->u.dumpbase)
+        status = manifest_pack(mu->u.out_fname, mu->scratch, mu->u.dumpbase);
+    if (status == 0 && mu->u.mods) {
+        char *module = malloc(strlen(mu->u.mods) + 1);
+
+        if (module == NULL)
+            status = EXIT_OUT_OF_MEMORY;
+        else if (mod_exported(mu->u.mods, module))
+            status = mod_pack(mu->u.out_fname, module);
+        free(module);
+    }
+    if (status == 0 && mu->u.keep)
+        status = rlink_keep(mu->u.out_fname);
+    free(mu->mod_mapper);
+    mu->mod_mapper = NULL;
+    free(mu->scratch);
+    mu->scratch = NULL;
+
+    if (status == 0 && mu->inline_in && stat(mu->u.out_fname, &st) == 0
+        && st.st_size <= batch_inline_max()) {
+        if (batch_encode_file(mu->u.out_fname, &data) != 0)
+            status = EXIT_OUT_OF_MEMORY;
+    } else if (status == 0 && getenv("MRCC_BATCH_OPACKS")) {
+        if ((status = map_pack_output(mu)) == 0) {
+            /* reported when the pack is on the net fs */
+            mu->mem_kb = ru->ru_maxrss;
+            mu->msec = delta.tv_sec * 1000L + delta.tv_usec / 1000;
+            return;
+        }
+    } else if (status == 0) {
+        if ((fs_out_fname = name_local_to_fs(mu->u.out_fname)) == NULL) {
+            status = EXIT_OUT_OF_MEMORY;
+        } else {
+            if (put_file_fs(mu->u.out_fname, fs_out_fname) != 0) {
+                rs_log_error("put output file to net fs: \"%s\" failed",
+                             mu->u.out_fname);
+                status = EXIT_MAPPER_FAILED;
+            }
+            free(fs_out_fname);
+        }
+    }
+
+    /* ru_maxrss is in kilobytes on Linux */
+    map_report(mu, status, ru->ru_maxrss,
+               delta.tv_sec * 1000L + delta.tv_usec / 1000, data);
+    free(data);
+}
+
+
+/*
+ * compile the units of one split, in parallel within the memory budget
+ */
+static int map_run_split(struct map_unit *units, int n, long task_mem_kb)
+{
+    struct map_unit tmp;
+    struct rusage ru;
+    long running_mem = 0;
+    int n_running = 0;
+    int next = 0;
+    int wait_status;
+    pid_t pid;
+    int i, first, ret;
+
+    while (next < n || n_running > 0) {
+        /* always run at least one, even if it alone is over budget */
+        while (next < n && (n_running == 0
+                  || running_mem + units[next].u.mem_kb <= task_mem_kb)) {
+            first = units[next].u.same
+                ? map_find_first(units, n, next) : -1;
+            if (first > next) {
+                /* stolen splits run backwards: wait for its input */
+                tmp = units[next];
+                memmove(&units[next], &units[next + 1],
+                        (first - next) * sizeof *units);
+                units[first] = tmp;
+                continue;
+            }
+            if ((ret = map_start_unit(&units[next],
+                            first >= 0 ? &units[first] : NULL)) == EXIT_BUSY) {
+                /* somebody else compiles this one */
+            } else if (ret != 0) {
+                map_report(&units[next], ret, 0, 0, NULL);
+            } else {
+                running_mem += units[next].u.mem_kb;
+                n_running++;
+            }
+            next++;
+        }
+        if (n_running == 0)
+            break;
+
+        pid = wait4(-1, &wait_status, 0, &ru);
+        if (pid == -1) {
+            if (errno == EINTR)
+                continue;
+            rs_log_error("wait4 failed: %s", strerror(errno));
+            return EXIT_MRCC_FAILED;
+        }
+        for (i = 0; i < next; i++) {
+            if (units[i].pid == pid)
+                break;
+        }
+        if (i == next)
+            continue;
+
+        map_finish_unit(&units[i], wait_status, &ru);
+        units[i].pid = 0;
+        running_mem -= units[i].u.mem_kb;
+        n_running--;
+    }
+    map_put_outputs(units, n);
+    return 0;
+}
+
+
+/*
+ * split one input line into its units, in place
+ */
+static int map_parse_split(char *line, struct map_unit **units_ret, int *n_ret)
+{
+    struct map_unit *units;
+    char *p, *tab;
+    int n, i;
+
+    /* NLineInputFormat hands us "OFFSET<tab>LINE" */
+    for (p = line; isdigit((unsigned char) *p); p++)
+        ;
+    if (p != line && *p == '\t')
+        line = p + 1;
+
+    for (n = 1, p = line; (p = strchr(p, '\t')) != NULL; p++)
+        n++;
+    if ((units = calloc(n, sizeof *units)) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+
+    for (i = 0, p = line; i < n; i++, p = tab + 1) {
+        if ((tab = strchr(p, '\t')) != NULL)
+            *tab = '\0';
+        if (batch_unit_parse(p, &units[i].u) != 0) {
+            free(units);
+            return EXIT_PROTOCOL_ERROR;
+        }
+        units[i].claim = find_basename(
+            units[i - i % MAP_CLAIM_UNITS].u.cpp_fname);
+        if (tab == NULL)
+            break;
+    }
+
+    *units_ret = units;
+    *n_ret = n;
+    return 0;
+}
+
+
+/*
+ * Add the rest of the batch to the own units of this task, in the order
+ * this task should try to steal them: the splits after our own one
+ * first, each from its tail, where its owner will get last.
+ *
+ * The whole job input is fetched from MRCC_BATCH_QUEUE.  The units point
+ * into *queue_ret, which the caller must free after running them.
+ */
+static int map_steal_queue(struct map_unit *own, int n_own,
+                           struct map_unit **all_ret, int *n_all_ret,
+                           char **queue_ret)
+{
+    const char *fs_queue;
+    char *queue_fname = NULL;
+    char *queue = NULL, *p, *nl;
+    char **lines = NULL, **more;
+    struct map_unit **split_units = NULL, *all = NULL;
+    int *split_n = NULL;
+    int n_lines = 0, n_all = 0, own_line = 0;
+    int i, j, k;
+    FILE *fp;
+    long len;
+    int ret = EXIT_OUT_OF_MEMORY;
+
+    if ((fs_queue = getenv("MRCC_BATCH_QUEUE")) == NULL) {
+        rs_log_error("MRCC_BATCH_QUEUE is not set");
+        return EXIT_BAD_ARGUMENTS;
+    }
+    if ((ret = make_tmpnam("mrcc_queue", ".txt", &queue_fname)))
+        return ret;
+    if (get_new_file_fs((char *) fs_queue, queue_fname) != 0
+        || (fp = fopen(queue_fname, "r")) == NULL) {
+        rs_log_error("get batch queue \"%s\" failed", fs_queue);
+        ret = EXIT_GET_CONFIG_FS_FAILED;
+        goto out;
+    }
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+    if ((queue = malloc(len + 1)) == NULL) {
+        fclose(fp);
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+    len = fread(queue, 1, len, fp);
+    queue[len] = '\0';
+    fclose(fp);
+
+    ret = EXIT_OUT_OF_MEMORY;
+    for (p = queue; *p; p = nl + 1) {
+        if ((more = realloc(lines, (n_lines + 1) * sizeof *lines)) == NULL)
+            goto out;
+        lines = more;
+        lines[n_lines++] = p;
+        if ((nl = strchr(p, '\n')) == NULL)
+            break;
+        *nl = '\0';
+    }
+
+    ret = EXIT_OUT_OF_MEMORY;
+    split_units = calloc(n_lines, sizeof *split_units);
+    split_n = calloc(n_lines, sizeof *split_n);
+    if (n_lines && (!split_units || !split_n))
+        goto out;
+    for (i = 0; i < n_lines; i++) {
+        if (*lines[i] == '\0')
+            continue;
+        if (map_parse_split(lines[i], &split_units[i], &split_n[i]) != 0)
+            continue;
+        n_all += split_n[i];
+        if (str_equal(split_units[i][0].u.cpp_fname, own[0].u.cpp_fname))
+            own_line = i;
+    }
+
+    if ((all = calloc(n_own + n_all, sizeof *all)) == NULL)
+        goto out;
+    memcpy(all, own, n_own * sizeof *all);
+    n_all = n_own;
+    for (k = 1; k < n_lines; k++) {
+        i = (own_line + k) % n_lines;
+        for (j = split_n[i] - 1; j >= 0; j--)
+            all[n_all++] = split_units[i][j];
+    }
+
+    rs_trace("%d own units, %d to steal", n_own, n_all - n_own);
+    *all_ret = all;
+    *n_all_ret = n_all;
+    *queue_ret = queue;
+    queue = NULL;
+    ret = 0;
+
+out:
+    for (i = 0; split_units && i < n_lines; i++)
+        free(split_units[i]);
+    free(split_units);
+    free(split_n);
+    free(lines);
+    free(queue);
+    unlink(queue_fname);
+    free(queue_fname);
+    return ret;
+}
+
+
+int map_batch(void)
+{
+    const char *tmp_top;
+    char *line = NULL;
+    char **lines = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+    struct map_unit *units = NULL, *line_units, *all_units;
+    char *queue;
+    void *p;
+    long task_mem_kb = batch_task_mem_kb();
+    int n_units = 0, n_line_units, n_all_units, n_lines = 0;
+    int slot_fd = -1;
+    int i;
+    int ret;
+
+    if ((ret = get_tmp_top(&tmp_top)))
+        return ret;
+
+    if ((claim_dir = getenv("MRCC_BATCH_CLAIMS")) != NULL
+        && (ret = make_tmpnam("mrcc_claim", "", &claim_token)))
+        return ret;
+
+    /* wait for the node to have memory for us */
+    if ((ret = mrcc_lock_slot(tmp_top, "mrcc-map-slot",
+                              map_node_slots(task_mem_kb), 1, &slot_fd)))
+        return ret;
+
+    /* the units point into the lines */
+    while ((len = getline(&line, &line_size, stdin)) != -1) {
+        if (len > 0 && line[len - 1] == '\n')
+            line[--len] = '\0';
+        if (len == 0)
+            continue;
+        if (map_parse_split(line, &line_units, &n_line_units) != 0) {
+            rs_log_error("bad split: %s", line);
+            continue;
+        }
+        /* each buffer is only ever freed at out */
+        if ((p = realloc(units, (n_units + n_line_units) * sizeof *units))
+            != NULL)
+            units = p;
+        if (p != NULL
+            && (p = realloc(lines, (n_lines + 1) * sizeof *lines)) != NULL)
+            lines = p;
+        if (p == NULL) {
+            free(line_units);
+            ret = EXIT_OUT_OF_MEMORY;
+            goto out;
+        }
+        memcpy(units + n_units, line_units, n_line_units * sizeof *units);
+        n_units += n_line_units;
+        free(line_units);
+        lines[n_lines++] = line;
+        line = NULL;
+        line_size = 0;
+    }
+
+    rs_trace("split of %d units", n_units);
+    if (n_units == 0) {
+        ret = 0;
+    } else if (claim_dir && map_steal_queue(units, n_units, &all_units,
+                                            &n_all_units, &queue) == 0) {
+        ret = map_run_split(all_units, n_all_units, task_mem_kb);
+        free(all_units);
+        free(queue);
+    } else {
+        ret = map_run_split(units, n_units, task_mem_kb);
+    }
+
+out:
+    free(units);
+    for (i = 0; i < n_lines; i++)
+        free(lines[i]);
+    free(lines);
+    free(line);
+    mrcc_unlock(slot_fd);
+    return ret;
+}
@@ -0,0 +1,9 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_MAPBATCH_H
+# define _HEADER_MAPBATCH_H
+
+int map_batch(void);
+
+#endif //_HEADER_MAPBATCH_H
@@ -0,0 +1,322 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "tempfile.h"
+#include "io.h"
+#include "netfsutils.h"
+#include "hash.h"
+#include "mapcache.h"
+
+/**
+ * @file
+ *
+ * Node-local, content addressed cache of the files mrcc-map fetches
+ * from the net fs.
+ *
+ * Every entry is a file named by the digest of its content (see
+ * hash_file_hex()) in MRCC_MAP_CACHE, $TMPDIR/mrcc-cache by default.
+ * The digest comes from the master along with the net fs name, so a hit
+ * needs no net fs access at all: the same input compiled again, a
+ * retried unit, or a unit stolen by a task on a node that already had
+ * it.
+ *
+ * There is no locking between the tasks sharing a node.  An entry is
+ * written under a temporary name and renamed into place, and it is
+ * handed out by hard link (or copy), so an entry that is evicted while
+ * somebody uses it just stays alive until they are done.  A reader who
+ * loses the race against eviction sees a miss.
+ *
+ * The cache is kept under MRCC_MAP_CACHE_SIZE MB (default 1024) by
+ * removing the least recently used entries after each insert; hits
+ * touch the entry's mtime.  MRCC_MAP_CACHE_SIZE=0 disables the cache.
+ **/
+
+struct cache_entry {
+    char *fname;
+    off_t size;
+    time_t mtime;
+};
+
+/* temporary files older than this were left by a task that died */
+#define CACHE_STALE_TMP_SEC 3600
+
+
+static long map_cache_limit_kb(void)
+{
+    return getenv_int("MRCC_MAP_CACHE_SIZE", 1024) * 1024L;
+}
+
+
+/**
+ * The directory of the node cache, which is created if need be.
+ **/
+int map_cache_dir(char **dir_ret)
+{
+    static char *cached;
+    const char *env, *tmp_top;
+    int ret;
+
+    if (cached) {
+        *dir_ret = cached;
+        return 0;
+    }
+
+    if ((env = getenv("MRCC_MAP_CACHE")) != NULL && *env) {
+        if ((cached = strdup(env)) == NULL)
+            return EXIT_OUT_OF_MEMORY;
+    } else {
+        if ((ret = get_tmp_top(&tmp_top)))
+            return ret;
+        if (asprintf(&cached, "%s/mrcc-cache", tmp_top) == -1) {
+            cached = NULL;
+            return EXIT_OUT_OF_MEMORY;
+        }
+    }
+    if (mkdir(cached, 0777) == -1 && errno != EEXIST) {
+        rs_log_error("mkdir %s failed: %s", cached, strerror(errno));
+        free(cached);
+        cached = NULL;
+        return EXIT_IO_ERROR;
+    }
+
+    *dir_ret = cached;
+    return 0;
+}
+
+
+/*
+ * make dst a copy of src: a hard link if they are on the same file
+ * system, a real copy otherwise
+ */
+static int map_cache_copy(const char *src, const char *dst)
+{
+    char buf[65536];
+    ssize_t n;
+    int ifd, ofd;
+    int ret = 0;
+
+    if (link(src, dst) == 0)
+        return 0;
+    if (errno == ENOENT)
+        return EXIT_NO_SUCH_FILE;
+
+    if ((ifd = open(src, O_RDONLY)) == -1)
+        return errno == ENOENT ? EXIT_NO_SUCH_FILE : EXIT_IO_ERROR;
+    if ((ofd = open(dst, O_WRONLY|O_CREAT|O_TRUNC, 0666)) == -1) {
+        rs_log_error("failed to create %s: %s", dst, strerror(errno));
+        close(ifd);
+        return EXIT_IO_ERROR;
+    }
+    while ((n = read(ifd, buf, sizeof buf)) != 0) {
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 || writex(ofd, buf, n) != 0) {
+            ret = EXIT_IO_ERROR;
+            break;
+        }
+    }
+    close(ifd);
+    if (close(ofd) != 0)
+        ret = EXIT_IO_ERROR;
+    if (ret) {
+        rs_log_error("failed to copy %s to %s", src, dst);
+        unlink(dst);
+    }
+    return ret;
+}
+
+
+static int cmp_entry_mtime(const void *a, const void *b)
+{
+    const struct cache_entry *ea = a, *eb = b;
+
+    if (ea->mtime != eb->mtime)
+        return ea->mtime < eb->mtime ? -1 : 1;
+    return 0;
+}
+
+/*
+ * remove the least recently used entries until the cache fits its limit
+ */
+static void map_cache_evict(const char *dir, long limit_kb)
+{
+    DIR *d;
+    struct dirent *de;
+    struct stat st;
+    struct cache_entry *entries = NULL, *p;
+    int n = 0, i;
+    long total_kb = 0;
+    time_t now = time(NULL);
+    char *fname;
+
+    if ((d = opendir(dir)) == NULL)
+        return;
+    while ((de = readdir(d)) != NULL) {
+        if (str_equal(de->d_name, ".") || str_equal(de->d_name, ".."))
+            continue;
+        if (asprintf(&fname, "%s/%s", dir, de->d_name) == -1)
+            break;
+        if (stat(fname, &st) == -1 || !S_ISREG(st.st_mode)) {
+            free(fname);
+            continue;
+        }
+        if (de->d_name[0] == '.') {
+            if (now - st.st_mtime > CACHE_STALE_TMP_SEC)
+                unlink(fname);
+            free(fname);
+            continue;
+        }
+        if ((p = realloc(entries, (n + 1) * sizeof *entries)) == NULL) {
+            free(fname);
+            break;
+        }
+        entries = p;
+        entries[n].fname = fname;
+        entries[n].size = st.st_size;
+        entries[n].mtime = st.st_mtime;
+        total_kb += st.st_size / 1024;
+        n++;
+    }
+    closedir(d);
+
+    if (total_kb > limit_kb) {
+        qsort(entries, n, sizeof *entries, cmp_entry_mtime);
+        for (i = 0; i < n && total_kb > limit_kb; i++) {
+            /* somebody else may have evicted it already */
+            if (unlink(entries[i].fname) == 0 || errno == ENOENT) {
+                rs_trace("evict %s", entries[i].fname);
+                total_kb -= entries[i].size / 1024;
+            }
+        }
+    }
+
+    for (i = 0; i < n; i++)
+        free(entries[i].fname);
+    free(entries);
+}
+
+
+/**
+ * Add @p fname to the cache as the content with digest @p digest.
+ * Failing to cache is not an error for the caller, it only costs a
+ * fetch later.
+ **/
+int map_cache_insert(const char *digest, const char *fname)
+{
+    char *dir, *entry = NULL, *tmp = NULL;
+    long limit_kb = map_cache_limit_kb();
+    int ret;
+
+    if (digest == NULL || limit_kb <= 0)
+        return 0;
+    if ((ret = map_cache_dir(&dir)))
+        return ret;
+    if (asprintf(&entry, "%s/%s", dir, digest) == -1
+        || asprintf(&tmp, "%s/.%s.%d", dir, digest, (int) getpid()) == -1) {
+        free(entry);
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    if ((ret = map_cache_copy(fname, tmp)) == 0) {
+        if (rename(tmp, entry) == -1) {
+            rs_log_warning("rename %s to %s failed: %s",
+                           tmp, entry, strerror(errno));
+            unlink(tmp);
+            ret = EXIT_IO_ERROR;
+        } else {
+            rs_trace("cached %s as %s", fname, entry);
+            map_cache_evict(dir, limit_kb);
+        }
+    }
+
+    free(entry);
+    free(tmp);
+    return ret;
+}
+
+
+/**
+ * Get the file with content @p digest to @p local_fname: from the node
+ * cache if it has it, otherwise from @p fs_fname on the net fs, in which
+ * case it is added to the cache.  @p digest may be NULL, for a plain get.
+ * If @p hit is not NULL, it is set to 1 if the cache had the file.
+ * Whatever is at @p local_fname is replaced, as by get_new_file_fs().
+ *
+ * @returns 0 on success, nonzero if the net fs get failed.
+ **/
+int map_cache_get_file(const char *digest, char *fs_fname, char *local_fname,
+                       int *hit)
+{
+    char *dir, *entry = NULL;
+    int ret;
+
+    if (hit)
+        *hit = 0;
+    /* a link would fail too, and a copy would write into what is there */
+    unlink(local_fname);
+    if (digest && map_cache_limit_kb() > 0 && map_cache_dir(&dir) == 0
+        && asprintf(&entry, "%s/%s", dir, digest) != -1) {
+        ret = map_cache_copy(entry, local_fname);
+        if (ret == 0) {
+            /* keep it from being evicted soon */
+            utime(entry, NULL);
+            rs_trace("cache hit for %s: %s", local_fname, entry);
+            free(entry);
+            if (hit)
+                *hit = 1;
+            return 0;
+        }
+        rs_trace("cache miss for %s", local_fname);
+        free(entry);
+    }
+
+    if ((ret = get_file_fs(fs_fname, local_fname)) != 0)
+        return ret;
+    map_cache_insert(digest, local_fname);
+    return 0;
+}
+
+
+/**
+ * Remove the entry for @p digest, whose content turned out not to match
+ * it.
+ **/
+void map_cache_drop(const char *digest)
+{
+    char *dir, *entry;
+
+    if (map_cache_dir(&dir) != 0
+        || asprintf(&entry, "%s/%s", dir, digest) == -1)
+        return;
+    unlink(entry);
+    free(entry);
+}
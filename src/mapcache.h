@@ -0,0 +1,13 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_MAPCACHE_H
+# define _HEADER_MAPCACHE_H
+
+int map_cache_dir(char **dir_ret);
+int map_cache_insert(const char *digest, const char *fname);
+int map_cache_get_file(const char *digest, char *fs_fname, char *local_fname,
+                       int *hit);
+void map_cache_drop(const char *digest);
+
+#endif //_HEADER_MAPCACHE_H
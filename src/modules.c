@@ -0,0 +1,480 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "files.h"
+#include "cleanup.h"
+#include "io.h"
+#include "pack.h"
+#include "hash.h"
+#include "store.h"
+#include "modules.h"
+
+/**
+ * @file
+ *
+ * C++20 modules, as GCC builds them with -fmodules-ts.
+ *
+ * A module interface unit, "export module M;", or a partition,
+ * "module M:P;", writes the compiled interface of M, its BMI, to the
+ * module cache dir, gcm.cache/M.gcm in the working directory.  Every
+ * unit that imports M, and the implementation units of M, read it from
+ * there.  The master finds these declarations in the preprocessed
+ * source, and mod_ship() puts the BMI of every module the unit imports
+ * to the net fs under the hash of its content, as mrcc/bmi/DIGEST.gcm,
+ * see store.c; an interface that does not
+ * change is put once, however many units import it.  If a BMI is not
+ * there, the compile runs locally.
+ *
+ * The unit goes to the mapper with the list of its modules,
+ *     NAME=DIGEST,NAME=DIGEST,...
+ * in which the module the unit exports, if any, has no DIGEST.  The
+ * mapper fetches the BMIs through its node cache and points the
+ * compiler at them, and at the file to write the exported BMI to, with
+ * a module mapper file in CXX_MODULE_MAPPER, see mod_fetch().  The BMI
+ * an interface unit builds comes back packed with the object (see
+ * pack.c), and goes to the module cache dir of the master, so it is
+ * built once, by the compile of its unit, for the master and the nodes.
+ *
+ * Header units, "import <vector>;", a module mapper of the build's own
+ * and clang's .pcm interfaces, which clang builds with --precompile
+ * rather than -c, are left to the local compiler.  MRCC_MODULES=0 sends
+ * module units to the nodes as plain compiles.
+ **/
+
+static const char mod_cache_dir[] = "gcm.cache";
+
+
+/**
+ * Whether the compile @p argv may use modules.
+ **/
+int mod_enabled(char **argv)
+{
+    int i;
+
+    for (i = 1; argv[i]; i++) {
+        if (str_equal(argv[i], "-fmodules-ts")
+            || str_equal(argv[i], "-fmodules"))
+            return getenv_bool("MRCC_MODULES", 1);
+    }
+    return 0;
+}
+
+
+/*
+ * the name of the BMI of module @p name in the module cache dir, where
+ * the ':' of a partition is a '-'
+ */
+static char *mod_bmi_name(const char *name)
+{
+    char *fname, *p;
+
+    if (asprintf(&fname, "%s.gcm", name) == -1)
+        return NULL;
+    for (p = fname; *p; p++) {
+        if (*p == ':')
+            *p = '-';
+    }
+    return fname;
+}
+
+
+/*
+ * Take the module name that @p s starts with, up to the ';', without
+ * the spaces the preprocessor puts around the ':' of a partition.
+ * Returns NULL if it is not one.
+ */
+static char *mod_decl_name(const char *s)
+{
+    char *name, *p;
+
+    if ((name = malloc(strlen(s) + 1)) == NULL)
+        return NULL;
+    for (p = name; *s && *s != ';' && *s != '['; s++) {
+        if (isspace((unsigned char) *s))
+            continue;
+        if (!isalnum((unsigned char) *s) && !strchr("_.:", *s)) {
+            free(name);
+            return NULL;
+        }
+        *p++ = *s;
+    }
+    *p = '\0';
+    if (*s == '\0' || name[0] == '\0') {
+        free(name);
+        return NULL;
+    }
+    return name;
+}
+
+
+/*
+ * add "NAME=DIGEST" to the list @p mods
+ */
+static int mod_list_add(char **mods, const char *name, const char *digest)
+{
+    char *more;
+
+    if (asprintf(&more, "%s%s%s=%s", *mods ? *mods : "", *mods ? "," : "",
+                 name, digest) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    free(*mods);
+    *mods = more;
+    return 0;
+}
+
+
+/*
+ * add the import of @p name to @p mods, with its BMI put to the net fs
+ */
+static int mod_import(char **mods, const char *name)
+{
+    char digest[HASH_HEX_LEN + 1];
+    char *bmi, *fname;
+    int ret;
+
+    if ((bmi = mod_bmi_name(name)) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    if (asprintf(&fname, "%s/%s", mod_cache_dir, bmi) == -1) {
+        free(bmi);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    free(bmi);
+    if (access(fname, R_OK) == -1) {
+        rs_log_info("module %s is not built yet, no %s", name, fname);
+        ret = EXIT_MRCC_FAILED;
+    } else if ((ret = store_put(fname, "bmi", ".gcm", digest)) == 0) {
+        ret = mod_list_add(mods, name, digest);
+    }
+    free(fname);
+    return ret;
+}
+
+
+/**
+ * Find the module declarations of the preprocessed source @p cpp_fname
+ * of the compile @p argv, and ship the BMIs it imports.  The list of
+ * modules for the mapper is returned in @p mods_ret, or NULL if it uses
+ * none.  Returns nonzero if the compile has to run locally.
+ **/
+int mod_ship(char **argv, const char *cpp_fname, char **mods_ret)
+{
+    char *line = NULL, *p, *name = NULL, *module = NULL, *mods = NULL;
+    size_t line_size = 0;
+    int exported, ret = 0;
+    int i;
+    FILE *fp;
+
+    *mods_ret = NULL;
+    if (!mod_enabled(argv))
+        return 0;
+    for (i = 1; argv[i]; i++) {
+        if (str_startswith("-fmodule-mapper", argv[i]))
+            return EXIT_MRCC_FAILED;
+    }
+    if (getenv("CXX_MODULE_MAPPER"))
+        return EXIT_MRCC_FAILED;
+
+    if ((fp = fopen(cpp_fname, "r")) == NULL) {
+        rs_log_error("failed to open %s: %s", cpp_fname, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    while (ret == 0 && getline(&line, &line_size, fp) != -1) {
+        for (p = line; *p == ' ' || *p == '\t'; p++)
+            ;
+        exported = str_startswith("export", p) && isspace((unsigned char) p[6]);
+        if (exported) {
+            for (p += 6; isspace((unsigned char) *p); p++)
+                ;
+        }
+
+        if (str_startswith("module", p) && isspace((unsigned char) p[6])) {
+            /* "module;" opens the global module fragment, "module
+             * :private;" the private one */
+            if ((name = mod_decl_name(p + 6)) == NULL || name[0] == ':') {
+                free(name);
+                continue;
+            }
+            free(module);
+            module = name;
+            if (exported || strchr(name, ':'))
+                ret = mod_list_add(&mods, name, "");
+            else
+                ret = mod_import(&mods, name);
+        } else if (str_startswith("import", p)
+                   && (isspace((unsigned char) p[6]) || p[6] == ':'
+                       || p[6] == '<' || p[6] == '"')) {
+            for (p += 6; isspace((unsigned char) *p); p++)
+                ;
+            if (*p == '<' || *p == '"') {
+                rs_log_info("%s imports a header unit", cpp_fname);
+                ret = EXIT_MRCC_FAILED;
+                break;
+            }
+            if ((name = mod_decl_name(p)) == NULL)
+                continue;
+            if (name[0] == ':' && module == NULL) {
+                ret = EXIT_MRCC_FAILED;
+            } else if (name[0] == ':') {
+                char *part;
+
+                /* a partition of the module the unit belongs to */
+                if (asprintf(&part, "%.*s%s", (int) strcspn(module, ":"),
+                             module, name) == -1) {
+                    ret = EXIT_OUT_OF_MEMORY;
+                } else {
+                    ret = mod_import(&mods, part);
+                    free(part);
+                }
+            } else {
+                ret = mod_import(&mods, name);
+            }
+            free(name);
+        }
+    }
+    free(line);
+    free(module);
+    fclose(fp);
+
+    if (ret != 0) {
+        free(mods);
+        return ret;
+    }
+    if (mods)
+        rs_trace("%s uses modules %s", cpp_fname, mods);
+    *mods_ret = mods;
+    return 0;
+}
+
+
+/**
+ * The module the unit with modules @p mods exports, or NULL.  The name
+ * is returned in @p name, which has space for all of @p mods.
+ **/
+const char *mod_exported(const char *mods, char *name)
+{
+    const char *p, *eq;
+
+    for (p = mods; p && (eq = strchr(p, '=')) != NULL; p = strchr(eq, ',')) {
+        if (*p == ',')
+            p++;
+        if (eq[1] == ',' || eq[1] == '\0') {
+            memcpy(name, p, eq - p);
+            name[eq - p] = '\0';
+            return name;
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * On the mapper: get the BMIs of the modules @p mods of the unit that
+ * writes @p out_fname, and write the module mapper file for its compile,
+ * whose name is returned in @p mapper_ret.  An exported BMI is written
+ * to @p out_fname with ".gcm" appended.
+ **/
+int mod_fetch(const char *mods, const char *out_fname, char **mapper_ret)
+{
+    char *list, *entry, *save, *eq, *mapper, *bmi;
+    FILE *fp;
+    int ret = 0;
+
+    if (asprintf(&mapper, "%s.modmap", out_fname) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    if ((list = strdup(mods)) == NULL) {
+        free(mapper);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    if ((ret = add_cleanup(mapper))) {
+        free(list);
+        free(mapper);
+        return ret;
+    }
+    if ((fp = fopen(mapper, "w")) == NULL) {
+        rs_log_error("failed to create %s: %s", mapper, strerror(errno));
+        free(list);
+        free(mapper);
+        return EXIT_IO_ERROR;
+    }
+
+    for (entry = strtok_r(list, ",", &save); entry && ret == 0;
+         entry = strtok_r(NULL, ",", &save)) {
+        if ((eq = strchr(entry, '=')) == NULL) {
+            ret = EXIT_PROTOCOL_ERROR;
+            break;
+        }
+        *eq++ = '\0';
+        if (*eq == '\0') {
+            if (asprintf(&bmi, "%s.gcm", out_fname) == -1) {
+                ret = EXIT_OUT_OF_MEMORY;
+                break;
+            }
+            ret = add_cleanup(bmi);
+        } else {
+            ret = store_get(eq, "bmi", ".gcm", &bmi);
+        }
+        if (ret == 0) {
+            fprintf(fp, "%s %s\n", entry, bmi);
+            free(bmi);
+        }
+    }
+    if (fclose(fp) != 0 && ret == 0)
+        ret = EXIT_IO_ERROR;
+    free(list);
+
+    if (ret != 0) {
+        free(mapper);
+        return ret;
+    }
+    rs_trace("module mapper %s for %s", mapper, mods);
+    *mapper_ret = mapper;
+    return 0;
+}
+
+
+/**
+ * On the mapper: replace @p out_fname, the object of a unit that exports
+ * module @p name, with the pack of it and the BMI.
+ **/
+int mod_pack(const char *out_fname, const char *name)
+{
+    char *bmi = NULL, *bmi_name = NULL, *pack = NULL;
+    struct pack_writer w;
+    long off, len;
+    int ret;
+
+    if (asprintf(&bmi, "%s.gcm", out_fname) == -1
+        || (bmi_name = mod_bmi_name(name)) == NULL
+        || asprintf(&pack, "%s.mod", out_fname) == -1) {
+        free(bmi);
+        free(bmi_name);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    if ((ret = pack_create(pack, &w)) == 0) {
+        if ((ret = pack_add_file(&w, find_basename(out_fname), out_fname,
+                                 &off, &len)) == 0)
+            ret = pack_add_file(&w, bmi_name, bmi, &off, &len);
+        if (pack_finish(&w) != 0 && ret == 0)
+            ret = EXIT_IO_ERROR;
+    }
+    if (ret == 0 && rename(pack, out_fname) == -1) {
+        rs_log_error("rename %s to %s failed: %s",
+                     pack, out_fname, strerror(errno));
+        ret = EXIT_IO_ERROR;
+    }
+    if (ret == 0)
+        rs_trace("%s goes back with BMI %s", out_fname, bmi_name);
+    else
+        unlink(pack);
+    free(bmi);
+    free(bmi_name);
+    free(pack);
+    return ret;
+}
+
+
+struct mod_unpack {
+    const char *result;
+    const char *obj;        /* member that is the object */
+    const char *bmi_name;   /* member that is the BMI */
+    long obj_off, obj_len;
+};
+
+/* pack_foreach() callback: extract the BMI, note the object */
+static int mod_unpack_member(int fd, const char *name, long off, long len,
+                             void *arg)
+{
+    struct mod_unpack *m = arg;
+    char *dst;
+    int ret;
+
+    if (str_equal(name, m->obj)) {
+        m->obj_off = off;
+        m->obj_len = len;
+        return 0;
+    }
+    if (!str_equal(name, m->bmi_name)) {
+        rs_log_error("bad BMI \"%s\" in %s", name, m->result);
+        return EXIT_PROTOCOL_ERROR;
+    }
+    if (asprintf(&dst, "%s/%s", mod_cache_dir, name) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    rs_trace("BMI %s", dst);
+    ret = pack_extract(fd, off, len, dst);
+    free(dst);
+    return ret;
+}
+
+/**
+ * Unpack the result @p result of a unit that exports module @p name:
+ * the object to @p output_fname, and the BMI to the module cache dir.
+ * The object comes last, so that it is not there before the BMI.
+ **/
+int mod_unpack(const char *result, const char *output_fname,
+               const char *name)
+{
+    struct mod_unpack m;
+    char *bmi_name;
+    int fd;
+    int ret;
+
+    if ((bmi_name = mod_bmi_name(name)) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    m.result = result;
+    m.obj = find_basename(result);
+    m.bmi_name = bmi_name;
+    m.obj_off = -1;
+    m.obj_len = 0;
+    if ((fd = open(result, O_RDONLY|O_BINARY)) == -1) {
+        rs_log_error("failed to open %s: %s", result, strerror(errno));
+        free(bmi_name);
+        return EXIT_IO_ERROR;
+    }
+    if (mkdir(mod_cache_dir, 0777) == -1 && errno != EEXIST) {
+        rs_log_error("failed to create %s: %s", mod_cache_dir,
+                     strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+
+    ret = pack_foreach(fd, mod_unpack_member, &m);
+    if (ret == 0 && m.obj_off == -1) {
+        rs_log_error("no object in %s", result);
+        ret = EXIT_PROTOCOL_ERROR;
+    }
+    if (ret == 0)
+        ret = pack_extract(fd, m.obj_off, m.obj_len, output_fname);
+
+  out:
+    close(fd);
+    free(bmi_name);
+    unlink(result);
+    return ret;
+}
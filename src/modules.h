@@ -0,0 +1,15 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_MODULES_H
+# define _HEADER_MODULES_H
+
+int mod_enabled(char **argv);
+int mod_ship(char **argv, const char *cpp_fname, char **mods_ret);
+const char *mod_exported(const char *mods, char *name);
+int mod_fetch(const char *mods, const char *out_fname, char **mapper_ret);
+int mod_pack(const char *out_fname, const char *name);
+int mod_unpack(const char *result, const char *output_fname,
+               const char *name);
+
+#endif //_HEADER_MODULES_H
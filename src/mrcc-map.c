@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include "mrcc-map.h"
 #include "args.h"
@@ -14,6 +16,14 @@
 #include "cleanup.h"
 #include "utils.h"
 #include "args.h"
+#include "mapbatch.h"
+#include "mapcache.h"
+#include "manifest.h"
+#include "pch.h"
+#include "bundle.h"
+#include "rlink.h"
+#include "modules.h"
+#include "toolchain.h"
 
 
 const char* mrcc_map_version = "0.1.0";
@@ -38,6 +48,9 @@ static void map_show_usage()
 {
     printf(
 "Usage:\n"
+"   mrcc-map CPP_FILE OUT_FILE COMPILER [compile options]\n"
+"   mrcc-map --batch           compile the unit records on stdin\n"
+"\n"
 "mrcc-map is part of mrcc. mrcc is a C Compiler system on MapReduce.\n"
 "mrcc distributes compilation jobs across slave machines on MapReduce.\n"
 "Jobs that cannot be distributed, such as linking or preprocessing\n"
@@ -74,9 +87,16 @@ int main(int argc, char* argv[])
     char* cpp_fname;
     char** map_argv;
     char* map_argv_str;
+    char* tc_argv_str;
     char* fs_cpp_fname;
     char* out_fname;
     char* fs_out_fname;
+    const char* dumpbase;
+    char* scratch = NULL;
+    int cwd_fd = -1;
+    const char* mods;
+    char* mod_mapper = NULL;
+    char* module = NULL;
 
     // for debug only
     // int i;
@@ -106,6 +126,12 @@ int main(int argc, char* argv[])
     note_called_time();
     trace_version();
 
+    // batch mode, the units come on stdin
+    if (!strcmp(argv[1], "--batch")) {
+        ret = map_batch();
+        goto out;
+    }
+
     cpp_fname = argv[1];
     rs_trace("cpp_fname is \"%s\"", cpp_fname);
 
@@ -122,7 +148,8 @@ int main(int argc, char* argv[])
     if ((fs_cpp_fname = name_local_to_fs(cpp_fname)) == NULL) {
         return EXIT_OUT_OF_MEMORY;
     }
-    if (get_file_fs(fs_cpp_fname, cpp_fname) != 0) {
+    if (map_cache_get_file(getenv("MRCC_MAP_DIGEST"),
+                fs_cpp_fname, cpp_fname, NULL) != 0) {
         rs_log_error("get cpp from net fs: \"%s\" failed", cpp_fname);
         ret =  EXIT_GET_CPP_FS_FAILED;
         goto out;
@@ -140,18 +167,90 @@ int main(int argc, char* argv[])
     }
     rs_trace("add clean up file: \"%s\"", cpp_fname);
 
+    // the precompiled header it loads, see pch.c
+    if (getenv("MRCC_MAP_PCH") != NULL
+            && (ret = pch_fetch(getenv("MRCC_MAP_PCH"), cpp_fname)) != 0) {
+        goto out;
+    }
+
+    // and the module interfaces it imports, see modules.c
+    if ((mods = getenv("MRCC_MAP_MODULES")) != NULL) {
+        if ((ret = mod_fetch(mods, out_fname, &mod_mapper)) != 0) {
+            goto out;
+        }
+        setenv("CXX_MODULE_MAPPER", mod_mapper, 1);
+        if ((module = malloc(strlen(mods) + 1)) == NULL) {
+            return EXIT_OUT_OF_MEMORY;
+        }
+    }
+
+    // a compile with side outputs runs in a scratch dir, see manifest.c
+    if ((dumpbase = getenv("MRCC_MAP_DUMPBASE")) != NULL) {
+        if ((ret = manifest_prepare(out_fname, dumpbase, &scratch)) != 0) {
+            goto out;
+        }
+        // back at the end, the scratch dir goes away at exit
+        if ((cwd_fd = open(".", O_RDONLY)) == -1 || chdir(scratch) == -1) {
+            rs_log_error("failed to enter %s", scratch);
+            ret = EXIT_IO_ERROR;
+            goto out;
+        }
+    }
+    // so does a command whose inputs come in a bundle, see bundle.c
+    else if (is_bundle(cpp_fname)) {
+        if ((ret = bundle_extract(cpp_fname, &scratch)) != 0) {
+            goto out;
+        }
+        if ((cwd_fd = open(".", O_RDONLY)) == -1 || chdir(scratch) == -1) {
+            rs_log_error("failed to enter %s", scratch);
+            ret = EXIT_IO_ERROR;
+            goto out;
+        }
+    }
+
     // compile it now
     if ((map_argv_str = argv_tostr(map_argv)) == NULL) {
         return EXIT_OUT_OF_MEMORY;
     }
+    // with the compiler of the master, see toolchain.c
+    if (getenv("MRCC_MAP_TOOLCHAIN") != NULL) {
+        if ((ret = tc_localize(getenv("MRCC_MAP_TOOLCHAIN"), map_argv_str,
+                        &tc_argv_str)) != 0) {
+            goto out;
+        }
+        free(map_argv_str);
+        map_argv_str = tc_argv_str;
+    }
     rs_trace("compile on map: \"%s\"", map_argv_str);
     ret = system(map_argv_str);
     rs_trace("compile on map return %d ", ret);
     free(map_argv_str);
+    if (cwd_fd != -1) {
+        fchdir(cwd_fd);
+        close(cwd_fd);
+    }
     if (ret != 0) {
         goto out;
     }
 
+    // the object and the side outputs go back in one file
+    if (dumpbase != NULL
+            && (ret = manifest_pack(out_fname, scratch, dumpbase)) != 0) {
+        goto out;
+    }
+
+    // the BMI of a module interface goes back with the object
+    if (mods != NULL && mod_exported(mods, module) != NULL
+            && (ret = mod_pack(out_fname, module)) != 0) {
+        goto out;
+    }
+
+    // or the object stays on net fs, and its stub goes back, see rlink.c
+    if (getenv_bool("MRCC_MAP_KEEP", 0)
+            && (ret = rlink_keep(out_fname)) != 0) {
+        goto out;
+    }
+
     // put output file to net fs
     if ((fs_out_fname = name_local_to_fs(out_fname)) == NULL) {
         return EXIT_OUT_OF_MEMORY;
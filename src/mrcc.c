@@ -15,6 +15,11 @@
 #include "trace.h"
 #include "traceenv.h"
 #include "compile.h"
+#include "xfer.h"
+#include "admit.h"
+#include "split.h"
+#include "lto.h"
+#include "rlink.h"
 
 
 const char* mrcc_version = "0.1.0";
@@ -41,12 +46,14 @@ static void show_usage()
     printf(
 "Usage:\n"
 "   mrcc [COMPILER] [compile options] -o OBJECT -c SOURCE\n"
+"   mrcc-ld LINKER [link options] -flto=thin OBJECTS\n"
 "   mrcc --help\n"
 "\n"
 "Options:\n"
 "   COMPILER                   defaults to \"cc\"\n"
 "   --help                     explain usage and exit\n"
 "   --version                  show version and exit\n"
+"   --stats                    show transfer and cluster stats and exit\n"
 "\n"
 /*
 "Environment variables:\n"
@@ -72,7 +79,7 @@ static void show_help()
 
 int main(int argc, char* argv[])
 {
-    int status, sg_level;
+    int status, sg_level, done;
     char** compiler_args = NULL; /* dynamically allocated */
     const char* compiler_name;
   
@@ -92,8 +99,13 @@ int main(int argc, char* argv[])
      * see the EPIPE. */
     ignore_sigpipe(1);
 
+    /* a recursive mrcc, run by a compiler that is mrcc again, runs the
+     * command as it is: it does not split it, link it remotely or send
+     * out its ThinLTO backends, which would only recurse once more */
     sg_level = recursion_safeguard();
 
+    xfer_enable();
+
     rs_trace("compiler name is \"%s\"", compiler_name);
 
     if (!strcmp(compiler_name, "mrcc")) {
@@ -108,10 +120,29 @@ int main(int argc, char* argv[])
             ret = 0;
             goto out;
         }
+        if (!strcmp(argv[1], "--stats")) {
+            if ((ret = xfer_show_stats(stdout)) == 0)
+                ret = admit_show_stats(stdout);
+            goto out;
+        }
         if ((ret = find_compiler(argv, &compiler_args)) != 0) {
             goto out;
         }
     }
+    else if (!strcmp(compiler_name, "mrcc-ld")) {
+        // "mrcc-ld clang -flto=thin ...", the backends go remote
+        if (argc <= 1 || !strcmp(argv[1], "--help")) {
+            show_help();
+            ret = 0;
+            goto out;
+        }
+        if ((ret = copy_argv(argv + 1, &compiler_args, 0)) != 0) {
+            goto out;
+        }
+        ret = lto_link(compiler_args, sg_level);
+        free_argv(compiler_args);
+        goto out;
+    }
     else {
         // NOT support masquerade by now
         printf("Sorry, we do not support masquerade by now.\n");
@@ -120,10 +151,23 @@ int main(int argc, char* argv[])
         
     }
 
+    // a link of objects that stayed on net fs runs next to them
+    if ((ret = rlink_build(compiler_args, sg_level, &done)) != 0 || done)
+        goto out_args;
+
+    // "cc -c a.c b.c" compiles each source as a unit of its own
+    if (!sg_level
+        && ((ret = split_build(compiler_args, &done)) != 0 || done))
+        goto out_args;
+
     // Compile now
     ret = build_somewhere_timed(compiler_args, sg_level, &status);
     compiler_args = NULL; /* build_somewhere_timed already free'd it. */
 
+out_args:
+    /* the builders above free it only if they ran the command */
+    if (compiler_args && !done)
+        free_argv(compiler_args);
 out:
     return ret;
 }
@@ -30,6 +30,9 @@
 #include "args.h"
 #include "netfsutils.h"
 #include "trace.h"
+#include "batch.h"
+#include "remote.h"
+#include "mrutils.h"
 
 
 // MapReduce operation command
@@ -37,35 +40,219 @@ const char* mr_exec_cmd_prefix = "/lhome/mr/hadoop-0.20.2/bin/hadoop jar /lhome/
 const char* mr_exec_cmd_mapper = "/usr/bin/mrcc-map ";
 const char* mr_exec_cmd_parameter = "-numReduceTasks 0 -input null -output ";
 
-int mr_exec(char* argv, char* cpp_fname, char* out_fname)
+// batch jobs: one map task per line of the input, see batch.c
+const char* mr_exec_batch_cmd_prefix = "/lhome/mr/hadoop-0.20.2/bin/hadoop jar /lhome/mr/hadoop-0.20.2/contrib/streaming/hadoop-0.20.2-streaming.jar -D mapred.line.input.format.linespermap=1";
+const char* mr_exec_batch_cmd_inputformat = "-inputformat org.apache.hadoop.mapred.lib.NLineInputFormat";
+const char* mr_exec_batch_cmd_mapper = "/usr/bin/mrcc-map --batch";
+// data-local batch jobs: one map task per input file, never split
+const char* mr_exec_local_cmd_prefix = "/lhome/mr/hadoop-0.20.2/bin/hadoop jar /lhome/mr/hadoop-0.20.2/contrib/streaming/hadoop-0.20.2-streaming.jar -D mapred.min.split.size=9223372036854775807";
+// cluster state, see admit.c
+const char* mr_list_jobs_cmd = "/lhome/mr/hadoop-0.20.2/bin/hadoop job -list 2>/dev/null";
+const char* mr_list_trackers_cmd = "/lhome/mr/hadoop-0.20.2/bin/hadoop job -list-active-trackers 2>/dev/null";
+
+/*
+ * append "-cmdenv NAME=VALUE " to the options in *env, which may be NULL
+ */
+int mr_cmdenv(char **env, const char *name, const char *value)
+{
+    char *old = *env;
+
+    if (asprintf(env, "%s-cmdenv %s=%s ", old ? old : "", name, value) == -1) {
+        *env = old;
+        return EXIT_OUT_OF_MEMORY;
+    }
+    free(old);
+    return 0;
+}
+
+/*
+ * run the job of one remote compile; what the mapper needs besides the
+ * command is in job, see struct remote_job, and is passed as -cmdenv
+ */
+int mr_exec(char* argv, char* cpp_fname, char* out_fname,
+        const struct remote_job* job)
 {
+    const struct {
+        const char* name;
+        const char* value;
+    } env[] = {
+        // lets mrcc-map serve the cpp file from its node cache
+        { "MRCC_MAP_DIGEST", job->digest },
+        // and return the side outputs with the object, see manifest.c
+        { "MRCC_MAP_DUMPBASE", job->dumpbase },
+        // and load the precompiled header, see pch.c
+        { "MRCC_MAP_PCH", job->pch },
+        // and leave the object on the net fs, see rlink.c
+        { "MRCC_MAP_KEEP", job->keep ? "1" : NULL },
+        // and get the module interfaces it imports, see modules.c
+        { "MRCC_MAP_MODULES", job->mods },
+        // and compile with the toolchain of the master, see toolchain.c
+        { "MRCC_MAP_TOOLCHAIN", job->tc },
+    };
     int ret;
+    size_t i;
     char* out_dir = NULL;
     char* fs_out_dir = NULL;
     char* mr_argv = NULL;
+    char* cmdenv = NULL;
 
     if ((out_dir = name_local_cpp_to_local_outdir(cpp_fname)) == NULL) {
         return EXIT_OUT_OF_MEMORY;
     }
     if ((fs_out_dir = name_local_to_fs(out_dir)) == NULL) {
+        free(out_dir);
         return EXIT_OUT_OF_MEMORY;
     }
     free(out_dir);
 
-    if (asprintf(&mr_argv, "%s \"%s %s %s %s\" %s %s",
+    for (i = 0; i < sizeof env / sizeof env[0]; i++) {
+        if (env[i].value != NULL
+                && mr_cmdenv(&cmdenv, env[i].name, env[i].value) != 0) {
+            ret = EXIT_OUT_OF_MEMORY;
+            goto out;
+        }
+    }
+
+    if (asprintf(&mr_argv, "%s \"%s %s %s %s\" %s%s %s",
                     mr_exec_cmd_prefix,
                     mr_exec_cmd_mapper, cpp_fname, out_fname, argv,
-                    mr_exec_cmd_parameter,
+                    cmdenv ? cmdenv : "", mr_exec_cmd_parameter,
                     fs_out_dir) == -1) {
-        return EXIT_OUT_OF_MEMORY;
+        mr_argv = NULL;
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
     }
     rs_log_info("mr_exec: %s", mr_argv);
     ret = system(mr_argv);
     ret = add_cleanup_fs(fs_out_dir) || ret;
+
+out:
+    free(cmdenv);
     free(fs_out_dir);
     free(mr_argv);
+    return ret;
+}
+
+/*
+ * run a batch job: one map task per line of fs_input
+ * MRCC_BATCH_TASK_MEM is passed on so that mrcc-map knows the budget
+ * the splits were packed for, MRCC_BATCH_INLINE so that it knows which
+ * objects to send back inline
+ * cmdenv has more "-cmdenv NAME=VALUE " options from the leader, or NULL
+ */
+int mr_exec_batch(char* fs_input, char* fs_out_dir, int n_splits,
+        char* cmdenv)
+{
+    int ret;
+    char* mr_argv = NULL;
+
+    // the generic -D options must come before the streaming options
+    if (asprintf(&mr_argv, "%s -D mapred.map.tasks=%d %s -mapper \"%s\" "
+                    "-cmdenv MRCC_BATCH_TASK_MEM=%ld "
+                    "-cmdenv MRCC_BATCH_INLINE=%ld %s"
+                    "-numReduceTasks 0 -input %s -output %s",
+                    mr_exec_batch_cmd_prefix, n_splits,
+                    mr_exec_batch_cmd_inputformat,
+                    mr_exec_batch_cmd_mapper,
+                    batch_task_mem_kb() / 1024,
+                    batch_inline_max() / 1024, cmdenv ? cmdenv : "",
+                    fs_input, fs_out_dir) == -1) {
+        return EXIT_OUT_OF_MEMORY;
+    }
+    rs_log_info("mr_exec_batch: %s", mr_argv);
+    ret = system(mr_argv);
+    ret = add_cleanup_fs(fs_out_dir) || ret;
+    free(mr_argv);
+
+    return ret;
+}
+
+/*
+ * run a data-local batch job: fs_input_dir has one file per map task,
+ * with one unit per line, and each map task runs where its file is
+ */
+int mr_exec_batch_local(char* fs_input_dir, char* fs_out_dir, char* cmdenv)
+{
+    int ret;
+    char* mr_argv = NULL;
+
+    if (asprintf(&mr_argv, "%s -mapper \"%s\" "
+                    "-cmdenv MRCC_BATCH_TASK_MEM=%ld "
+                    "-cmdenv MRCC_BATCH_INLINE=%ld %s"
+                    "-numReduceTasks 0 -input %s -output %s",
+                    mr_exec_local_cmd_prefix,
+                    mr_exec_batch_cmd_mapper,
+                    batch_task_mem_kb() / 1024,
+                    batch_inline_max() / 1024, cmdenv ? cmdenv : "",
+                    fs_input_dir, fs_out_dir) == -1) {
+        return EXIT_OUT_OF_MEMORY;
+    }
+    rs_log_info("mr_exec_batch_local: %s", mr_argv);
+    ret = system(mr_argv);
+    ret = add_cleanup_fs(fs_out_dir) || ret;
+    free(mr_argv);
 
     return ret;
 }
 
+/*
+ * count the jobs on the JobTracker: running ones, and queued ones that
+ * are still waiting to be set up (the PREP state)
+ */
+int mr_probe_jobs(int* running, int* queued)
+{
+    FILE* fp;
+    char line[1024];
+    char job_id[256];
+    int state;
+    int found = 0;
+
+    *running = *queued = 0;
+    if ((fp = popen(mr_list_jobs_cmd, "r")) == NULL) {
+        rs_log_error("failed to run \"%s\": %s", mr_list_jobs_cmd,
+                strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    // "N jobs currently running", a header, then "JOBID\tSTATE\t..."
+    while (fgets(line, sizeof line, fp) != NULL) {
+        if (strstr(line, "jobs currently running") != NULL) {
+            found = 1;
+        } else if (sscanf(line, "%255s %d", job_id, &state) == 2
+                && str_startswith("job_", job_id)) {
+            if (state == 4)
+                (*queued)++;
+            else if (state == 1)
+                (*running)++;
+        }
+    }
+    if (pclose(fp) != 0 || !found) {
+        rs_log_warning("could not list the jobs of the JobTracker");
+        return EXIT_CONNECT_FAILED;
+    }
+    return 0;
+}
 
+/*
+ * count the TaskTrackers the JobTracker hands map tasks to
+ */
+int mr_probe_trackers(int* n_trackers)
+{
+    FILE* fp;
+    char line[1024];
+
+    *n_trackers = 0;
+    if ((fp = popen(mr_list_trackers_cmd, "r")) == NULL) {
+        rs_log_error("failed to run \"%s\": %s", mr_list_trackers_cmd,
+                strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    while (fgets(line, sizeof line, fp) != NULL) {
+        if (str_startswith("tracker_", line))
+            (*n_trackers)++;
+    }
+    if (pclose(fp) != 0) {
+        rs_log_warning("could not list the TaskTrackers");
+        return EXIT_CONNECT_FAILED;
+    }
+    return 0;
+}
@@ -4,6 +4,15 @@
 #ifndef _HEADER_MRUTILS_H
 # define _HEADER_MRUTILS_H
 
-int mr_exec(char* argv, char* cpp_fname, char* out_fname);
+struct remote_job;
+
+int mr_cmdenv(char **env, const char *name, const char *value);
+int mr_exec(char* argv, char* cpp_fname, char* out_fname,
+        const struct remote_job* job);
+int mr_exec_batch(char* fs_input, char* fs_out_dir, int n_splits,
+        char* cmdenv);
+int mr_exec_batch_local(char* fs_input_dir, char* fs_out_dir, char* cmdenv);
+int mr_probe_jobs(int* running, int* queued);
+int mr_probe_trackers(int* n_trackers);
 
 #endif //_HEADER_MRUTILS_H
@@ -0,0 +1,372 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+#include <sys/utsname.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "tempfile.h"
+#include "args.h"
+#include "hash.h"
+#include "native.h"
+
+/**
+ * @file
+ *
+ * Resolution of -march=native, -mtune=native and -mcpu=native on the
+ * master, so that such compiles can go remote: the nodes may have other
+ * CPUs, which the compiler there would tune for instead.
+ *
+ * The compiler is asked what it makes of them with
+ *     CC -### -E -x c /dev/null -march=native
+ * whose cc1 line has the CPU, its features and its cache sizes.  Those
+ * options replace the native ones in the command line, where the first
+ * of them was, so that the options after it still override them.
+ *
+ * The answer is kept in the native dir under the hash of the path,
+ * size and mtime of the compiler, of the options asked about, and of
+ * the machine: its uname and the CPU model and flags of /proc/cpuinfo,
+ * since the native dir may be in a home directory that other machines
+ * share.  So a build asks once, and a new compiler or another CPU is
+ * asked again.  Options that change the word size go into the question
+ * too.
+ *
+ * If the compiler does not say, as clang does not in that form, the
+ * command is left alone, and scan_args() keeps it local.  That answer
+ * is kept too, as an empty file, so that the compiler is not asked on
+ * every compile.  MRCC_NATIVE=0 turns this off.
+ **/
+
+
+static int native_option(const char *a)
+{
+    return str_equal(a, "-march=native") || str_equal(a, "-mtune=native")
+        || str_equal(a, "-mcpu=native");
+}
+
+
+/*
+ * the options the answer depends on
+ */
+static int native_asked(const char *a)
+{
+    return native_option(a) || str_equal(a, "-m16") || str_equal(a, "-m32")
+        || str_equal(a, "-m64") || str_equal(a, "-mx32");
+}
+
+
+/*
+ * Ask the compiler.  The options come back in @p *flags_ret, one per
+ * line.
+ */
+static int native_query(char **argv, char **flags_ret)
+{
+    char *cmd, *more, *line = NULL, *tok, *save, *flags = NULL;
+    size_t line_size = 0, flags_len = 0;
+    int cc1 = 0, found = 0, in_run, param, i;
+    FILE *fp, *out;
+
+    if (!str_shell_safe(argv[0]))
+        return EXIT_MRCC_FAILED;
+    if (asprintf(&cmd, "%s -### -E -x c /dev/null", argv[0]) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    for (i = 1; argv[i]; i++) {
+        if (!native_asked(argv[i]))
+            continue;
+        if (asprintf(&more, "%s %s", cmd, argv[i]) == -1) {
+            free(cmd);
+            return EXIT_OUT_OF_MEMORY;
+        }
+        free(cmd);
+        cmd = more;
+    }
+    if (asprintf(&more, "%s 2>&1", cmd) == -1) {
+        free(cmd);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    free(cmd);
+    cmd = more;
+
+    rs_trace("asking the compiler: %s", cmd);
+    if ((fp = popen(cmd, "r")) == NULL) {
+        rs_log_error("failed to run \"%s\": %s", cmd, strerror(errno));
+        free(cmd);
+        return EXIT_IO_ERROR;
+    }
+    if ((out = open_memstream(&flags, &flags_len)) == NULL) {
+        pclose(fp);
+        free(cmd);
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    /* the expansion is one run of -m options and --param pairs in the
+     * cc1 line, within the quotes of one argument or not */
+    while (getline(&line, &line_size, fp) != -1) {
+        if ((cc1 = strstr(line, "/cc1") != NULL))
+            break;
+    }
+    in_run = param = 0;
+    for (tok = cc1 ? strtok_r(line, " \t\n", &save) : NULL; tok;
+         tok = strtok_r(NULL, " \t\n", &save)) {
+        if (*tok == '"')
+            tok++;
+        if (*tok && tok[strlen(tok) - 1] == '"')
+            tok[strlen(tok) - 1] = '\0';
+        if (str_startswith("-march=", tok) || str_startswith("-mtune=", tok)
+            || str_startswith("-mcpu=", tok))
+            found = 1;
+        if (!in_run && (found || str_equal(tok, "--param")))
+            in_run = 1;
+        if (!in_run)
+            continue;
+        if (!param && !str_startswith("-m", tok)
+            && !str_equal(tok, "--param"))
+            break;
+        if (strstr(tok, "native")) {
+            /* not expanded after all */
+            found = 0;
+            break;
+        }
+        param = str_equal(tok, "--param");
+        fprintf(out, "%s\n", tok);
+    }
+    while (getline(&line, &line_size, fp) != -1)
+        ;
+    fclose(out);
+    free(line);
+
+    if (pclose(fp) != 0 || !found) {
+        rs_log_info("\"%s\" does not say what native is", cmd);
+        free(flags);
+        free(cmd);
+        return EXIT_MRCC_FAILED;
+    }
+    free(cmd);
+    *flags_ret = flags;
+    return 0;
+}
+
+
+/*
+ * the answer kept in @p fname, or EXIT_MRCC_FAILED if the compiler did
+ * not say
+ */
+static int native_read(const char *fname, char **flags_ret)
+{
+    char *flags;
+    long len;
+    FILE *fp;
+
+    if ((fp = fopen(fname, "r")) == NULL)
+        return EXIT_NO_SUCH_FILE;
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+    if (len <= 0 || (flags = malloc(len + 1)) == NULL) {
+        fclose(fp);
+        return len == 0 ? EXIT_MRCC_FAILED
+            : len < 0 ? EXIT_NO_SUCH_FILE : EXIT_OUT_OF_MEMORY;
+    }
+    len = fread(flags, 1, len, fp);
+    flags[len] = '\0';
+    fclose(fp);
+    *flags_ret = flags;
+    return 0;
+}
+
+
+/*
+ * put the answer in place for the next ones
+ */
+static void native_write(const char *fname, const char *flags)
+{
+    char *tmp_fname;
+    FILE *fp;
+
+    if (asprintf(&tmp_fname, "%s.%d.tmp", fname, (int) getpid()) == -1)
+        return;
+    if ((fp = fopen(tmp_fname, "w")) != NULL) {
+        fputs(flags, fp);
+        if (fclose(fp) != 0 || rename(tmp_fname, fname) == -1)
+            unlink(tmp_fname);
+    }
+    free(tmp_fname);
+}
+
+
+/*
+ * add what native means on this machine to @p hs: the uname, and the
+ * lines of the first CPU in /proc/cpuinfo that tell its model and
+ * features, but not its clock, which changes
+ */
+static void native_hash_machine(struct hash_state *hs)
+{
+    static const char *keys[] = {
+        "vendor_id", "cpu family", "model", "model name", "stepping",
+        "flags", "CPU implementer", "CPU architecture", "CPU variant",
+        "CPU part", "CPU revision", "Features", "isa", NULL
+    };
+    struct utsname u;
+    char *line = NULL, *colon;
+    size_t line_size = 0;
+    FILE *fp;
+    int k;
+
+    if (uname(&u) == 0) {
+        hash_update(hs, u.sysname, strlen(u.sysname) + 1);
+        hash_update(hs, u.nodename, strlen(u.nodename) + 1);
+        hash_update(hs, u.machine, strlen(u.machine) + 1);
+    }
+    if ((fp = fopen("/proc/cpuinfo", "r")) == NULL)
+        return;
+    while (getline(&line, &line_size, fp) != -1 && line[0] != '\n') {
+        if ((colon = strchr(line, ':')) == NULL)
+            continue;
+        for (k = 0; keys[k]; k++) {
+            if (str_startswith(keys[k], line)
+                && strspn(line + strlen(keys[k]), " \t")
+                   == (size_t) (colon - line - strlen(keys[k]))) {
+                hash_update(hs, line, strlen(line));
+                break;
+            }
+        }
+    }
+    free(line);
+    fclose(fp);
+}
+
+
+/*
+ * what the native options of @p argv stand for, one per line
+ */
+static int native_resolve(char **argv, char **flags_ret)
+{
+    char key[HASH_HEX_LEN + 1];
+    char *dir, *cc_path, *fname;
+    struct hash_state hs;
+    struct stat st;
+    int i;
+    int ret;
+
+    if ((ret = find_in_path(argv[0], &cc_path, &st)))
+        return ret;
+    hash_init(&hs);
+    hash_update(&hs, cc_path, strlen(cc_path) + 1);
+    hash_update(&hs, &st.st_size, sizeof st.st_size);
+    hash_update(&hs, &st.st_mtime, sizeof st.st_mtime);
+    for (i = 1; argv[i]; i++) {
+        if (native_asked(argv[i]))
+            hash_update(&hs, argv[i], strlen(argv[i]) + 1);
+    }
+    native_hash_machine(&hs);
+    hash_final_hex(&hs, key);
+    free(cc_path);
+
+    if ((ret = get_native_dir(&dir)))
+        return ret;
+    if (asprintf(&fname, "%s/%s", dir, key) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    ret = native_read(fname, flags_ret);
+    if (ret != 0 && ret != EXIT_MRCC_FAILED) {
+        if ((ret = native_query(argv, flags_ret)) == 0)
+            native_write(fname, *flags_ret);
+        else if (ret == EXIT_MRCC_FAILED)
+            native_write(fname, "");
+    }
+    free(fname);
+    return ret;
+}
+
+
+/**
+ * Replace -march=native and the like in @p *argv_ptr with what they
+ * stand for on this machine, if the compiler tells.  Returns nonzero
+ * only if out of memory; otherwise the command is left as it was.
+ *
+ * The argv array pointed to by argv_ptr when this function is called
+ * must have been dynamically allocated.  It remains the caller's
+ * responsibility to deallocate it.
+ **/
+int expand_native_options(char ***argv_ptr)
+{
+    char **argv = *argv_ptr;
+    char **new_argv, **native_argv;
+    char *flags, *line, *nl;
+    int n_flags = 0, first = -1;
+    int i, j;
+    int ret;
+
+    for (i = 0; argv[i]; i++) {
+        if (native_option(argv[i])) {
+            first = i;
+            break;
+        }
+    }
+    if (first == -1 || !getenv_bool("MRCC_NATIVE", 1))
+        return 0;
+
+    if ((ret = native_resolve(argv, &flags)))
+        return ret == EXIT_OUT_OF_MEMORY ? ret : 0;
+    for (line = flags; *line; line++) {
+        if (*line == '\n')
+            n_flags++;
+    }
+
+    if ((native_argv = calloc(n_flags + 1, sizeof(char *))) == NULL
+        || (new_argv = calloc(argv_len(argv) + n_flags + 1,
+                              sizeof(char *))) == NULL) {
+        free(native_argv);
+        free(flags);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    for (i = 0, line = flags; (nl = strchr(line, '\n')); line = nl + 1) {
+        *nl = '\0';
+        if ((native_argv[i++] = strdup(line)) == NULL) {
+            free_argv(native_argv);
+            free(new_argv);
+            free(flags);
+            return EXIT_OUT_OF_MEMORY;
+        }
+    }
+
+    for (i = j = 0; argv[i]; i++) {
+        if (i == first) {
+            memcpy(new_argv + j, native_argv, n_flags * sizeof(char *));
+            j += n_flags;
+        }
+        if (native_option(argv[i]))
+            free(argv[i]);
+        else
+            new_argv[j++] = argv[i];
+    }
+    free(native_argv);
+    free(flags);
+    free(argv);
+    *argv_ptr = new_argv;
+    rs_trace("native is %d options for %s", n_flags, new_argv[0]);
+    return 0;
+}
@@ -0,0 +1,9 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_NATIVE_H
+# define _HEADER_NATIVE_H
+
+int expand_native_options(char ***argv_ptr);
+
+#endif //_HEADER_NATIVE_H
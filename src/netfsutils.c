@@ -29,11 +29,14 @@
 #include "stringutils.h"
 #include "trace.h"
 #include "cleanup.h"
+#include "xfer.h"
 
 // net fs oporation command
 const char* put_file_fs_cmd = "/lhome/mr/hadoop-0.20.2/bin/hadoop dfs -put";
 const char* get_file_fs_cmd = "/lhome/mr/hadoop-0.20.2/bin/hadoop dfs -get";
 const char* del_file_fs_cmd = "/lhome/mr/hadoop-0.20.2/bin/hadoop dfs -rmr";
+const char* getmerge_file_fs_cmd = "/lhome/mr/hadoop-0.20.2/bin/hadoop dfs -getmerge";
+const char* test_file_fs_cmd = "/lhome/mr/hadoop-0.20.2/bin/hadoop dfs -test -e";
 
 // top dir of temp files in net fs
 const char* fs_top_dir = "mrcc";
@@ -103,15 +106,32 @@ char* name_fs_to_local(char* fsname)
  * put file to net fs
  */
 
+/*
+ * size of a local file, 0 if it is not there (yet)
+ */
+static long netfs_local_size(const char *fname)
+{
+    struct stat st;
+
+    if (stat(fname, &st) == -1)
+        return 0;
+    return st.st_size;
+}
+
+
 int put_file_fs(char* localsrc, char* dst)
 {
     int ret;
     char* args = NULL;
+    struct xfer x;
+    long size = netfs_local_size(localsrc);
     if (asprintf(&args, "%s %s %s", 
                 put_file_fs_cmd, localsrc, dst) == -1) {
         return EXIT_OUT_OF_MEMORY;
     }
+    xfer_begin(XFER_UP, size, &x);
     ret = system(args);
+    xfer_end(&x, ret == 0 ? size : 0);
     free(args);
     return ret;
 }
@@ -123,11 +143,85 @@ int get_file_fs(char* src, char* localdst)
 {
     int ret;
     char* args = NULL;
+    struct xfer x;
     if (asprintf(&args, "%s %s %s", 
                 get_file_fs_cmd, src, localdst) == -1) {
         return EXIT_OUT_OF_MEMORY;
     }
+    xfer_begin(XFER_DOWN, 0, &x);
+    ret = system(args);
+    xfer_end(&x, ret == 0 ? netfs_local_size(localdst) : 0);
+    free(args);
+    return ret;
+}
+
+/*
+ * Get src from net fs to localdst, replacing whatever is there.  The get
+ * refuses to overwrite a local file, and localdst is often a name that
+ * make_tmpnam() reserved by creating it.
+ */
+int get_new_file_fs(char* src, char* localdst)
+{
+    unlink(localdst);
+    return get_file_fs(src, localdst);
+}
+
+/*
+ * Atomically create fname on net fs, if nobody else has created it yet.
+ * The put refuses to overwrite an existing file, and the file is created
+ * by the name node in one step, so of several callers exactly one gets 0.
+ * token is an existing local file to put, normally empty.
+ */
+int claim_file_fs(char* token, char* fname)
+{
+    return put_file_fs(token, fname);
+}
+
+/*
+ * whether fname exists on net fs, 0 if it does
+ */
+int test_file_fs(char* fname)
+{
+    int ret;
+    char* args = NULL;
+    if (asprintf(&args, "%s %s", test_file_fs_cmd, fname) == -1) {
+        return EXIT_OUT_OF_MEMORY;
+    }
+    ret = system(args);
+    free(args);
+    return ret;
+}
+
+/*
+ * Make sure fname is on net fs, putting localsrc there if it is not.  For
+ * files named by their content, which are the same whoever puts them:
+ * the put refuses to overwrite, so of two callers that put the same file
+ * at once one fails, and that is no failure if the file is there now.
+ */
+int share_file_fs(char* localsrc, char* fname)
+{
+    if (test_file_fs(fname) == 0)
+        return 0;
+    if (put_file_fs(localsrc, fname) == 0)
+        return 0;
+    return test_file_fs(fname);
+}
+
+/*
+ * get all files in a dir on net fs, concatenated into one local file
+ */
+int getmerge_file_fs(char* src_dir, char* localdst)
+{
+    int ret;
+    char* args = NULL;
+    struct xfer x;
+    if (asprintf(&args, "%s %s %s",
+                getmerge_file_fs_cmd, src_dir, localdst) == -1) {
+        return EXIT_OUT_OF_MEMORY;
+    }
+    xfer_begin(XFER_DOWN, 0, &x);
     ret = system(args);
+    xfer_end(&x, ret == 0 ? netfs_local_size(localdst) : 0);
     free(args);
     return ret;
 }
@@ -20,6 +20,11 @@ char* name_local_cpp_to_local_outdir(char* cpp_fname);
 
 int get_file_fs(char* srt, char* localdst);
 int put_file_fs(char* localsrc, char* dst);
+int get_new_file_fs(char* src, char* localdst);
+int share_file_fs(char* localsrc, char* fname);
+int getmerge_file_fs(char* src_dir, char* localdst);
+int claim_file_fs(char* token, char* fname);
+int test_file_fs(char* fname);
 int del_file_fs(char* fname);
 //int del_dir_fs(char* fname);
 
@@ -0,0 +1,304 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "io.h"
+#include "pack.h"
+
+/**
+ * @file
+ *
+ * Pack files: many small files in one, so that a batch costs the net fs
+ * one file instead of one per unit.
+ *
+ * A pack is written once, front to back:
+ *
+ *     MEMBER_DATA ...  INDEX  TRAILER
+ *
+ * The members are stored as they are, one after the other.  The index
+ * has one line "NAME OFFSET LENGTH" per member, and the trailer is a
+ * fixed size line "MRCCPACK1 INDEX_OFFSET".  A reader who knows where a
+ * member is can copy it out without looking at the rest; anybody else
+ * reads the trailer and then the index.
+ *
+ * Members are copied in and out with sendfile(), so their data does not
+ * pass through user space.
+ **/
+
+#define PACK_MAGIC          "MRCCPACK1"
+/* "MRCCPACK1 " + 20 digits + "\n" */
+#define PACK_TRAILER_LEN    31
+
+
+/*
+ * copy len bytes from in_fd at *off (or its position, if off is NULL)
+ * to the position of out_fd
+ */
+static int pack_copy(int out_fd, int in_fd, off_t *off, long len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = sendfile(out_fd, in_fd, off, len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            rs_log_error("sendfile failed: %s",
+                         n == 0 ? "unexpected end of file" : strerror(errno));
+            return EXIT_IO_ERROR;
+        }
+        len -= n;
+    }
+    return 0;
+}
+
+
+/**
+ * Start writing a new pack to @p fname.
+ **/
+int pack_create(const char *fname, struct pack_writer *w)
+{
+    memset(w, 0, sizeof *w);
+    w->fd = open(fname, O_WRONLY|O_CREAT|O_TRUNC|O_BINARY, 0666);
+    if (w->fd == -1) {
+        rs_log_error("failed to create %s: %s", fname, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    if ((w->index = open_memstream(&w->index_buf, &w->index_len)) == NULL) {
+        close(w->fd);
+        w->fd = -1;
+        return EXIT_OUT_OF_MEMORY;
+    }
+    return 0;
+}
+
+
+/**
+ * Append the file @p src as member @p name, which must not contain
+ * white space.  Where it went is returned in @p off and @p len.
+ **/
+int pack_add_file(struct pack_writer *w, const char *name, const char *src,
+                  long *off, long *len)
+{
+    struct stat st;
+    int fd;
+    int ret;
+
+    if ((fd = open(src, O_RDONLY|O_BINARY)) == -1) {
+        rs_log_error("failed to open %s: %s", src, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    if (fstat(fd, &st) == -1) {
+        rs_log_error("fstat %s failed: %s", src, strerror(errno));
+        close(fd);
+        return EXIT_IO_ERROR;
+    }
+    ret = pack_copy(w->fd, fd, NULL, st.st_size);
+    close(fd);
+    if (ret)
+        return ret;
+
+    *off = w->size;
+    *len = st.st_size;
+    w->size += st.st_size;
+    fprintf(w->index, "%s %ld %ld\n", name, *off, *len);
+    return 0;
+}
+
+
+/**
+ * Write the index and the trailer, and close the pack.
+ **/
+int pack_finish(struct pack_writer *w)
+{
+    char trailer[PACK_TRAILER_LEN + 1];
+    int ret = 0;
+
+    fclose(w->index);
+    snprintf(trailer, sizeof trailer, "%s %020ld\n", PACK_MAGIC, w->size);
+    if (writex(w->fd, w->index_buf, w->index_len)
+        || writex(w->fd, trailer, PACK_TRAILER_LEN))
+        ret = EXIT_IO_ERROR;
+    if (mrcc_close(w->fd) != 0)
+        ret = EXIT_IO_ERROR;
+    free(w->index_buf);
+    w->fd = -1;
+    return ret;
+}
+
+
+/**
+ * Read the index of the pack open on @p fd into @p *index_ret, which
+ * the caller must free.  It has one line "NAME OFFSET LENGTH" per
+ * member.
+ **/
+int pack_index(int fd, char **index_ret)
+{
+    char trailer[PACK_TRAILER_LEN + 1];
+    char *index;
+    struct stat st;
+    long index_off, index_len;
+
+    if (fstat(fd, &st) == -1 || st.st_size < PACK_TRAILER_LEN
+        || pread(fd, trailer, PACK_TRAILER_LEN,
+                 st.st_size - PACK_TRAILER_LEN) != PACK_TRAILER_LEN) {
+        rs_log_error("not a pack: too short");
+        return EXIT_PROTOCOL_ERROR;
+    }
+    trailer[PACK_TRAILER_LEN] = '\0';
+    if (!str_startswith(PACK_MAGIC " ", trailer)
+        || sscanf(trailer + strlen(PACK_MAGIC), "%ld", &index_off) != 1
+        || index_off < 0 || index_off > st.st_size - PACK_TRAILER_LEN) {
+        rs_log_error("not a pack: bad trailer");
+        return EXIT_PROTOCOL_ERROR;
+    }
+
+    index_len = st.st_size - PACK_TRAILER_LEN - index_off;
+    if ((index = malloc(index_len + 1)) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    if (pread(fd, index, index_len, index_off) != index_len) {
+        free(index);
+        return EXIT_IO_ERROR;
+    }
+    index[index_len] = '\0';
+    *index_ret = index;
+    return 0;
+}
+
+
+/**
+ * Call @p fn for each member of the pack open on @p fd, in the order of
+ * the index, with its name, offset and length, and @p arg.
+ *
+ * @returns 0 once all members were seen, the first nonzero return of
+ * @p fn, which ends the walk, or an error if @p fd is not a pack.
+ **/
+int pack_foreach(int fd, pack_member_fn *fn, void *arg)
+{
+    char *index, *line, *nl, *sp;
+    long off, len;
+    int ret;
+
+    if ((ret = pack_index(fd, &index)))
+        return ret;
+
+    for (line = index; ret == 0 && *line; line = nl + 1) {
+        if ((nl = strchr(line, '\n')) == NULL)
+            break;
+        *nl = '\0';
+        if ((sp = strchr(line, ' ')) == NULL
+            || sscanf(sp, "%ld %ld", &off, &len) != 2) {
+            rs_log_error("not a pack: bad index line \"%s\"", line);
+            ret = EXIT_PROTOCOL_ERROR;
+            break;
+        }
+        *sp = '\0';
+        ret = fn(fd, line, off, len, arg);
+    }
+
+    free(index);
+    return ret;
+}
+
+
+struct pack_find {
+    const char *name;
+    long *off, *len;
+};
+
+/* pack_foreach() callback of pack_lookup(): 1 stops at the member */
+static int pack_find_member(int fd, const char *name, long off, long len,
+                            void *arg)
+{
+    struct pack_find *f = arg;
+
+    (void) fd;
+    if (!str_equal(name, f->name))
+        return 0;
+    *f->off = off;
+    *f->len = len;
+    return 1;
+}
+
+/**
+ * Find member @p name in the pack open on @p fd.
+ *
+ * @returns 0 if found, EXIT_NO_SUCH_FILE if not, or another error if
+ * @p fd is not a pack.
+ **/
+int pack_lookup(int fd, const char *name, long *off, long *len)
+{
+    struct pack_find f;
+    int ret;
+
+    f.name = name;
+    f.off = off;
+    f.len = len;
+    ret = pack_foreach(fd, pack_find_member, &f);
+    if (ret == 1)
+        return 0;
+    return ret ? ret : EXIT_NO_SUCH_FILE;
+}
+
+
+/**
+ * Copy the member at @p off, @p len of the pack open on @p fd out to
+ * @p dst.  The file is renamed into place, so it is complete if it
+ * exists at all.
+ **/
+int pack_extract(int fd, long off, long len, const char *dst)
+{
+    char *tmp_fname;
+    off_t pos = off;
+    int out_fd;
+    int ret;
+
+    if (asprintf(&tmp_fname, "%s.%d.tmp", dst, (int) getpid()) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    if ((out_fd = open(tmp_fname, O_WRONLY|O_CREAT|O_TRUNC|O_BINARY,
+                       0666)) == -1) {
+        rs_log_error("failed to create %s: %s", tmp_fname, strerror(errno));
+        free(tmp_fname);
+        return EXIT_IO_ERROR;
+    }
+
+    ret = pack_copy(out_fd, fd, &pos, len);
+    if (mrcc_close(out_fd) != 0 && ret == 0)
+        ret = EXIT_IO_ERROR;
+    if (ret == 0 && rename(tmp_fname, dst) == -1) {
+        rs_log_error("rename %s to %s failed: %s",
+                     tmp_fname, dst, strerror(errno));
+        ret = EXIT_IO_ERROR;
+    }
+    if (ret)
+        unlink(tmp_fname);
+    free(tmp_fname);
+    return ret;
+}
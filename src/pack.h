@@ -0,0 +1,29 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_PACK_H
+# define _HEADER_PACK_H
+
+struct pack_writer {
+    int fd;
+    long size;          /* bytes of member data so far */
+    FILE *index;
+    char *index_buf;
+    size_t index_len;
+};
+
+int pack_create(const char *fname, struct pack_writer *w);
+int pack_add_file(struct pack_writer *w, const char *name, const char *src,
+                  long *off, long *len);
+int pack_finish(struct pack_writer *w);
+
+/* called by pack_foreach() for each member; nonzero ends the walk */
+typedef int pack_member_fn(int fd, const char *name, long off, long len,
+                           void *arg);
+
+int pack_index(int fd, char **index_ret);
+int pack_foreach(int fd, pack_member_fn *fn, void *arg);
+int pack_lookup(int fd, const char *name, long *off, long *len);
+int pack_extract(int fd, long off, long len, const char *dst);
+
+#endif //_HEADER_PACK_H
@@ -0,0 +1,200 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <utime.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "hash.h"
+#include "store.h"
+#include "pch.h"
+
+/**
+ * @file
+ *
+ * Precompiled headers on the cluster.
+ *
+ * The master preprocesses with -fpch-preprocess (see cpp_maybe()), so a
+ * .gch that GCC would use, for "-include pch.h" or a first #include of
+ * a header with a valid .gch next to it, is not expanded into the .i.
+ * The .i gets
+ *     #pragma GCC pch_preprocess "./pch.h.gch"
+ * instead, and the compiler of the .i loads the .gch from that path.
+ *
+ * pch_ship() finds that line, and puts the .gch to the net fs under the
+ * hash of its content, as mrcc/pch/DIGEST.gch, see store.c.  It stays
+ * there for all later compiles and builds that use the same .gch, so it
+ * is put once.  Nothing removes the .gch files from the net fs; remove
+ * mrcc/pch there to reclaim them.
+ *
+ * The mapper gets the DIGEST with the unit, fetches the .gch through
+ * its node cache (see mapcache.c), checks it, and points the pragma of
+ * the .i at it with pch_fetch().  A task fetches each .gch once for all
+ * its units.
+ *
+ * The .gch itself is built locally, since compiles of headers are not
+ * distributed; the nodes need the same compiler as the master to load
+ * it, or the compile fails there and is retried locally.  So this is
+ * only on by default along with MRCC_TOOLCHAIN=1, which gives them that
+ * compiler, see toolchain.c; MRCC_PCH=1 turns it on for clusters that
+ * have it anyway, and MRCC_PCH=0 off.  Without it the headers are
+ * expanded into the .i as before.
+ **/
+
+static const char pch_pragma[] = "#pragma GCC pch_preprocess \"";
+
+
+/*
+ * Find the .gch that the .i @p cpp_fname loads.  It comes before the
+ * first line of code, so only the directives at the top are looked at.
+ */
+static int pch_find(const char *cpp_fname, char **gch_ret)
+{
+    char *line = NULL, *path, *end;
+    size_t line_size = 0;
+    int ret = 0;
+    FILE *fp;
+
+    *gch_ret = NULL;
+    if ((fp = fopen(cpp_fname, "r")) == NULL) {
+        rs_log_error("failed to open %s: %s", cpp_fname, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    while (getline(&line, &line_size, fp) != -1) {
+        if (line[0] != '#' && line[0] != '\n')
+            break;
+        if (!str_startswith(pch_pragma, line))
+            continue;
+        path = line + strlen(pch_pragma);
+        if ((end = strchr(path, '"')) == NULL || strchr(path, '\\')) {
+            rs_log_warning("cannot make out the PCH in %s", cpp_fname);
+            ret = EXIT_MRCC_FAILED;
+        } else {
+            *end = '\0';
+            if ((*gch_ret = strdup(path)) == NULL)
+                ret = EXIT_OUT_OF_MEMORY;
+        }
+        break;
+    }
+    free(line);
+    fclose(fp);
+    return ret;
+}
+
+
+/**
+ * If the .i @p cpp_fname loads a precompiled header, make sure it is on
+ * the net fs, and return its digest in @p pch_digest, which must have
+ * space for HASH_HEX_LEN + 1 chars.  Otherwise @p pch_digest is set to
+ * "".
+ **/
+int pch_ship(const char *cpp_fname, char *pch_digest)
+{
+    char *gch;
+    int ret;
+
+    pch_digest[0] = '\0';
+    if ((ret = pch_find(cpp_fname, &gch)) || gch == NULL)
+        return ret;
+    if ((ret = store_put(gch, "pch", ".gch", pch_digest)) != 0)
+        pch_digest[0] = '\0';
+    free(gch);
+    return ret;
+}
+
+
+/*
+ * point the pragma of the .i @p cpp_fname at @p gch; the .i is replaced
+ * rather than written to, it may be linked to the node cache
+ */
+static int pch_localize(char *cpp_fname, const char *gch)
+{
+    char *tmp_fname, *line = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+    int done = 0;
+    FILE *in, *out;
+    int ret = 0;
+
+    if (asprintf(&tmp_fname, "%s.pch", cpp_fname) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    if ((in = fopen(cpp_fname, "r")) == NULL) {
+        free(tmp_fname);
+        return EXIT_IO_ERROR;
+    }
+    if ((out = fopen(tmp_fname, "w")) == NULL) {
+        rs_log_error("failed to create %s: %s", tmp_fname, strerror(errno));
+        fclose(in);
+        free(tmp_fname);
+        return EXIT_IO_ERROR;
+    }
+    while ((len = getline(&line, &line_size, in)) != -1) {
+        if (!done && str_startswith(pch_pragma, line)) {
+            fprintf(out, "%s%s\"\n", pch_pragma, gch);
+            done = 1;
+        } else {
+            fwrite(line, 1, len, out);
+        }
+    }
+    free(line);
+    fclose(in);
+    if (fclose(out) != 0 || !done) {
+        rs_log_error("failed to point %s at its PCH", cpp_fname);
+        ret = EXIT_IO_ERROR;
+    } else if (rename(tmp_fname, cpp_fname) == -1) {
+        rs_log_error("rename %s to %s failed: %s",
+                     tmp_fname, cpp_fname, strerror(errno));
+        ret = EXIT_IO_ERROR;
+    }
+    if (ret != 0)
+        unlink(tmp_fname);
+    free(tmp_fname);
+    return ret;
+}
+
+
+/**
+ * On the mapper: get the precompiled header with digest @p pch_digest,
+ * which the .i @p cpp_fname loads, and point the .i at it.
+ **/
+int pch_fetch(const char *pch_digest, char *cpp_fname)
+{
+    static char last_digest[HASH_HEX_LEN + 1];
+    static char *last_gch = NULL;
+    int ret;
+
+    if (last_gch == NULL || !str_equal(last_digest, pch_digest)) {
+        free(last_gch);
+        last_gch = NULL;
+        if ((ret = store_get(pch_digest, "pch", ".gch", &last_gch)))
+            return ret;
+        strcpy(last_digest, pch_digest);
+    }
+
+    rs_trace("%s loads PCH %s", cpp_fname, last_gch);
+    return pch_localize(cpp_fname, last_gch);
+}
@@ -0,0 +1,10 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_PCH_H
+# define _HEADER_PCH_H
+
+int pch_ship(const char *cpp_fname, char *pch_digest);
+int pch_fetch(const char *pch_digest, char *cpp_fname);
+
+#endif //_HEADER_PCH_H
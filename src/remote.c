@@ -28,14 +28,29 @@
 #include "utils.h"
 #include "trace.h"
 #include "args.h"
+#include "files.h"
 #include "exec.h"
 #include "remote.h"
 //#include "state.h"
 //#include "lock.h"
 #include "netfsutils.h"
+#include "cleanup.h"
 #include "stringutils.h"
 #include "mrutils.h"
 #include "compile.h"
+#include "io.h"
+#include "hash.h"
+#include "batch.h"
+#include "resdb.h"
+#include "coalesce.h"
+#include "manifest.h"
+#include "pch.h"
+#include "bundle.h"
+#include "rlink.h"
+#include "modules.h"
+#include "toolchain.h"
+#include "basedir.h"
+#include "tee.h"
 
 
 static int wait_for_cpp(pid_t cpp_pid,
@@ -68,7 +83,7 @@ static int wait_for_cpp(pid_t cpp_pid,
  */
 int put_cpp_fs(char* cpp_fname)
 {
-    int ret;
+    int ret = 0;
     char *out = NULL;
     if ((out = name_local_to_fs(cpp_fname)) == NULL) {
         return EXIT_OUT_OF_MEMORY;
@@ -185,7 +200,9 @@ static int put_cpp_config_fs(char** argv,
     if (*status != 0)
         goto out;
    
-    if ((ret = put_cpp_fs(cpp_fname)) != 0) {
+    if (batch_enabled()) {
+        rs_trace("cpp file \"%s\" goes to net fs with its batch", cpp_fname);
+    } else if ((ret = put_cpp_fs(cpp_fname)) != 0) {
         rs_log_error("put cpp file \"%s\" to net fs failed", cpp_fname);
         goto out;
     }
@@ -229,7 +246,8 @@ out:
  * source and object is replaced for the remote compilation
  * MapReduce will control the running of the job
  */
-static int call_mapper(char** argv, char* input_fname, char* cpp_fname, char* output_fname) 
+static int call_mapper(char** argv, char* input_fname, char* cpp_fname,
+        char* output_fname, const struct remote_job* job)
 {
     int ret = EXIT_CALL_MAPPER_FAILED;
     char** new_argv = NULL;
@@ -262,7 +280,13 @@ static int call_mapper(char** argv, char* input_fname, char* cpp_fname, char* ou
     }
     free_argv(new_argv);
 
-    ret = mr_exec(str_argv, cpp_fname, new_output_fname);
+    if (batch_enabled()) {
+        char key[HASH_HEX_LEN + 1];
+        resdb_key(input_fname, output_fname, key);
+        ret = batch_compile(str_argv, cpp_fname, new_output_fname, key, job);
+    } else {
+        ret = mr_exec(str_argv, cpp_fname, new_output_fname, job);
+    }
 
     free(str_argv);
     free(new_output_fname);
@@ -274,21 +298,65 @@ static int call_mapper(char** argv, char* input_fname, char* cpp_fname, char* ou
  * get the result from net fs and do cleanup at the same time
  * get the output file from network and put it to the right place
  * and do the net fs cleanup works at the same time
+ * a compile with side outputs returns them all in one pack, which is
+ * unpacked here, see manifest.c, and so does the compile of a module
+ * interface with its BMI, see modules.c
  */
-static int get_result_fs(char* cpp_fname, char* output_fname) 
+static int get_result_fs(char* cpp_fname, char* output_fname,
+        const char* dumpbase, const char* mods)
 {
     int ret;
     char* out_fname = NULL;
     char* fsname = NULL;
+    char* module = NULL;
+    if (mods != NULL && ((module = malloc(strlen(mods) + 1)) == NULL)) {
+        return EXIT_OUT_OF_MEMORY;
+    }
+    if (mods != NULL && mod_exported(mods, module) == NULL) {
+        free(module);
+        module = NULL;
+    }
     if ((out_fname = name_local_cpp_to_local_outfile(cpp_fname)) == NULL) {
+        free(module);
         return EXIT_OUT_OF_MEMORY;
     }
+    // a batch leader may have delivered it inline already
+    if (access(out_fname, F_OK) == 0) {
+        rs_trace("output file \"%s\" came inline", out_fname);
+        if (dumpbase != NULL) {
+            ret = manifest_unpack(out_fname, output_fname);
+        } else if (module != NULL) {
+            ret = mod_unpack(out_fname, output_fname, module);
+        } else {
+            ret = move_file(out_fname, output_fname);
+        }
+        free(out_fname);
+        free(module);
+        return ret;
+    }
     if ((fsname = name_local_to_fs(out_fname)) == NULL) {
+        free(module);
         return EXIT_OUT_OF_MEMORY;
     }
+    // get output file from net fs
+    if (dumpbase != NULL || module != NULL) {
+        ret = add_cleanup(out_fname);
+        if (ret == 0) {
+            ret = get_file_fs(fsname, out_fname);
+        }
+        if (ret == 0 && dumpbase != NULL) {
+            ret = manifest_unpack(out_fname, output_fname);
+        } else if (ret == 0) {
+            ret = mod_unpack(out_fname, output_fname, module);
+        }
+        add_cleanup_fs(fsname);
+        free(fsname);
+        free(out_fname);
+        free(module);
+        return ret;
+    }
     free(out_fname);
     out_fname = NULL;
-    // get output file from net fs
     ret = get_file_fs(fsname, output_fname);
     if (ret == 0) {
         ret = add_cleanup_fs(fsname);
@@ -342,11 +410,12 @@ int clean_up_outdir_fs(char* cpp_fname)
  * @param cpp_fname Filename of preprocessed source.  May not be complete yet,
  * depending on @p cpp_pid.
  *
- * @param files If we are doing preprocessing on the server, the names of
- * all the files needed; otherwise, NULL.
- *
  * @param output_fname File that the object code should be delivered to.
  *
+ * @param job If not NULL, what the caller knows of the job already: a
+ * compile with side outputs names them by job->dumpbase, and they come
+ * back with the object, see manifest.c.  The rest is filled in here.
+ *
  * @param cpp_pid If nonzero, the pid of the preprocessor.  Must be
  * allowed to complete before we send the input file.
  *
@@ -357,6 +426,15 @@ int clean_up_outdir_fs(char* cpp_fname)
  *
  * @param host Definition of host to send this job to.
  *
+ * An identical compile that is already running on the master is waited
+ * for and its object taken, see coalesce.c.  A precompiled header the
+ * preprocessed source loads is shipped along, see pch.c.  With
+ * MRCC_REMOTE_LINK=1 the object stays on the net fs, and a stub of it
+ * is delivered instead, see rlink.c.  With MRCC_TOOLCHAIN=1 the nodes
+ * compile with the compiler of the master, see toolchain.c.  The line
+ * markers of the preprocessed source name the files below MRCC_BASE_DIR
+ * by relative paths, see basedir.c.
+ *
  * @param status on return contains the wait-status of the remote
  * compiler.
  *
@@ -367,10 +445,8 @@ int clean_up_outdir_fs(char* cpp_fname)
 int compile_remote(char **argv,
                        char *input_fname,
                        char *cpp_fname,
-                       char **files, /* no use */
                        char *output_fname,
-                       char *deps_fname, /* no use */
-                       char *server_stderr_fname, /* no use by now */
+                       const struct remote_job *job,
                        pid_t cpp_pid,
                        int local_cpu_lock_fd,
                        struct hostdef *host,
@@ -378,15 +454,92 @@ int compile_remote(char **argv,
 {
     int ret = 0;
     struct timeval before;
+    char digest[HASH_HEX_LEN + 1] = "";
+    char pch[HASH_HEX_LEN + 1] = "";
+    char tc[HASH_HEX_LEN + 1] = "";
+    int has_digest = 0;
+    struct coalesce flight;
+    int done = 0;
+    char *mods = NULL;
+    struct remote_job j;
+    const char *dumpbase = job ? job->dumpbase : NULL;
+
+    flight.lock_fd = -1;
 
     if (gettimeofday(&before, NULL))
         rs_log_warning("gettimeofday failed");
 
     note_execution(host, argv);
     // note_state(PHASE_CONNECT, input_fname, host->hostname);
+
+    // the compiler runs as it is on the master, see toolchain.c; that
+    // does not depend on the .i, so it is shipped while cpp runs
+    if (!is_bundle(cpp_fname) && tc_ship(argv, tc) != 0) {
+        ret = -1;
+        goto out;
+    }
+
+    // the rest has to know what the compile is, which takes all of the .i
+    if (wait_for_cpp(cpp_pid, status, input_fname) != 0) {
+        rs_log_error("wait_for_cpp failed!");
+        ret = -1;
+        goto out;
+    }
+    cpp_pid = 0;
+
+#ifdef ENABLE_REMOTE_ASSEMBLE
+    if (*status == 0 && is_assembler(cpp_fname)
+            && asm_needs_local(cpp_fname) != 0) {
+        ret = -1;
+        goto out;
+    }
+#endif
+
+    // the tee of cpp has named the .i by its content already, see tee.c
+    if (*status == 0 && tee_digest(cpp_fname, digest) == 0) {
+        has_digest = 1;
+    }
+    // or the paths below the base dir are made relative now, see basedir.c
+    else if (*status == 0 && !is_bundle(cpp_fname)
+            && base_normalize(argv, cpp_fname, digest) != 0) {
+        ret = -1;
+        goto out;
+    }
+    // which hashes it on the way
+    else if (*status == 0 && digest[0]) {
+        has_digest = 1;
+    }
+
+    // the precompiled header it loads goes to the net fs, see pch.c
+    if (*status == 0 && pch_ship(cpp_fname, pch) != 0) {
+        ret = -1;
+        goto out;
+    }
+
+    // so do the module interfaces it imports, see modules.c
+    if (*status == 0 && !is_bundle(cpp_fname)
+            && mod_ship(argv, cpp_fname, &mods) != 0) {
+        ret = -1;
+        goto out;
+    }
+    // the object stays on the net fs, see rlink.c
+    j.keep = dumpbase == NULL && mods == NULL && !is_bundle(cpp_fname)
+        && rlink_enabled();
+
+    // name the content, so that mappers can serve it from their cache
+    // and identical compiles on the master can be run once
+    if (*status == 0 && !has_digest
+            && hash_file_hex(cpp_fname, digest) == 0) {
+        has_digest = 1;
+    }
+    // the waiters would only get the object, not the side outputs
+    if (has_digest && dumpbase == NULL && mods == NULL
+            && coalesce_begin(argv, input_fname, output_fname, digest,
+                pch[0] ? pch : NULL, &flight, &done) == 0 && done) {
+        goto out;
+    }
     
     // copy the preprocessed file to network and put the configuration files
-    // when we wait for the cpp to finish if it has not finished
     note_info_time("begin put_cpp_config_fs");
     if (put_cpp_config_fs(argv, input_fname, cpp_fname, output_fname,
             cpp_pid, local_cpu_lock_fd, host, status) != 0) {
@@ -397,7 +550,12 @@ int compile_remote(char **argv,
     note_info_time("finish put_cpp_config_fs");
     // call the mapper
     note_info_time("begin call_mapper");
-    if (call_mapper(argv, input_fname, cpp_fname, output_fname) != 0) {
+    j.digest = has_digest ? digest : NULL;
+    j.dumpbase = dumpbase;
+    j.pch = pch[0] ? pch : NULL;
+    j.mods = mods;
+    j.tc = tc[0] ? tc : NULL;
+    if (call_mapper(argv, input_fname, cpp_fname, output_fname, &j) != 0) {
         rs_log_error("call_mapper failed!");
         ret = -1;
         goto out;
@@ -407,7 +565,7 @@ int compile_remote(char **argv,
     // get the output file from network and put it to the right place
     // and do the net fs cleanup works at the same time
     note_info_time("begin get_result_fs");
-    if (get_result_fs(cpp_fname, output_fname) != 0) {
+    if (get_result_fs(cpp_fname, output_fname, dumpbase, mods) != 0) {
         rs_log_error("get_result_fs failed!");
         ret = -1;
         goto out;
@@ -415,7 +573,28 @@ int compile_remote(char **argv,
     note_info_time("finish get_result-fs");
 
 out:
+    coalesce_end(&flight, output_fname, ret == 0 && *status == 0);
+    // the digest of a .i that failed, or was not asked for, see tee.c
+    if (cpp_pid == 0)
+        tee_close();
+    free(mods);
     return ret;
 }
 
 
+/**
+ * Run the command @p argv remotely on the files of the bundle
+ * @p bundle_fname (see bundle.c), which the mapper extracts next to it,
+ * and deliver its output to @p output_fname.  Nothing in the command is
+ * the bundle, so nothing in it is replaced but the output; used for
+ * ThinLTO backends (see lto.c) and remote links (see rlink.c).
+ *
+ * @returns as compile_remote() does, with the exit code of the command
+ * in @p status.
+ **/
+int compile_remote_bundle(char **argv, char *bundle_fname,
+                          char *output_fname, int *status)
+{
+    return compile_remote(argv, bundle_fname, bundle_fname, output_fname,
+                          NULL, 0, -1, NULL, status);
+}
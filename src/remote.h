@@ -4,18 +4,35 @@
 #ifndef _HEADER_REMOTE_H
 # define _HEADER_REMOTE_H
 
+/**
+ * What the mapper of a remote compile needs besides its command, see
+ * mr_exec() and batch_compile().  Strings that are NULL are not sent.
+ **/
+struct remote_job {
+    const char *digest;     /* content hash of the .i, see hash.c */
+    const char *dumpbase;   /* the compile has side outputs named after
+                               this, see manifest.c */
+    const char *pch;        /* content hash of the precompiled header
+                               the .i loads, see pch.c */
+    int keep;               /* the object stays on the net fs, see rlink.c */
+    const char *mods;       /* the C++ modules of the unit, see modules.c */
+    const char *tc;         /* fingerprint of the toolchain to compile
+                               with, see toolchain.c */
+};
+
 int compile_remote(char **argv,
                        char *input_fname,
                        char *cpp_fname,
-                       char **files,
                        char *output_fname,
-                       char *deps_fname,
-                       char *server_stderr_fname,
+                       const struct remote_job *job,
                        pid_t cpp_pid,
                        int local_cpu_lock_fd,
                        struct hostdef *host,
                        int *status);
 
+int compile_remote_bundle(char **argv, char *bundle_fname,
+                          char *output_fname, int *status);
+
 int put_cpp_fs(char* cpp_fname);
 int put_config_fs(char** argv,
         char* input_fname,
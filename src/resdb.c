@@ -0,0 +1,173 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "tempfile.h"
+#include "hash.h"
+#include "resdb.h"
+
+/**
+ * @file
+ *
+ * The resource database remembers what each compile unit cost on the
+ * mappers, so that batches can be packed with real numbers instead of
+ * guesses.
+ *
+ * There is one small text file per unit under ~/.mrcc/resdb, named by
+ * the hash of the unit's source and object names.  Records are replaced
+ * by rename(), so readers never see a half written record and no
+ * locking is needed.
+ **/
+
+/* Estimate for units that have never been compiled: a fixed cost for the
+ * compiler itself plus a multiple of the preprocessed size. */
+#define RESDB_BASE_MEM_KB   (64 * 1024)
+/* memory per size of .i, KB per KB */
+#define RESDB_MEM_RATIO     16
+/* Same for the compile time: milliseconds per KB of .i */
+#define RESDB_BASE_MSEC     50
+#define RESDB_MSEC_PER_KB   2
+
+
+/*
+ * name a unit by the source it is compiled from and the object it goes to
+ * key must have space for HASH_HEX_LEN + 1 chars
+ */
+void resdb_key(const char *input_fname, const char *output_fname, char *key)
+{
+    struct hash_state st;
+    char *cwd;
+
+    hash_init(&st);
+    /* relative names are only unique within a directory */
+    if (input_fname[0] != '/' && (cwd = getcwd(NULL, 0)) != NULL) {
+        hash_update(&st, cwd, strlen(cwd) + 1);
+        free(cwd);
+    }
+    hash_update(&st, input_fname, strlen(input_fname) + 1);
+    hash_update(&st, output_fname, strlen(output_fname));
+    hash_final_hex(&st, key);
+}
+
+
+static int resdb_fname(const char *key, char **fname_ret)
+{
+    int ret;
+    char *dir;
+
+    if ((ret = get_resdb_dir(&dir)))
+        return ret;
+    if (asprintf(fname_ret, "%s/%s", dir, key) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    return 0;
+}
+
+
+/**
+ * Look up the record for @p key.
+ *
+ * @returns 0 if found, EXIT_NO_SUCH_FILE if this unit has no history.
+ **/
+int resdb_lookup(const char *key, struct resdb_entry *e)
+{
+    FILE *fp;
+    char *fname;
+    int ret;
+
+    if ((ret = resdb_fname(key, &fname)))
+        return ret;
+
+    fp = fopen(fname, "r");
+    free(fname);
+    if (fp == NULL)
+        return EXIT_NO_SUCH_FILE;
+
+    if (fscanf(fp, "%ld %ld %ld", &e->mem_kb, &e->msec, &e->isize) != 3)
+        ret = EXIT_NO_SUCH_FILE;
+    fclose(fp);
+
+    return ret;
+}
+
+
+int resdb_record(const char *key, const struct resdb_entry *e)
+{
+    FILE *fp;
+    char *fname, *tmp_fname;
+    int ret;
+
+    if ((ret = resdb_fname(key, &fname)))
+        return ret;
+    if (asprintf(&tmp_fname, "%s.%d.tmp", fname, (int) getpid()) == -1) {
+        free(fname);
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    if ((fp = fopen(tmp_fname, "w")) == NULL) {
+        rs_log_warning("failed to write %s: %s", tmp_fname, strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+    fprintf(fp, "%ld %ld %ld\n", e->mem_kb, e->msec, e->isize);
+    if (fclose(fp) != 0 || rename(tmp_fname, fname) == -1) {
+        rs_log_warning("failed to record %s: %s", fname, strerror(errno));
+        unlink(tmp_fname);
+        ret = EXIT_IO_ERROR;
+    }
+
+out:
+    free(tmp_fname);
+    free(fname);
+    return ret;
+}
+
+
+/*
+ * guess the peak memory of a unit that has no history from its .i size
+ */
+long resdb_estimate_mem_kb(long isize)
+{
+    return RESDB_BASE_MEM_KB + isize / 1024 * RESDB_MEM_RATIO;
+}
+
+
+/*
+ * guess the compile time of a unit that has no history from its .i size
+ */
+long resdb_estimate_msec(long isize)
+{
+    return RESDB_BASE_MSEC + isize / 1024 * RESDB_MSEC_PER_KB;
+}
+
+
+/*
+ * Predict the compile time of a unit from its history.  The source may
+ * have changed since, so the recorded time is scaled by how much the .i
+ * grew or shrank.
+ */
+long resdb_scale_msec(const struct resdb_entry *e, long isize)
+{
+    if (e->isize <= 0 || isize <= 0)
+        return e->msec;
+    return (long) ((double) e->msec * isize / e->isize);
+}
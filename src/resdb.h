@@ -0,0 +1,25 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_RESDB_H
+# define _HEADER_RESDB_H
+
+/**
+ * What one compile unit cost the last time it was compiled on a mapper.
+ **/
+struct resdb_entry {
+    long mem_kb;    /* peak RSS of the compiler */
+    long msec;      /* wall clock time of the compiler */
+    long isize;     /* size of the preprocessed input */
+};
+
+void resdb_key(const char *input_fname, const char *output_fname, char *key);
+
+int resdb_lookup(const char *key, struct resdb_entry *e);
+int resdb_record(const char *key, const struct resdb_entry *e);
+
+long resdb_estimate_mem_kb(long isize);
+long resdb_estimate_msec(long isize);
+long resdb_scale_msec(const struct resdb_entry *e, long isize);
+
+#endif //_HEADER_RESDB_H
@@ -0,0 +1,412 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "args.h"
+#include "tempfile.h"
+#include "netfsutils.h"
+#include "mapcache.h"
+#include "hash.h"
+#include "remote.h"
+#include "bundle.h"
+#include "rlink.h"
+
+/**
+ * @file
+ *
+ * Remote links, MRCC_REMOTE_LINK=1 on the master.
+ *
+ * The objects of remote compiles then stay on the net fs: the mapper
+ * puts the object there under the hash of its content, as
+ * mrcc/objs/DIGEST.o, and sends back a stub in its place,
+ *     !<mrcc-object>
+ *     DIGEST SIZE
+ * which the master writes to the output file as it would the object.
+ * Compiles with side outputs and commands whose input is a bundle (see
+ * bundle.c) get their outputs back as before.
+ *
+ * A link through mrcc, "mrcc cc -o app a.o b.o", whose inputs include
+ * stubs, runs as a remote command of its own: its relative inputs, the
+ * stubs among them, go to the cluster as one bundle, the mapper fetches
+ * the object of every stub through its node cache, links in the
+ * directory the bundle was extracted to, and only the binary comes
+ * back.  The libraries and absolute inputs have to be on the node as
+ * they are on the master, like the compiler.
+ *
+ * A link that cannot go remote, because it names files by relative
+ * paths in its options (-L dirs, linker scripts, -Wl, lists), or fails
+ * there, gets the objects of the stubs among its inputs fetched in
+ * their place, and runs locally.  Compiles (-c, -S, -E) read no
+ * objects, and a stub that is their output is just replaced.  Tools
+ * that do not go through mrcc, such as ar, would see the stubs, so only
+ * builds that link through mrcc can turn this on.
+ *
+ * Nothing removes the objects from the net fs; remove mrcc/objs there
+ * to reclaim them.
+ **/
+
+static const char stub_magic[] = "!<mrcc-object>\n";
+
+
+int rlink_enabled(void)
+{
+    return getenv_bool("MRCC_REMOTE_LINK", 0);
+}
+
+
+/*
+ * the name of the object with content @p digest on the net fs
+ */
+static char *rlink_fs_name(const char *digest)
+{
+    char *fs_name;
+
+    if (asprintf(&fs_name, "%s/objs/%s.o", fs_top_dir, digest) == -1)
+        return NULL;
+    return fs_name;
+}
+
+
+/*
+ * Read the stub @p fname; the digest of its object goes to @p digest.
+ * Returns nonzero if it is not a stub.
+ */
+static int rlink_read_stub(const char *fname, char *digest, long *size)
+{
+    char buf[sizeof stub_magic + HASH_HEX_LEN + 32];
+    char fmt[32];
+    size_t len;
+    FILE *fp;
+
+    if ((fp = fopen(fname, "r")) == NULL)
+        return EXIT_NO_SUCH_FILE;
+    len = fread(buf, 1, sizeof buf - 1, fp);
+    fclose(fp);
+    buf[len] = '\0';
+    if (!str_startswith(stub_magic, buf))
+        return EXIT_MRCC_FAILED;
+    snprintf(fmt, sizeof fmt, "%%%ds %%ld", HASH_HEX_LEN);
+    if (sscanf(buf + strlen(stub_magic), fmt, digest, size) != 2
+        || strlen(digest) != HASH_HEX_LEN)
+        return EXIT_PROTOCOL_ERROR;
+    return 0;
+}
+
+
+/**
+ * Whether @p fname is the stub of an object on the net fs.
+ **/
+int is_obj_stub(const char *fname)
+{
+    char digest[HASH_HEX_LEN + 1];
+    struct stat st;
+    long size;
+
+    if (stat(fname, &st) == -1 || !S_ISREG(st.st_mode)
+        || st.st_size > (off_t) (sizeof stub_magic + HASH_HEX_LEN + 32))
+        return 0;
+    return rlink_read_stub(fname, digest, &size) == 0;
+}
+
+
+/**
+ * On the mapper: put the object @p out_fname to the net fs, and leave
+ * its stub in its place.
+ **/
+int rlink_keep(const char *out_fname)
+{
+    char digest[HASH_HEX_LEN + 1];
+    char *fs_name, *tmp_fname;
+    struct stat st;
+    FILE *fp;
+    int ret = 0;
+
+    if (stat(out_fname, &st) == -1 || hash_file_hex(out_fname, digest) != 0) {
+        rs_log_error("failed to read %s", out_fname);
+        return EXIT_IO_ERROR;
+    }
+    if ((fs_name = rlink_fs_name(digest)) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+
+    if (share_file_fs((char *) out_fname, fs_name) != 0) {
+        rs_log_error("put object %s to net fs failed", out_fname);
+        free(fs_name);
+        return EXIT_PUT_CPP_FS_FAILED;
+    }
+
+    if (asprintf(&tmp_fname, "%s.stub", out_fname) == -1) {
+        free(fs_name);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    if ((fp = fopen(tmp_fname, "w")) == NULL) {
+        rs_log_error("failed to create %s: %s", tmp_fname, strerror(errno));
+        ret = EXIT_IO_ERROR;
+    } else {
+        fprintf(fp, "%s%s %ld\n", stub_magic, digest, (long) st.st_size);
+        if (fclose(fp) != 0 || rename(tmp_fname, out_fname) == -1) {
+            rs_log_error("failed to leave the stub of %s", out_fname);
+            unlink(tmp_fname);
+            ret = EXIT_IO_ERROR;
+        }
+    }
+    if (ret == 0)
+        rs_trace("object %s stays on net fs as %s", out_fname, fs_name);
+    free(tmp_fname);
+    free(fs_name);
+    return ret;
+}
+
+
+/**
+ * Replace the stub @p fname with its object, through the node cache if
+ * @p on_map.
+ **/
+int rlink_unstub(const char *fname, int on_map)
+{
+    char digest[HASH_HEX_LEN + 1], got[HASH_HEX_LEN + 1];
+    char *fs_name, *tmp_fname;
+    long size;
+    int ret;
+
+    if ((ret = rlink_read_stub(fname, digest, &size)))
+        return ret;
+    if ((fs_name = rlink_fs_name(digest)) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    if (asprintf(&tmp_fname, "%s.unstub", fname) == -1) {
+        free(fs_name);
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    if (on_map)
+        ret = map_cache_get_file(digest, fs_name, tmp_fname, NULL);
+    else
+        ret = get_new_file_fs(fs_name, tmp_fname);
+    if (ret != 0 || hash_file_hex(tmp_fname, got) != 0
+        || !str_equal(got, digest)) {
+        rs_log_error("get object %s from net fs failed", fs_name);
+        if (on_map)
+            map_cache_drop(digest);
+        ret = EXIT_GET_CPP_FS_FAILED;
+    } else if (rename(tmp_fname, fname) == -1) {
+        rs_log_error("rename %s to %s failed: %s",
+                     tmp_fname, fname, strerror(errno));
+        ret = EXIT_IO_ERROR;
+    } else {
+        rs_trace("stub %s is object %s again", fname, fs_name);
+    }
+    if (ret != 0)
+        unlink(tmp_fname);
+    free(tmp_fname);
+    free(fs_name);
+    return ret;
+}
+
+
+/*
+ * Advance @p *i to the next input of the link @p argv that is a stub,
+ * starting with *i at 0.  Returns 0 when there is none.  The output and
+ * the values of options are not inputs, and commands that do not link
+ * have none, since a stub of their output from an earlier build is only
+ * to be replaced.
+ */
+static int rlink_next_stub(char **argv, int *i)
+{
+    const char *a;
+    int j;
+
+    for (j = 1; argv[j]; j++) {
+        if (str_equal(argv[j], "-c") || str_equal(argv[j], "-S")
+            || str_equal(argv[j], "-E"))
+            return 0;
+    }
+    for ((*i)++; argv[*i]; (*i)++) {
+        a = argv[*i];
+        if (a[0] != '-') {
+            if (is_obj_stub(a))
+                return 1;
+        } else if ((str_equal(a, "-o") || str_equal(a, "-x")
+                    || str_equal(a, "-T") || arg_takes_value(a))
+                   && argv[*i + 1]) {
+            (*i)++;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * Fetch the objects of the stubs among the inputs of the link @p argv
+ * into their place, for it to run locally.
+ **/
+int rlink_materialize(char **argv)
+{
+    int i = 0;
+    int ret;
+
+    while (rlink_next_stub(argv, &i)) {
+        if ((ret = rlink_unstub(argv[i], 0)))
+            return ret;
+    }
+    return 0;
+}
+
+
+/*
+ * whether some piece of the option value @p value, split at @p sep, is
+ * a file the node would not find
+ */
+static int rlink_names_file(const char *value, int sep)
+{
+    char *copy, *piece, *next;
+    int found = 0;
+
+    if ((copy = strdup(value)) == NULL)
+        return 1;
+    for (piece = copy; piece && !found; piece = next) {
+        if ((next = strchr(piece, sep)) != NULL)
+            *next++ = '\0';
+        found = piece[0] && piece[0] != '/' && access(piece, F_OK) == 0;
+    }
+    free(copy);
+    return found;
+}
+
+
+/*
+ * Find what the link @p argv reads: the relative inputs go to
+ * @p files, the output to @p output_ret.  Returns nonzero if it cannot
+ * run remotely.
+ */
+static int rlink_inputs(char **argv, char **files, char **output_ret)
+{
+    int n = 0;
+    int i;
+
+    *output_ret = NULL;
+    for (i = 1; argv[i]; i++) {
+        char *a = argv[i];
+
+        if (a[0] != '-') {
+            if (access(a, R_OK) == -1)
+                return EXIT_NO_SUCH_FILE;
+            if (a[0] == '/')
+                continue;
+            if (!bundle_name_ok(a))
+                return EXIT_MRCC_FAILED;
+            files[n++] = a;
+        } else if (str_equal(a, "-o") && argv[i+1]) {
+            *output_ret = argv[++i];
+        } else if (str_equal(a, "-c") || str_equal(a, "-S")
+                   || str_equal(a, "-E") || str_startswith("-M", a)) {
+            /* not a link */
+            return EXIT_MRCC_FAILED;
+        } else if (str_startswith("-L", a) || str_startswith("-B", a)) {
+            const char *dir = a[2] ? a + 2 : argv[i+1];
+
+            if (dir == NULL || dir[0] != '/')
+                return EXIT_MRCC_FAILED;
+            if (a[2] == '\0')
+                i++;
+        } else if (str_startswith("-Wl,", a)) {
+            if (rlink_names_file(a + 4, ','))
+                return EXIT_MRCC_FAILED;
+        } else if (str_equal(a, "-T") || str_equal(a, "-Xlinker")) {
+            if (argv[i+1] == NULL || rlink_names_file(argv[++i], '\0'))
+                return EXIT_MRCC_FAILED;
+        } else if (str_startswith("-T", a) || str_startswith("-specs", a)) {
+            return EXIT_MRCC_FAILED;
+        } else if (arg_takes_value(a) && argv[i+1]) {
+            i++;
+        }
+    }
+    files[n] = NULL;
+    return *output_ret ? 0 : EXIT_MRCC_FAILED;
+}
+
+
+/*
+ * Run the link @p argv on the cluster, with its relative inputs in a
+ * bundle.
+ */
+static int rlink_remote(char **argv)
+{
+    char **files;
+    char *output, *bundle_fname;
+    int status = 0;
+    mode_t mask;
+    int ret;
+
+    if ((files = calloc(argv_len(argv) + 1, sizeof(char *))) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    if ((ret = rlink_inputs(argv, files, &output)) != 0) {
+        rs_log_info("link cannot go remote, linking here");
+        free(files);
+        return ret;
+    }
+    if ((ret = make_tmpnam("mrcc", ".bundle", &bundle_fname)) == 0)
+        ret = bundle_create(bundle_fname, files);
+    free(files);
+    if (ret != 0)
+        return ret;
+
+    rs_log_info("linking %s remotely", output);
+    if ((ret = compile_remote_bundle(argv, bundle_fname, output,
+                                     &status)) != 0)
+        return ret;
+
+    /* it came as a plain file */
+    mask = umask(0);
+    umask(mask);
+    chmod(output, 0777 & ~mask);
+    return status;
+}
+
+
+/**
+ * Link @p argv remotely, if some of its inputs are stubs and @p sg_level
+ * does not say that this is a recursive mrcc (see mrcc.c); @p *done
+ * tells whether it did.  Otherwise the objects of the stubs are fetched
+ * for the command to run here.  The exit code of the link is returned,
+ * and @p argv is freed if it was run.
+ **/
+int rlink_build(char **argv, int sg_level, int *done)
+{
+    int i = 0;
+
+    *done = 0;
+    if (!rlink_next_stub(argv, &i))
+        return 0;
+
+    if (!sg_level && rlink_enabled() && rlink_remote(argv) == 0) {
+        free_argv(argv);
+        *done = 1;
+        return 0;
+    }
+    return rlink_materialize(argv);
+}
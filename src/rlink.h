@@ -0,0 +1,14 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_RLINK_H
+# define _HEADER_RLINK_H
+
+int rlink_enabled(void);
+int is_obj_stub(const char *fname);
+int rlink_keep(const char *out_fname);
+int rlink_unstub(const char *fname, int on_map);
+int rlink_materialize(char **argv);
+int rlink_build(char **argv, int sg_level, int *done);
+
+#endif //_HEADER_RLINK_H
@@ -0,0 +1,255 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "files.h"
+#include "args.h"
+#include "compile.h"
+#include "split.h"
+
+/**
+ * @file
+ *
+ * Compiles of several sources in one command, "cc -c a.c b.c c.c", as
+ * some build systems issue them.  scan_args() only takes one input, so
+ * such a command is taken apart into one unit per source, each with all
+ * the options of the command, and the -x language in effect for that
+ * source.  The units have no -o, the compiler put the objects of the
+ * command into the working directory, named after the sources, and
+ * scan_args() names them the same way.
+ *
+ * Every unit is built by a child of its own, like a separate mrcc
+ * process, so that the units are preprocessed and go to the cluster in
+ * parallel, up to MRCC_SPLIT_JOBS (default 16) at a time; admission
+ * control (see admit.c) still decides where each one runs.  The command
+ * fails if any unit fails, after all of them are done, as the compiler
+ * would.
+ *
+ * Commands with -o, with a dependency output of their own, or with
+ * words that are neither options nor sources, are left alone.
+ * MRCC_SPLIT=0 turns this off.
+ **/
+
+
+/*
+ * Find the inputs of @p argv, which are returned in @p inputs with
+ * their -x languages in @p langs.  Returns the number of inputs, or -1
+ * if the command is not to be split.
+ */
+static int split_inputs(char **argv, char **inputs, const char **langs)
+{
+    const char *lang = NULL;
+    int seen_opt_c = 0;
+    int n = 0;
+    int i;
+
+    for (i = 1; argv[i]; i++) {
+        char *a = argv[i];
+
+        if (a[0] == '-' && a[1] != '\0') {
+            if (str_startswith("-x", a)) {
+                lang = a[2] ? a + 2 : argv[++i];
+                if (lang == NULL)
+                    return -1;
+                if (str_equal(lang, "none"))
+                    lang = NULL;
+            } else if (str_equal(a, "-c") || str_equal(a, "-S")) {
+                seen_opt_c = 1;
+            } else if (str_startswith("-o", a) || str_equal(a, "-E")
+                       || str_startswith("-Wp,-M", a)
+                       || str_equal(a, "-MF") || str_equal(a, "-MT")
+                       || str_equal(a, "-MQ")
+                       || (str_startswith("-M", a) && !str_equal(a, "-MD")
+                           && !str_equal(a, "-MMD") && !str_equal(a, "-MP")
+                           && !str_equal(a, "-MG"))) {
+                /* one output for all of them */
+                return -1;
+            } else if (arg_takes_value(a) && argv[i+1]) {
+                i++;
+            }
+        } else if (lang || is_source(a)) {
+            inputs[n] = a;
+            langs[n] = lang;
+            n++;
+        } else {
+            /* "-", or an object the compiler would ignore */
+            return -1;
+        }
+    }
+    return seen_opt_c ? n : -1;
+}
+
+
+/*
+ * the command of the unit for @p input: the options of @p argv, and the
+ * input with its language
+ */
+static int split_unit(char **argv, char *input, const char *lang,
+                      char ***unit_ret)
+{
+    char **unit;
+    int i, j = 0;
+
+    if ((unit = calloc(argv_len(argv) + 4, sizeof(char *))) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+
+    for (i = 0; argv[i]; i++) {
+        if (i > 0 && (argv[i][0] != '-' || argv[i][1] == '\0'))
+            continue;
+        if (str_equal(argv[i], "-x")) {
+            if (argv[i+1])
+                i++;
+            continue;
+        }
+        if (str_startswith("-x", argv[i]))
+            continue;
+        if ((unit[j++] = strdup(argv[i])) == NULL)
+            goto oom;
+        if (i > 0 && arg_takes_value(argv[i]) && argv[i+1]) {
+            if ((unit[j++] = strdup(argv[++i])) == NULL)
+                goto oom;
+        }
+    }
+    if (lang) {
+        if ((unit[j++] = strdup("-x")) == NULL
+            || (unit[j++] = strdup(lang)) == NULL)
+            goto oom;
+    }
+    if ((unit[j++] = strdup(input)) == NULL)
+        goto oom;
+
+    *unit_ret = unit;
+    return 0;
+
+  oom:
+    free_argv(unit);
+    return EXIT_OUT_OF_MEMORY;
+}
+
+
+/*
+ * wait for one unit, and keep the first failure in @p ret
+ */
+static void split_wait_one(int *running, int *ret)
+{
+    int status, unit_ret;
+    pid_t pid;
+
+    while ((pid = wait(&status)) == -1 && errno == EINTR)
+        ;
+    if (pid == -1) {
+        rs_log_error("wait failed: %s", strerror(errno));
+        *running = 0;
+        if (*ret == 0)
+            *ret = EXIT_MRCC_FAILED;
+        return;
+    }
+    (*running)--;
+
+    if (WIFEXITED(status))
+        unit_ret = WEXITSTATUS(status);
+    else if (WIFSIGNALED(status))
+        unit_ret = 128 + WTERMSIG(status);
+    else
+        unit_ret = EXIT_MRCC_FAILED;
+    if (unit_ret != 0 && *ret == 0)
+        *ret = unit_ret;
+}
+
+
+/**
+ * Build the command @p argv unit by unit, if it compiles several
+ * sources; @p *done tells whether it did.  The exit code of the
+ * command is returned, and @p argv is freed if it was built.
+ **/
+int split_build(char **argv, int *done)
+{
+    char **inputs, **unit;
+    const char **langs;
+    int max_jobs, running = 0;
+    int n, i;
+    int ret = 0;
+    pid_t pid;
+
+    *done = 0;
+    if (!getenv_bool("MRCC_SPLIT", 1))
+        return 0;
+
+    inputs = calloc(argv_len(argv), sizeof(char *));
+    langs = calloc(argv_len(argv), sizeof(char *));
+    if (inputs == NULL || langs == NULL) {
+        free(inputs);
+        free(langs);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    if ((n = split_inputs(argv, inputs, langs)) < 2) {
+        free(inputs);
+        free(langs);
+        return 0;
+    }
+
+    rs_log_info("compiling %d sources as separate units", n);
+    max_jobs = getenv_int("MRCC_SPLIT_JOBS", 16);
+    if (max_jobs < 1)
+        max_jobs = 1;
+    fflush(NULL);
+
+    for (i = 0; i < n; i++) {
+        if (running == max_jobs)
+            split_wait_one(&running, &ret);
+        if (split_unit(argv, inputs[i], langs[i], &unit) != 0) {
+            ret = EXIT_OUT_OF_MEMORY;
+            break;
+        }
+
+        if ((pid = fork()) == -1) {
+            rs_log_error("failed to fork: %s", strerror(errno));
+            free_argv(unit);
+            ret = EXIT_MRCC_FAILED;
+            break;
+        }
+        if (pid == 0) {
+            int status;
+
+            /* build_somewhere_timed() frees it */
+            exit(build_somewhere_timed(unit, 0, &status));
+        }
+        rs_trace("unit for %s is process %d", inputs[i], (int) pid);
+        free_argv(unit);
+        running++;
+    }
+    while (running > 0)
+        split_wait_one(&running, &ret);
+
+    free(inputs);
+    free(langs);
+    free_argv(argv);
+    *done = 1;
+    return ret;
+}
@@ -0,0 +1,9 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_SPLIT_H
+# define _HEADER_SPLIT_H
+
+int split_build(char **argv, int *done);
+
+#endif //_HEADER_SPLIT_H
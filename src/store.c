@@ -0,0 +1,220 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <utime.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "tempfile.h"
+#include "netfsutils.h"
+#include "mapcache.h"
+#include "hash.h"
+#include "store.h"
+
+/**
+ * @file
+ *
+ * Files on the net fs named by the hash of their content.
+ *
+ * The master puts a file with store_put() as mrcc/KIND/DIGEST.EXTEN,
+ * where KIND keeps apart what the files are: precompiled headers (see
+ * pch.c) and module interfaces (see modules.c).  A file that does not
+ * change is put once, for all later compiles and builds; a file in the
+ * store dir of the master remembers that it is there for
+ * STORE_MARK_KEEP seconds, after which the net fs is asked again.  The
+ * digest of a file is remembered there too, by its path, inode, size and
+ * mtime, so that a big .gch is not read again for every compile that
+ * loads it.
+ *
+ * The mapper gets the file with store_get(), through its node cache
+ * (see mapcache.c), and checks its content against the DIGEST, since it
+ * may have been caught half put.
+ **/
+
+#define STORE_MARK_KEEP     3600
+
+
+/*
+ * the name of the file with content @p digest and extension @p exten on
+ * the net fs, in its @p kind dir
+ */
+static char *store_fs_name(const char *kind, const char *digest,
+                           const char *exten)
+{
+    char *fs_name;
+
+    if (asprintf(&fs_name, "%s/%s/%s%s", fs_top_dir, kind, digest,
+                 exten) == -1)
+        return NULL;
+    return fs_name;
+}
+
+
+/*
+ * the digest of @p fname, from the memo of it in @p dir if the file did
+ * not change since, otherwise hashed and memoized
+ *
+ * The memo is named by the hash of the path, and holds one line
+ *     DIGEST INODE SIZE MTIME
+ */
+static int store_digest(const char *dir, const char *fname, char *digest)
+{
+    char key[HASH_HEX_LEN + 1], line[HASH_HEX_LEN + 64];
+    char *path, *memo = NULL, *tmp = NULL;
+    unsigned long ino;
+    long size, mtime;
+    struct stat st;
+    FILE *f;
+    int ret = 0;
+
+    if ((path = realpath(fname, NULL)) == NULL || stat(path, &st) == -1) {
+        rs_log_error("failed to read %s: %s", fname, strerror(errno));
+        free(path);
+        return EXIT_IO_ERROR;
+    }
+    hash_str_hex(path, key);
+    if (asprintf(&memo, "%s/%s.memo", dir, key) == -1) {
+        memo = NULL;
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+
+    if ((f = fopen(memo, "r")) != NULL) {
+        if (fgets(line, sizeof line, f) != NULL
+            && line[HASH_HEX_LEN] == ' '
+            && sscanf(line + HASH_HEX_LEN + 1, "%lu %ld %ld",
+                      &ino, &size, &mtime) == 3
+            && ino == (unsigned long) st.st_ino
+            && size == (long) st.st_size && mtime == (long) st.st_mtime) {
+            memcpy(digest, line, HASH_HEX_LEN);
+            digest[HASH_HEX_LEN] = '\0';
+            fclose(f);
+            goto out;
+        }
+        fclose(f);
+    }
+
+    if (hash_file_hex(path, digest) != 0) {
+        rs_log_error("failed to read %s", fname);
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+    if (asprintf(&tmp, "%s.%d.tmp", memo, (int) getpid()) == -1) {
+        tmp = NULL;
+        goto out;
+    }
+    if ((f = fopen(tmp, "w")) != NULL) {
+        fprintf(f, "%s %lu %ld %ld\n", digest, (unsigned long) st.st_ino,
+                (long) st.st_size, (long) st.st_mtime);
+        if (fclose(f) != 0 || rename(tmp, memo) == -1)
+            unlink(tmp);
+    }
+
+  out:
+    free(path);
+    free(memo);
+    free(tmp);
+    return ret;
+}
+
+
+/**
+ * Make sure the file @p fname is on the net fs, under the hash of its
+ * content in the dir @p kind there, with extension @p exten, and return
+ * the hash in @p digest, which must have space for HASH_HEX_LEN + 1
+ * chars.
+ **/
+int store_put(const char *fname, const char *kind, const char *exten,
+              char *digest)
+{
+    char *dir, *mark = NULL, *fs_name = NULL;
+    struct stat st;
+    int fd;
+    int ret;
+
+    if ((ret = get_store_dir(&dir))
+        || (ret = store_digest(dir, fname, digest)))
+        return ret;
+    if (asprintf(&mark, "%s/%s%s", dir, digest, exten) == -1
+        || (fs_name = store_fs_name(kind, digest, exten)) == NULL) {
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+    if (stat(mark, &st) == 0 && time(NULL) - st.st_mtime < STORE_MARK_KEEP) {
+        rs_trace("%s is on net fs as %s", fname, fs_name);
+        goto out;
+    }
+
+    rs_log_info("put %s to net fs as %s", fname, fs_name);
+    if (share_file_fs((char *) fname, fs_name) != 0) {
+        rs_log_error("put %s to net fs failed", fname);
+        ret = EXIT_PUT_CPP_FS_FAILED;
+        goto out;
+    }
+    if ((fd = open(mark, O_WRONLY|O_CREAT, 0666)) != -1)
+        close(fd);
+    utime(mark, NULL);
+
+  out:
+    free(mark);
+    free(fs_name);
+    return ret;
+}
+
+
+/**
+ * On the mapper: get the file with content @p digest from the dir
+ * @p kind on the net fs, through the node cache, into a file of its own
+ * whose name is returned in @p fname_ret.
+ **/
+int store_get(const char *digest, const char *kind, const char *exten,
+              char **fname_ret)
+{
+    char got[HASH_HEX_LEN + 1];
+    char *fs_name, *fname;
+    int ret;
+
+    if ((fs_name = store_fs_name(kind, digest, exten)) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    if ((ret = make_tmpnam("mrcc_store", exten, &fname))) {
+        free(fs_name);
+        return ret;
+    }
+    ret = map_cache_get_file(digest, fs_name, fname, NULL);
+    /* it may have been caught half put */
+    if (ret != 0 || hash_file_hex(fname, got) != 0
+        || !str_equal(got, digest)) {
+        rs_log_error("get %s from net fs failed", fs_name);
+        map_cache_drop(digest);
+        free(fs_name);
+        free(fname);
+        return EXIT_GET_CPP_FS_FAILED;
+    }
+    free(fs_name);
+    *fname_ret = fname;
+    return 0;
+}
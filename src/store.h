@@ -0,0 +1,12 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_STORE_H
+# define _HEADER_STORE_H
+
+int store_put(const char *fname, const char *kind, const char *exten,
+              char *digest);
+int store_get(const char *digest, const char *kind, const char *exten,
+              char **fname_ret);
+
+#endif //_HEADER_STORE_H
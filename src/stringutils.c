@@ -45,6 +45,94 @@ int str_endswith(const char *tail, const char *tiger)
 }
 
 
+/*
+ * Whether s can go into a command for system() or popen() as it is:
+ * those run it through the shell, and nothing here quotes it.
+ */
+int str_shell_safe(const char *s)
+{
+    return strpbrk(s, " \t\n\"'\\$`;&|<>()*?[]#~") == NULL;
+}
+
+
+static const char base64_chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/*
+ * base64 encode len bytes of buf into a new '\0' terminated string
+ * return NULL if out of memory
+ */
+char *base64_encode(const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    char *out, *q;
+    unsigned long v;
+    size_t i;
+
+    if ((out = malloc((len + 2) / 3 * 4 + 1)) == NULL)
+        return NULL;
+    for (i = 0, q = out; i < len; i += 3) {
+        v = (unsigned long) p[i] << 16;
+        if (i + 1 < len)
+            v |= (unsigned long) p[i + 1] << 8;
+        if (i + 2 < len)
+            v |= p[i + 2];
+        *q++ = base64_chars[(v >> 18) & 63];
+        *q++ = base64_chars[(v >> 12) & 63];
+        *q++ = i + 1 < len ? base64_chars[(v >> 6) & 63] : '=';
+        *q++ = i + 2 < len ? base64_chars[v & 63] : '=';
+    }
+    *q = '\0';
+    return out;
+}
+
+
+static int base64_value(char c)
+{
+    const char *p;
+
+    if (c == '\0' || (p = strchr(base64_chars, c)) == NULL)
+        return -1;
+    return p - base64_chars;
+}
+
+/*
+ * decode slen chars of base64 from s into out, which must have space
+ * for slen / 4 * 3 bytes; the decoded length goes to out_len
+ * return -1 if s is not base64
+ */
+int base64_decode(const char *s, size_t slen, void *out, size_t *out_len)
+{
+    unsigned char *q = out;
+    unsigned long v;
+    int c, j;
+    size_t i;
+
+    if (slen % 4 != 0)
+        return -1;
+    for (i = 0; i < slen; i += 4) {
+        v = 0;
+        for (j = 0; j < 4; j++) {
+            /* padding only at the end: xx== or xxx= */
+            if (s[i + j] == '=' && i + 4 == slen
+                && (j == 3 || (j == 2 && s[i + 3] == '='))) {
+                c = 0;
+            } else if ((c = base64_value(s[i + j])) == -1) {
+                return -1;
+            }
+            v = (v << 6) | c;
+        }
+        *q++ = (v >> 16) & 0xff;
+        if (s[i + 2] != '=')
+            *q++ = (v >> 8) & 0xff;
+        if (s[i + 3] != '=')
+            *q++ = v & 0xff;
+    }
+    *out_len = q - (unsigned char *) out;
+    return 0;
+}
+
+
 
 
 
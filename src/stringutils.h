@@ -10,6 +10,11 @@ int str_startswith(const char *head, const char *worm);
 
 int str_endswith(const char *tail, const char *tiger);
 
+int str_shell_safe(const char *s);
+
+char *base64_encode(const void *buf, size_t len);
+int base64_decode(const char *s, size_t slen, void *out, size_t *out_len);
+
 #define HAVE_VA_COPY 1
 
 #ifdef HAVE_VA_COPY
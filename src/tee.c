@@ -0,0 +1,244 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "io.h"
+#include "exec.h"
+#include "hash.h"
+#include "basedir.h"
+#include "tee.h"
+
+/**
+ * @file
+ *
+ * The output of cpp, hashed as it is written.
+ *
+ * Naming the .i by its content (see hash.c) took a second read of it
+ * once cpp was done, on the critical path of every remote compile.
+ * tee_spawn_cpp() has cpp write into a pipe instead, and a tee process
+ * between the two writes the .i and hashes it on the way, rewriting the
+ * line markers below MRCC_BASE_DIR as it goes (see basedir.c).  When
+ * cpp is done it hands the digest to the master through a pipe of its
+ * own, so tee_digest() has it the moment cpp exits.
+ *
+ * The tee stands in for cpp: its pid is the one that is waited for, and
+ * it exits as cpp did.  A .i that could not be written fails like cpp
+ * would have.  The tee is off unless MRCC_CPP_TEE=1, since it costs a
+ * process and a pipe per compile and has not been measured against the
+ * second read yet; without it the .i is read again after cpp.
+ **/
+
+/* the read end of the digest pipe of the running tee, and its .i */
+static int tee_fd = -1;
+static char *tee_fname = NULL;
+
+
+/**
+ * Whether the output of cpp goes through the tee.
+ **/
+int tee_enabled(void)
+{
+    return getenv_bool("MRCC_CPP_TEE", 0);
+}
+
+
+/*
+ * Inside the tee: run cpp on @p cpp_argv, and copy its output to
+ * @p cpp_fname, rewritten for the compile @p argv and hashed.  The
+ * digest goes to @p result_fd if all went well.  Never returns.
+ */
+static void tee_run(char **cpp_argv, char **argv, const char *cpp_fname,
+                    int result_fd)
+{
+    struct base_map m;
+    struct hash_state hs;
+    char digest[HASH_HEX_LEN + 1];
+    char *line = NULL, *marker;
+    size_t line_size = 0;
+    ssize_t len;
+    int data[2], saved, status, normalize;
+    int ok = 1;
+    pid_t cpp_pid;
+    FILE *in, *out;
+
+    /* the master cleans up after us */
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+
+    /* cpp gets the write end as its stdout, and we keep none of it, so
+     * that its exit is the end of the data */
+    if (pipe(data) == -1) {
+        rs_log_error("pipe failed: %s", strerror(errno));
+        _exit(EXIT_IO_ERROR);
+    }
+    fcntl(data[0], F_SETFD, FD_CLOEXEC);
+    fcntl(result_fd, F_SETFD, FD_CLOEXEC);
+    /* cpp has no business with our stdout either */
+    if ((saved = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0)) == -1
+        || dup2(data[1], STDOUT_FILENO) == -1)
+        _exit(EXIT_IO_ERROR);
+    close(data[1]);
+    if (spawn_child(cpp_argv, &cpp_pid, "/dev/null", NULL, NULL) != 0)
+        _exit(EXIT_MRCC_FAILED);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+
+    if ((in = fdopen(data[0], "r")) == NULL)
+        _exit(EXIT_OUT_OF_MEMORY);
+    if ((out = fopen(cpp_fname, "w")) == NULL) {
+        rs_log_error("failed to create %s: %s", cpp_fname, strerror(errno));
+        ok = 0;
+    }
+    normalize = base_map_for(argv, &m);
+    hash_init(&hs);
+
+    /* all of it, even if it cannot be written, or cpp gets SIGPIPE */
+    while ((len = getline(&line, &line_size, in)) != -1) {
+        if (!ok)
+            continue;
+        if (normalize && line[0] == '#' && strlen(line) == (size_t) len
+            && (marker = base_marker(&m, line)) != NULL) {
+            fputs(marker, out);
+            hash_update(&hs, marker, strlen(marker));
+            free(marker);
+        } else {
+            fwrite(line, 1, len, out);
+            hash_update(&hs, line, len);
+        }
+    }
+    fclose(in);
+    if (out != NULL && fclose(out) != 0) {
+        rs_log_error("failed to write %s", cpp_fname);
+        ok = 0;
+    }
+
+    while (waitpid(cpp_pid, &status, 0) == -1) {
+        if (errno != EINTR)
+            _exit(EXIT_MRCC_FAILED);
+    }
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        if (!ok)
+            _exit(EXIT_IO_ERROR);
+        hash_final_hex(&hs, digest);
+        rs_trace("%s is %s", cpp_fname, digest);
+        writex(result_fd, digest, HASH_HEX_LEN);
+        _exit(0);
+    }
+    if (WIFSIGNALED(status)) {
+        signal(WTERMSIG(status), SIG_DFL);
+        kill(getpid(), WTERMSIG(status));
+    }
+    _exit(WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_MRCC_FAILED);
+}
+
+
+/**
+ * Start cpp on @p cpp_argv, with its output going to @p cpp_fname
+ * through the tee, for the compile @p argv.  The pid returned in
+ * @p pid_ret is that of the tee, which exits as cpp did.
+ **/
+int tee_spawn_cpp(char **cpp_argv, char **argv, const char *cpp_fname,
+                  pid_t *pid_ret)
+{
+    int result[2];
+    pid_t pid;
+
+    if (pipe(result) == -1) {
+        rs_log_error("pipe failed: %s", strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    /* the compilers started later have no business with it */
+    fcntl(result[0], F_SETFD, FD_CLOEXEC);
+
+    pid = fork();
+    if (pid == -1) {
+        rs_log_error("failed to fork: %s", strerror(errno));
+        close(result[0]);
+        close(result[1]);
+        return EXIT_OUT_OF_MEMORY;
+    } else if (pid == 0) {
+        close(result[0]);
+        tee_run(cpp_argv, argv, cpp_fname, result[1]);
+    }
+
+    close(result[1]);
+    tee_close();
+    tee_fd = result[0];
+    tee_fname = strdup(cpp_fname);
+    *pid_ret = pid;
+    rs_trace("cpp writes %s through tee pid%d", cpp_fname, (int) pid);
+    return 0;
+}
+
+
+/**
+ * The digest of @p cpp_fname, as its tee found it, into @p digest, which
+ * must have space for HASH_HEX_LEN + 1 chars.  Call it once the tee has
+ * exited successfully.  Returns nonzero if the .i did not go through the
+ * tee, in which case it has to be hashed, and its line markers
+ * rewritten, the slow way.
+ **/
+int tee_digest(const char *cpp_fname, char *digest)
+{
+    size_t got = 0;
+    ssize_t n;
+
+    if (tee_fd == -1 || tee_fname == NULL || !str_equal(tee_fname, cpp_fname))
+        return EXIT_GONE;
+    while (got < HASH_HEX_LEN
+           && (n = read(tee_fd, digest + got, HASH_HEX_LEN - got)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        got += n;
+    }
+    tee_close();
+    if (got != HASH_HEX_LEN)
+        return EXIT_GONE;
+    digest[HASH_HEX_LEN] = '\0';
+    return 0;
+}
+
+
+/**
+ * Drop the digest pipe of the last tee, if any.  Call it once the tee
+ * has been waited for, whether or not cpp succeeded; tee_digest() does
+ * so itself.
+ **/
+void tee_close(void)
+{
+    if (tee_fd != -1)
+        close(tee_fd);
+    tee_fd = -1;
+    free(tee_fname);
+    tee_fname = NULL;
+}
@@ -0,0 +1,13 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_TEE_H
+# define _HEADER_TEE_H
+
+int tee_enabled(void);
+int tee_spawn_cpp(char **cpp_argv, char **argv, const char *cpp_fname,
+                  pid_t *pid_ret);
+int tee_digest(const char *cpp_fname, char *digest);
+void tee_close(void);
+
+#endif //_HEADER_TEE_H
@@ -238,3 +238,104 @@ int get_state_dir(char **dir_ret)
 }
 
 
+
+int get_batch_dir(char **dir_ret)
+{
+    static char *cached;
+    int ret;
+
+    if (cached) {
+        *dir_ret = cached;
+        return 0;
+    } else {
+        ret = get_subdir("batch", dir_ret);
+        if (ret == 0)
+            cached = *dir_ret;
+        return ret;
+    }
+}
+
+
+int get_resdb_dir(char **dir_ret)
+{
+    static char *cached;
+    int ret;
+
+    if (cached) {
+        *dir_ret = cached;
+        return 0;
+    } else {
+        ret = get_subdir("resdb", dir_ret);
+        if (ret == 0)
+            cached = *dir_ret;
+        return ret;
+    }
+}
+
+
+int get_coalesce_dir(char **dir_ret)
+{
+    static char *cached;
+    int ret;
+
+    if (cached) {
+        *dir_ret = cached;
+        return 0;
+    } else {
+        ret = get_subdir("coalesce", dir_ret);
+        if (ret == 0)
+            cached = *dir_ret;
+        return ret;
+    }
+}
+
+
+int get_native_dir(char **dir_ret)
+{
+    static char *cached;
+    int ret;
+
+    if (cached) {
+        *dir_ret = cached;
+        return 0;
+    } else {
+        ret = get_subdir("native", dir_ret);
+        if (ret == 0)
+            cached = *dir_ret;
+        return ret;
+    }
+}
+
+
+int get_store_dir(char **dir_ret)
+{
+    static char *cached;
+    int ret;
+
+    if (cached) {
+        *dir_ret = cached;
+        return 0;
+    } else {
+        ret = get_subdir("store", dir_ret);
+        if (ret == 0)
+            cached = *dir_ret;
+        return ret;
+    }
+}
+
+
+int get_toolchain_dir(char **dir_ret)
+{
+    static char *cached;
+    int ret;
+
+    if (cached) {
+        *dir_ret = cached;
+        return 0;
+    } else {
+        ret = get_subdir("toolchain", dir_ret);
+        if (ret == 0)
+            cached = *dir_ret;
+        return ret;
+    }
+}
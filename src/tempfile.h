@@ -21,4 +21,22 @@ int get_lock_dir(char **dir_ret);
 int get_state_dir(char **dir_ret);
 
 
+int get_batch_dir(char **dir_ret);
+
+
+int get_resdb_dir(char **dir_ret);
+
+
+int get_coalesce_dir(char **dir_ret);
+
+
+int get_native_dir(char **dir_ret);
+
+
+int get_store_dir(char **dir_ret);
+
+
+int get_toolchain_dir(char **dir_ret);
+
+
 #endif //_HEADER_TEMP_FILE_H
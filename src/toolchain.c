@@ -0,0 +1,738 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <utime.h>
+#include <limits.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "files.h"
+#include "args.h"
+#include "tempfile.h"
+#include "cleanup.h"
+#include "io.h"
+#include "lock.h"
+#include "netfsutils.h"
+#include "mapcache.h"
+#include "pack.h"
+#include "hash.h"
+#include "toolchain.h"
+
+/**
+ * @file
+ *
+ * The master's compiler on the nodes, so that every node compiles with
+ * exactly the compiler the master would have used, not with whatever is
+ * on its PATH.
+ *
+ * With MRCC_TOOLCHAIN=1, tc_ship() fingerprints the GCC driver of a
+ * compile: the hash of its -v output and of the names and content of
+ * the files it runs.  Those are the driver, cc1, cc1plus, cc1obj and as
+ * where it finds them, and the shared libraries they need, but not the
+ * C library itself, which the nodes are expected to have.  The files are
+ * packed (see pack.c) as bin/cc, libexec/PROGRAM and lib/SONAME, and the
+ * pack is put to the net fs once, as mrcc/toolchain/FINGERPRINT.pack.
+ * The fingerprint goes to the mapper with the unit.
+ *
+ * Fingerprinting reads all of the files, so the result is kept in the
+ * toolchain dir of the master, under the hash of the path, inode, size
+ * and mtime of the driver, along with the inode, size and mtime of the
+ * other files; it holds as long as none of them changes.  After
+ * TC_MARK_KEEP seconds the net fs is asked again for the pack.
+ *
+ * The mapper unpacks the pack once per node, into toolchain/FINGERPRINT
+ * in the node cache dir (see mapcache.c), and tc_localize() has the
+ * command run the driver from there, with -B pointing it at its
+ * programs and LD_LIBRARY_PATH at its libraries.  Nothing removes old
+ * toolchains there, nor the packs on the net fs; remove mrcc/toolchain
+ * there along with the toolchain dir of the master to reclaim them.
+ *
+ * Other compilers than GCC, clang among them, and the commands of
+ * bundles (see bundle.c) run with what the nodes have.  A compile whose
+ * toolchain cannot be shipped is run locally.
+ **/
+
+#define TC_MARK_KEEP        3600
+
+/* what the driver runs, which goes to libexec in the pack */
+static const char *const tc_progs[] = {
+    "cc1", "cc1plus", "cc1obj", "as", NULL
+};
+
+/* the C library, which the nodes have */
+static const char *const tc_system_libs[] = {
+    "linux-vdso.so", "linux-gate.so", "ld-linux", "libc.so", "libm.so",
+    "libpthread.so", "libdl.so", "librt.so", NULL
+};
+
+struct tc_file {
+    char *path;
+    char *name;         /* in the pack */
+    struct stat st;
+};
+
+struct toolchain {
+    struct tc_file *files;
+    int n;
+};
+
+
+/*
+ * the name of the pack of toolchain @p fp on the net fs
+ */
+static char *tc_fs_name(const char *fp)
+{
+    char *fs_name;
+
+    if (asprintf(&fs_name, "%s/toolchain/%s.pack", fs_top_dir, fp) == -1)
+        return NULL;
+    return fs_name;
+}
+
+
+/*
+ * run @p cmd and return what it writes to stdout in @p out_ret
+ */
+static int tc_run(const char *cmd, char **out_ret)
+{
+    char buf[4096];
+    size_t n, len = 0;
+    FILE *fp, *out;
+
+    rs_trace("run \"%s\"", cmd);
+    if ((fp = popen(cmd, "r")) == NULL) {
+        rs_log_error("failed to run \"%s\": %s", cmd, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    if ((out = open_memstream(out_ret, &len)) == NULL) {
+        pclose(fp);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    while ((n = fread(buf, 1, sizeof buf, fp)) > 0)
+        fwrite(buf, 1, n, out);
+    fclose(out);
+    if (pclose(fp) != 0) {
+        rs_log_warning("\"%s\" failed", cmd);
+        free(*out_ret);
+        return EXIT_MRCC_FAILED;
+    }
+    return 0;
+}
+
+
+/*
+ * add the file @p path to @p tc, as @p dir/@p name in the pack, unless
+ * that name is taken already
+ */
+static int tc_add(struct toolchain *tc, const char *path, const char *dir,
+                  const char *name)
+{
+    struct tc_file *more, *f;
+    char *pack_name;
+    int i;
+
+    if (asprintf(&pack_name, "%s/%s", dir, name) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    for (i = 0; i < tc->n; i++) {
+        if (str_equal(tc->files[i].name, pack_name)) {
+            free(pack_name);
+            return 0;
+        }
+    }
+    if ((more = realloc(tc->files, (tc->n + 1) * sizeof *more)) == NULL) {
+        free(pack_name);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    tc->files = more;
+    f = &tc->files[tc->n];
+    if (stat(path, &f->st) == -1) {
+        rs_log_error("failed to stat %s: %s", path, strerror(errno));
+        free(pack_name);
+        return EXIT_NO_SUCH_FILE;
+    }
+    if ((f->path = strdup(path)) == NULL) {
+        free(pack_name);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    f->name = pack_name;
+    tc->n++;
+    rs_trace("toolchain file %s is %s", pack_name, path);
+    return 0;
+}
+
+
+static void tc_free(struct toolchain *tc)
+{
+    int i;
+
+    for (i = 0; i < tc->n; i++) {
+        free(tc->files[i].path);
+        free(tc->files[i].name);
+    }
+    free(tc->files);
+    tc->files = NULL;
+    tc->n = 0;
+}
+
+
+/*
+ * add the shared libraries that @p path needs to @p tc, as ldd finds
+ * them in lines like
+ *     libz.so.1 => /lib/x86_64-linux-gnu/libz.so.1 (0x00007f...)
+ */
+static int tc_add_libs(struct toolchain *tc, const char *path)
+{
+    char *cmd, *out, *line, *nl, *arrow, *lib, *end;
+    int ret, i;
+
+    if (asprintf(&cmd, "ldd %s 2>/dev/null", path) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    ret = tc_run(cmd, &out);
+    free(cmd);
+    /* not a dynamic executable */
+    if (ret != 0)
+        return 0;
+
+    for (line = out; ret == 0 && *line; line = nl + 1) {
+        if ((nl = strchr(line, '\n')) == NULL)
+            break;
+        *nl = '\0';
+        while (isspace((unsigned char) *line))
+            line++;
+        if ((arrow = strstr(line, " => /")) == NULL)
+            continue;
+        *arrow = '\0';
+        lib = arrow + 4;
+        if ((end = strchr(lib, ' ')) != NULL)
+            *end = '\0';
+        for (i = 0; tc_system_libs[i]; i++) {
+            if (str_startswith(tc_system_libs[i], line))
+                break;
+        }
+        if (tc_system_libs[i] == NULL)
+            ret = tc_add(tc, lib, "lib", line);
+    }
+    free(out);
+    return ret;
+}
+
+
+/*
+ * find the files of the toolchain of the driver @p driver
+ */
+static int tc_collect(const char *driver, struct toolchain *tc)
+{
+    char *cmd, *path, *nl;
+    struct stat st;
+    int n_progs, i;
+    int ret;
+
+    if ((ret = tc_add(tc, driver, "bin", "cc")))
+        return ret;
+    for (i = 0; tc_progs[i]; i++) {
+        if (asprintf(&cmd, "%s -print-prog-name=%s", driver,
+                     tc_progs[i]) == -1)
+            return EXIT_OUT_OF_MEMORY;
+        ret = tc_run(cmd, &path);
+        free(cmd);
+        if (ret)
+            return ret;
+        if ((nl = strchr(path, '\n')) != NULL)
+            *nl = '\0';
+        /* a bare name is what it would run from the PATH */
+        if (strchr(path, '/') == NULL) {
+            free(path);
+            if (find_in_path(tc_progs[i], &path, &st) != 0)
+                continue;
+        }
+        if (access(path, X_OK) == 0)
+            ret = tc_add(tc, path, "libexec", tc_progs[i]);
+        free(path);
+        if (ret)
+            return ret;
+    }
+
+    n_progs = tc->n;
+    for (i = 0; i < n_progs; i++) {
+        if ((ret = tc_add_libs(tc, tc->files[i].path)))
+            return ret;
+    }
+    return 0;
+}
+
+
+/*
+ * the fingerprint of the toolchain @p tc of the driver @p driver
+ */
+static int tc_fingerprint(const char *driver, struct toolchain *tc,
+                          char *fp)
+{
+    struct hash_state hs;
+    char digest[HASH_HEX_LEN + 1];
+    char *cmd, *version;
+    int i;
+    int ret;
+
+    if (asprintf(&cmd, "%s -v 2>&1", driver) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    ret = tc_run(cmd, &version);
+    free(cmd);
+    if (ret)
+        return ret;
+
+    hash_init(&hs);
+    hash_update(&hs, version, strlen(version) + 1);
+    free(version);
+    for (i = 0; i < tc->n; i++) {
+        if (hash_file_hex(tc->files[i].path, digest) != 0) {
+            rs_log_error("failed to read %s", tc->files[i].path);
+            return EXIT_IO_ERROR;
+        }
+        hash_update(&hs, tc->files[i].name, strlen(tc->files[i].name) + 1);
+        hash_update(&hs, digest, sizeof digest);
+    }
+    hash_final_hex(&hs, fp);
+    return 0;
+}
+
+
+/*
+ * Read the fingerprint in @p memo into @p fp.  It is valid if none of
+ * the files listed in it changed since; @p fresh is set if it is no
+ * older than TC_MARK_KEEP.
+ *
+ * The memo is the fingerprint on the first line, and then a line
+ *     INODE SIZE MTIME PATH
+ * for every file of the toolchain.
+ */
+static int tc_read_memo(const char *memo, char *fp, int *fresh)
+{
+    char *line = NULL, *nl;
+    size_t line_size = 0;
+    unsigned long ino;
+    long size, mtime;
+    struct stat st;
+    int pos, ok;
+    FILE *f;
+
+    if ((f = fopen(memo, "r")) == NULL)
+        return EXIT_NO_SUCH_FILE;
+    ok = fstat(fileno(f), &st) == 0
+        && getline(&line, &line_size, f) == HASH_HEX_LEN + 1;
+    if (ok) {
+        *fresh = time(NULL) - st.st_mtime < TC_MARK_KEEP;
+        memcpy(fp, line, HASH_HEX_LEN);
+        fp[HASH_HEX_LEN] = '\0';
+    }
+    while (ok && getline(&line, &line_size, f) != -1) {
+        if ((nl = strchr(line, '\n')) != NULL)
+            *nl = '\0';
+        ok = sscanf(line, "%lu %ld %ld %n", &ino, &size, &mtime, &pos) == 3
+            && stat(line + pos, &st) == 0 && st.st_ino == ino
+            && st.st_size == size && st.st_mtime == mtime;
+    }
+    free(line);
+    fclose(f);
+    if (!ok) {
+        fp[0] = '\0';
+        return EXIT_GONE;
+    }
+    return 0;
+}
+
+
+static void tc_write_memo(const char *memo, const char *fp,
+                          struct toolchain *tc)
+{
+    char *tmp;
+    FILE *f;
+    int i;
+
+    if (asprintf(&tmp, "%s.%d.tmp", memo, (int) getpid()) == -1)
+        return;
+    if ((f = fopen(tmp, "w")) == NULL) {
+        free(tmp);
+        return;
+    }
+    fprintf(f, "%s\n", fp);
+    for (i = 0; i < tc->n; i++) {
+        fprintf(f, "%lu %ld %ld %s\n", (unsigned long) tc->files[i].st.st_ino,
+                (long) tc->files[i].st.st_size,
+                (long) tc->files[i].st.st_mtime, tc->files[i].path);
+    }
+    if (fclose(f) != 0 || rename(tmp, memo) == -1)
+        unlink(tmp);
+    free(tmp);
+}
+
+
+/*
+ * make sure the pack of the toolchain @p tc is on the net fs
+ */
+static int tc_put(const char *fp, struct toolchain *tc)
+{
+    struct pack_writer w;
+    char *fs_name, *pack_fname;
+    long off, len;
+    int i;
+    int ret = 0;
+
+    if ((fs_name = tc_fs_name(fp)) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    if (test_file_fs(fs_name) == 0)
+        goto out;
+
+    if ((ret = make_tmpnam("mrcc_tc", ".pack", &pack_fname)))
+        goto out;
+    if ((ret = pack_create(pack_fname, &w)) == 0) {
+        for (i = 0; ret == 0 && i < tc->n; i++)
+            ret = pack_add_file(&w, tc->files[i].name, tc->files[i].path,
+                                &off, &len);
+        if (pack_finish(&w) != 0 && ret == 0)
+            ret = EXIT_IO_ERROR;
+    }
+    if (ret == 0) {
+        rs_log_info("put toolchain of %d files to net fs as %s",
+                    tc->n, fs_name);
+        if (share_file_fs(pack_fname, fs_name) != 0) {
+            rs_log_error("put %s to net fs failed", fs_name);
+            ret = EXIT_PUT_CPP_FS_FAILED;
+        }
+    }
+    unlink(pack_fname);
+    free(pack_fname);
+
+  out:
+    free(fs_name);
+    return ret;
+}
+
+
+/**
+ * Find the compiler driver @p cc the way execvp() would, and return its
+ * real path in @p driver_ret, which the caller must free, and in @p key,
+ * which must have space for HASH_HEX_LEN + 1 chars, a hash of that path
+ * and of the inode, size and mtime of the driver.  The key changes when
+ * the compiler is replaced, and differs between compilers of the same
+ * name.  Used for coalescing too, see coalesce.c.
+ **/
+int tc_driver(const char *cc, char **driver_ret, char *key)
+{
+    struct hash_state hs;
+    struct stat st;
+    char *path, *driver;
+    int ret;
+
+    if ((ret = find_in_path(cc, &path, &st)))
+        return ret;
+    driver = realpath(path, NULL);
+    free(path);
+    if (driver == NULL || stat(driver, &st) == -1) {
+        rs_log_error("cannot find the compiler %s", cc);
+        free(driver);
+        return EXIT_COMPILER_MISSING;
+    }
+
+    hash_init(&hs);
+    hash_update(&hs, driver, strlen(driver) + 1);
+    hash_update(&hs, &st.st_dev, sizeof st.st_dev);
+    hash_update(&hs, &st.st_ino, sizeof st.st_ino);
+    hash_update(&hs, &st.st_size, sizeof st.st_size);
+    hash_update(&hs, &st.st_mtime, sizeof st.st_mtime);
+    hash_final_hex(&hs, key);
+    *driver_ret = driver;
+    return 0;
+}
+
+
+/**
+ * If the compile @p argv is to run with the master's toolchain on the
+ * nodes, make sure the toolchain is on the net fs, and return its
+ * fingerprint in @p fp, which must have space for HASH_HEX_LEN + 1
+ * chars.  Otherwise @p fp is set to "".
+ **/
+int tc_ship(char **argv, char *fp)
+{
+    struct toolchain tc = { NULL, 0 };
+    char key[HASH_HEX_LEN + 1];
+    char *driver, *dir, *fs_name;
+    char *memo = NULL, *lock = NULL;
+    int fresh, lock_fd = -1;
+    int ret;
+
+    fp[0] = '\0';
+    if (!getenv_bool("MRCC_TOOLCHAIN", 0) || !cc_is_gcc(argv[0], 0))
+        return 0;
+    if ((ret = tc_driver(argv[0], &driver, key)))
+        return ret;
+    /* "cc" may well be clang */
+    if (!cc_is_gcc(driver, 1) || !str_shell_safe(driver)) {
+        free(driver);
+        return 0;
+    }
+
+    if ((ret = get_toolchain_dir(&dir)))
+        goto out;
+    if (asprintf(&memo, "%s/%s", dir, key) == -1
+        || asprintf(&lock, "%s/%s.lock", dir, key) == -1) {
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+    if (tc_read_memo(memo, fp, &fresh) == 0 && fresh)
+        goto out;
+
+    /* one process packs it, the others wait for it */
+    if ((ret = mrcc_lock_file(lock, 1, &lock_fd)))
+        goto out;
+    if (tc_read_memo(memo, fp, &fresh) == 0) {
+        if (fresh)
+            goto out;
+        if ((fs_name = tc_fs_name(fp)) == NULL) {
+            ret = EXIT_OUT_OF_MEMORY;
+            goto out;
+        }
+        ret = test_file_fs(fs_name);
+        free(fs_name);
+        if (ret == 0) {
+            utime(memo, NULL);
+            goto out;
+        }
+        ret = 0;
+    }
+
+    rs_log_info("fingerprinting the toolchain of %s", driver);
+    if ((ret = tc_collect(driver, &tc))
+        || (ret = tc_fingerprint(driver, &tc, fp))
+        || (ret = tc_put(fp, &tc)))
+        goto out;
+    tc_write_memo(memo, fp, &tc);
+
+  out:
+    if (ret != 0)
+        fp[0] = '\0';
+    else if (fp[0])
+        rs_trace("toolchain of %s is %s", driver, fp);
+    if (lock_fd != -1)
+        mrcc_unlock(lock_fd);
+    tc_free(&tc);
+    free(memo);
+    free(lock);
+    free(driver);
+    return ret;
+}
+
+
+/*
+ * whether @p name is one the pack of a toolchain may have
+ */
+static int tc_name_ok(const char *name)
+{
+    const char *slash = strchr(name, '/');
+
+    if (slash == NULL || strchr(slash + 1, '/') || slash[1] == '\0'
+        || slash[1] == '.')
+        return 0;
+    return str_startswith("bin/", name) || str_startswith("libexec/", name)
+        || str_startswith("lib/", name);
+}
+
+
+struct tc_extract {
+    const char *pack_fname;
+    const char *dir;
+};
+
+/* pack_foreach() callback: extract one file of the toolchain */
+static int tc_extract_member(int fd, const char *name, long off, long len,
+                             void *arg)
+{
+    struct tc_extract *x = arg;
+    char *dst;
+    int ret;
+
+    if (!tc_name_ok(name)) {
+        rs_log_error("bad name \"%s\" in %s", name, x->pack_fname);
+        return EXIT_PROTOCOL_ERROR;
+    }
+    if (asprintf(&dst, "%s/%s", x->dir, name) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    if ((ret = add_cleanup(dst)) == 0
+        && (ret = pack_extract(fd, off, len, dst)) == 0
+        && chmod(dst, 0755) == -1)
+        ret = EXIT_IO_ERROR;
+    free(dst);
+    return ret;
+}
+
+/*
+ * extract the pack @p pack_fname into the new directory @p dir
+ */
+static int tc_extract(const char *pack_fname, const char *dir)
+{
+    static const char *const subdirs[] = { "bin", "libexec", "lib", NULL };
+    struct tc_extract x;
+    char *dst;
+    int fd, i;
+    int ret = 0;
+
+    if (mkdir(dir, 0777) == -1 || (ret = add_cleanup(dir))) {
+        rs_log_error("failed to create %s: %s", dir, strerror(errno));
+        return ret ? ret : EXIT_IO_ERROR;
+    }
+    for (i = 0; subdirs[i]; i++) {
+        if (asprintf(&dst, "%s/%s", dir, subdirs[i]) == -1)
+            return EXIT_OUT_OF_MEMORY;
+        if (mkdir(dst, 0777) == -1) {
+            rs_log_error("failed to create %s: %s", dst, strerror(errno));
+            free(dst);
+            return EXIT_IO_ERROR;
+        }
+        ret = add_cleanup(dst);
+        free(dst);
+        if (ret)
+            return ret;
+    }
+
+    if ((fd = open(pack_fname, O_RDONLY|O_BINARY)) == -1) {
+        rs_log_error("failed to open %s: %s", pack_fname, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    x.pack_fname = pack_fname;
+    x.dir = dir;
+    ret = pack_foreach(fd, tc_extract_member, &x);
+    close(fd);
+    return ret;
+}
+
+
+/*
+ * get the toolchain @p fp into the node cache, unless it is there
+ * already, and return its directory in @p dir_ret
+ */
+static int tc_unpack(const char *fp, char **dir_ret)
+{
+    char *cache, *top = NULL, *dir = NULL, *lock = NULL;
+    char *tmp_dir = NULL, *fs_name = NULL, *pack_fname = NULL;
+    struct stat st;
+    int lock_fd = -1;
+    int ret;
+
+    if ((ret = map_cache_dir(&cache)))
+        return ret;
+    if (asprintf(&top, "%s/toolchain", cache) == -1
+        || asprintf(&dir, "%s/%s", top, fp) == -1
+        || asprintf(&lock, "%s/%s.lock", top, fp) == -1
+        || asprintf(&tmp_dir, "%s/.%s.%ld", top, fp, (long) getpid()) == -1
+        || (fs_name = tc_fs_name(fp)) == NULL) {
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+    if (stat(dir, &st) == 0)
+        goto found;
+
+    if (mkdir(top, 0777) == -1 && errno != EEXIST) {
+        rs_log_error("failed to create %s: %s", top, strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+    /* the tasks of the node wait for the one that unpacks it */
+    if ((ret = mrcc_lock_file(lock, 1, &lock_fd)))
+        goto out;
+    if (stat(dir, &st) == 0)
+        goto found;
+
+    rs_log_info("get toolchain %s from net fs", fs_name);
+    if ((ret = make_tmpnam("mrcc_tc", ".pack", &pack_fname)))
+        goto out;
+    if (get_new_file_fs(fs_name, pack_fname) != 0) {
+        rs_log_error("get %s from net fs failed", fs_name);
+        ret = EXIT_GET_CPP_FS_FAILED;
+        goto out;
+    }
+    if ((ret = tc_extract(pack_fname, tmp_dir)))
+        goto out;
+    /* it is complete once it has its name */
+    if (rename(tmp_dir, dir) == -1) {
+        rs_log_error("rename %s to %s failed: %s",
+                     tmp_dir, dir, strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+
+  found:
+    /* the command may run in another dir */
+    if ((*dir_ret = realpath(dir, NULL)) == NULL)
+        ret = EXIT_OUT_OF_MEMORY;
+
+  out:
+    if (lock_fd != -1)
+        mrcc_unlock(lock_fd);
+    if (pack_fname)
+        unlink(pack_fname);
+    free(pack_fname);
+    free(top);
+    free(dir);
+    free(lock);
+    free(tmp_dir);
+    free(fs_name);
+    return ret;
+}
+
+
+/**
+ * On the mapper: get the toolchain with fingerprint @p fp, and return in
+ * @p cmd_ret the compiler command line @p cmd, as a string, changed to
+ * run with it.
+ **/
+int tc_localize(const char *fp, const char *cmd, char **cmd_ret)
+{
+    static char last_fp[HASH_HEX_LEN + 1];
+    static char *last_dir = NULL;
+    const char *args;
+    int ret;
+
+    if (last_dir == NULL || !str_equal(last_fp, fp)) {
+        free(last_dir);
+        last_dir = NULL;
+        if ((ret = tc_unpack(fp, &last_dir)))
+            return ret;
+        strncpy(last_fp, fp, HASH_HEX_LEN);
+        last_fp[HASH_HEX_LEN] = '\0';
+    }
+    if (!str_shell_safe(last_dir)) {
+        rs_log_error("cannot run a compiler in %s", last_dir);
+        return EXIT_MRCC_FAILED;
+    }
+
+    /* the compiler is the first word */
+    if ((args = strchr(cmd, ' ')) == NULL)
+        args = cmd + strlen(cmd);
+    if (asprintf(cmd_ret, "LD_LIBRARY_PATH=%s/lib %s/bin/cc -B%s/libexec/%s",
+                 last_dir, last_dir, last_dir, args) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    return 0;
+}
@@ -0,0 +1,11 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_TOOLCHAIN_H
+# define _HEADER_TOOLCHAIN_H
+
+int tc_driver(const char *cc, char **driver_ret, char *key);
+int tc_ship(char **argv, char *fp);
+int tc_localize(const char *fp, const char *cmd, char **cmd_ret);
+
+#endif //_HEADER_TOOLCHAIN_H
@@ -70,6 +70,26 @@ int getenv_bool(const char *name, int default_value)
 }
 
 
+/**
+ * Look up an integer environment option.  The default, if it's not set,
+ * is empty or is not a number, is @p default_value.
+ **/
+int getenv_int(const char *name, int default_value)
+{
+    const char *e;
+    char *end;
+    long v;
+
+    e = getenv(name);
+    if (!e || !*e)
+        return default_value;
+    v = strtol(e, &end, 10);
+    if (*end != '\0')
+        return default_value;
+    return (int) v;
+}
+
+
 /* Return the supplied path with the current-working directory prefixed (if
  * needed) and all "dir/.." references removed.  Supply path_len if you want
  * to use only a substring of the path string, otherwise make it 0. */
@@ -356,6 +376,38 @@ int ignore_sigpipe(int val)
 }
 
 
+/**
+ * Find the program @p name the way execvp() would, and return its path
+ * in @p path_ret and its status in @p st.
+ **/
+int find_in_path(const char *name, char **path_ret, struct stat *st)
+{
+    const char *path, *end;
+    char *fname;
+
+    if (strchr(name, '/')) {
+        if (stat(name, st) == -1)
+            return EXIT_NO_SUCH_FILE;
+        return (*path_ret = strdup(name)) ? 0 : EXIT_OUT_OF_MEMORY;
+    }
+
+    if ((path = getenv("PATH")) == NULL)
+        return EXIT_NO_SUCH_FILE;
+    for (; *path; path = *end ? end + 1 : end) {
+        if ((end = strchr(path, ':')) == NULL)
+            end = path + strlen(path);
+        if (asprintf(&fname, "%.*s/%s", (int) (end - path), path, name) == -1)
+            return EXIT_OUT_OF_MEMORY;
+        if (access(fname, X_OK) == 0 && stat(fname, st) == 0) {
+            *path_ret = fname;
+            return 0;
+        }
+        free(fname);
+    }
+    return EXIT_NO_SUCH_FILE;
+}
+
+
 /* Define as the return type of signal handlers (`int' or `void'). */
 #define RETSIGTYPE void
 
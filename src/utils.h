@@ -95,9 +95,13 @@ enum compress {
 int set_path(const char *newpath);
 
 int getenv_bool(const char *name, int default_value);
+int getenv_int(const char *name, int default_value);
 
 char *abspath(const char *path, int path_len);
 
+struct stat;
+int find_in_path(const char *name, char **path_ret, struct stat *st);
+
 void mrcc_exit(int exitcode);
 
 int timeval_subtract(struct timeval *result, struct timeval *x, struct timeval *y);
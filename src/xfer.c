@@ -0,0 +1,257 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdarg.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <assert.h>
+#include <fcntl.h>
+
+#include <sys/fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <signal.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "stringutils.h"
+#include "tempfile.h"
+#include "lock.h"
+#include "xfer.h"
+
+/**
+ * @file
+ *
+ * Scheduling of the net fs transfers of all mrcc processes on the
+ * master, so that a big -j does not saturate its uplink with uploads
+ * while make waits for downloads.
+ *
+ * A transfer first takes one of MRCC_XFER_SLOTS (default 8) slots.  A
+ * quarter of them are kept for downloads and small uploads, up to
+ * MRCC_XFER_SMALL KB (default 64); bulk uploads only get the others.
+ *
+ * Each direction then has a token bucket shared through a file in the
+ * state dir, with MRCC_XFER_UP_KBPS and MRCC_XFER_DOWN_KBPS of rate
+ * (0, the default, for no limit) and a burst of one second's worth.
+ * Uploads are charged before they start; downloads, whose size is only
+ * known afterwards, wait out the debt of earlier ones and are charged
+ * when they are done.
+ *
+ * The slots and buckets are off unless MRCC_XFER=1, until their
+ * defaults have been measured on a real cluster.  The totals go to a
+ * stats file in the state dir either way, shown by "mrcc --stats".
+ *
+ * Only the mrcc client shapes its transfers, see xfer_enable(); a
+ * mapper is one process among many on its node.
+ **/
+
+static const char *xfer_dir_name[] = { "up", "down" };
+
+static int xfer_enabled = 0;
+
+
+void xfer_enable(void)
+{
+    xfer_enabled = 1;
+}
+
+
+static long xfer_now_ms(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+
+/*
+ * Take @p bytes from the token bucket of @p dir.  Returns how many ms
+ * the caller has to wait for the tokens to have been there.
+ */
+static long xfer_charge(enum xfer_dir dir, long bytes)
+{
+    char name[32];
+    long rate, burst, tokens, last, now, wait_ms = 0;
+    int lock_fd;
+    FILE *fp;
+
+    rate = getenv_int(dir == XFER_UP ? "MRCC_XFER_UP_KBPS"
+                                     : "MRCC_XFER_DOWN_KBPS", 0) * 1024L;
+    if (rate <= 0)
+        return 0;
+    burst = rate;
+
+    snprintf(name, sizeof name, "xfer_bucket_%s", xfer_dir_name[dir]);
+    if (mrcc_open_state(name, &lock_fd, &fp) != 0)
+        return 0;
+
+    now = xfer_now_ms();
+    if (fscanf(fp, "%ld %ld", &tokens, &last) != 2) {
+        tokens = burst;
+        last = now;
+    }
+    tokens += (now - last) * (rate / 1000);
+    if (tokens > burst)
+        tokens = burst;
+    /* the bucket may go into debt, which the next ones wait out */
+    tokens -= bytes;
+    if (tokens < 0)
+        wait_ms = -tokens * 1000 / rate;
+
+    rewind(fp);
+    fprintf(fp, "%ld %ld\n", tokens, now);
+    fflush(fp);
+    ftruncate(fileno(fp), ftell(fp));
+    mrcc_close_state(lock_fd, fp);
+    return wait_ms;
+}
+
+
+/*
+ * add one transfer to the stats file
+ */
+static void xfer_record(const struct xfer *x, long bytes)
+{
+    long n[2] = {0, 0}, total[2] = {0, 0};
+    long busy[2] = {0, 0}, wait[2] = {0, 0};
+    long since;
+    int lock_fd, d;
+    FILE *fp;
+
+    if (mrcc_open_state("xfer_stats", &lock_fd, &fp) != 0)
+        return;
+
+    if (fscanf(fp, "since %ld", &since) != 1)
+        since = x->start_ms;
+    for (d = 0; d < 2; d++)
+        if (fscanf(fp, " %*s %ld %ld %ld %ld",
+                   &n[d], &total[d], &busy[d], &wait[d]) != 4)
+            break;
+
+    n[x->dir]++;
+    total[x->dir] += bytes;
+    busy[x->dir] += xfer_now_ms() - x->start_ms;
+    wait[x->dir] += x->wait_ms;
+
+    rewind(fp);
+    fprintf(fp, "since %ld\n", since);
+    for (d = 0; d < 2; d++)
+        fprintf(fp, "%s %ld %ld %ld %ld\n", xfer_dir_name[d],
+                n[d], total[d], busy[d], wait[d]);
+    fflush(fp);
+    ftruncate(fileno(fp), ftell(fp));
+    mrcc_close_state(lock_fd, fp);
+}
+
+
+/**
+ * Get permission for a transfer of @p bytes in direction @p dir; pass
+ * 0 if the size is not known.  Blocks until a slot is free and the rate
+ * limit allows it.  Must be paired with xfer_end().
+ **/
+int xfer_begin(enum xfer_dir dir, long bytes, struct xfer *x)
+{
+    char *lock_dir;
+    int n_slots, priority;
+    long start, wait_ms;
+
+    memset(x, 0, sizeof *x);
+    x->dir = dir;
+    x->lock_fd = -1;
+    if (!xfer_enabled)
+        return 0;
+
+    start = xfer_now_ms();
+    if (!getenv_bool("MRCC_XFER", 0) || get_lock_dir(&lock_dir) != 0) {
+        x->start_ms = start;
+        return 0;
+    }
+    x->shaped = 1;
+    n_slots = getenv_int("MRCC_XFER_SLOTS", 8);
+    if (n_slots < 1)
+        n_slots = 1;
+    priority = dir == XFER_DOWN
+        || bytes <= getenv_int("MRCC_XFER_SMALL", 64) * 1024L;
+    if (!priority && n_slots > 1)
+        n_slots -= (n_slots + 3) / 4;
+    mrcc_lock_slot(lock_dir, "xfer", n_slots, 1, &x->lock_fd);
+
+    if ((wait_ms = xfer_charge(dir, dir == XFER_UP ? bytes : 0)) > 0) {
+        rs_trace("transfer of %ld bytes %s waits %ldms for bandwidth",
+                 bytes, xfer_dir_name[dir], wait_ms);
+        poll(NULL, 0, wait_ms);
+    }
+
+    x->start_ms = xfer_now_ms();
+    x->wait_ms = x->start_ms - start;
+    return 0;
+}
+
+
+/**
+ * End a transfer started with xfer_begin(); @p bytes is how much was
+ * actually moved.
+ **/
+void xfer_end(struct xfer *x, long bytes)
+{
+    if (!xfer_enabled)
+        return;
+    if (x->dir == XFER_DOWN && x->shaped)
+        xfer_charge(XFER_DOWN, bytes);
+    mrcc_unlock(x->lock_fd);
+    x->lock_fd = -1;
+    xfer_record(x, bytes);
+}
+
+
+/**
+ * Print the transfer stats, for "mrcc --stats".
+ **/
+int xfer_show_stats(FILE *out)
+{
+    long n, total, busy, wait;
+    long since, elapsed;
+    char dir[16];
+    int lock_fd, d;
+    FILE *fp;
+    int ret;
+
+    if ((ret = mrcc_open_state("xfer_stats", &lock_fd, &fp)))
+        return ret;
+
+    if (fscanf(fp, "since %ld", &since) != 1) {
+        fprintf(out, "no transfers yet\n");
+        mrcc_close_state(lock_fd, fp);
+        return 0;
+    }
+    elapsed = xfer_now_ms() - since;
+    fprintf(out, "transfers in the last %lds, %d slots:\n",
+            elapsed / 1000, getenv_int("MRCC_XFER_SLOTS", 8));
+    for (d = 0; d < 2; d++) {
+        if (fscanf(fp, " %15s %ld %ld %ld %ld",
+                   dir, &n, &total, &busy, &wait) != 5)
+            break;
+        fprintf(out, "  %-4s %6ld transfers %10ld KB, %ld KB/s while busy, "
+                "%.1f slots busy on average, %ldms waited\n",
+                dir, n, total / 1024,
+                busy > 0 ? total * 1000 / busy / 1024 : 0,
+                elapsed > 0 ? (double) busy / elapsed : 0.0, wait);
+    }
+
+    mrcc_close_state(lock_fd, fp);
+    return 0;
+}
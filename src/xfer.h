@@ -0,0 +1,25 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#ifndef _HEADER_XFER_H
+# define _HEADER_XFER_H
+
+enum xfer_dir {
+    XFER_UP = 0,
+    XFER_DOWN = 1
+};
+
+struct xfer {
+    enum xfer_dir dir;
+    int shaped;         /* took a slot and tokens, see MRCC_XFER */
+    int lock_fd;        /* transfer slot */
+    long start_ms;
+    long wait_ms;       /* for the slot and the bandwidth */
+};
+
+void xfer_enable(void);
+int xfer_begin(enum xfer_dir dir, long bytes, struct xfer *x);
+void xfer_end(struct xfer *x, long bytes);
+int xfer_show_stats(FILE *out);
+
+#endif //_HEADER_XFER_H
@@ -0,0 +1,153 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "args.h"
+#include "hash.h"
+#include "basedir.h"
+
+/**
+ * @file
+ *
+ * Checks that a source using __FILE__, in itself and in a header found
+ * through an absolute -I, preprocesses to the same .i from two
+ * checkouts under MRCC_BASE_DIR, with the options of
+ * base_expand_options() and the markers of base_normalize().  Needs
+ * gcc in the PATH.  Run by "make check".
+ **/
+
+const char *rs_program_name = "basedir_check";
+
+static const char header[] = "static const char *h = __FILE__;\n";
+static const char source[] =
+    "#include \"h.h\"\n"
+    "const char *f = __FILE__;\n";
+
+/* write @p text to the file @p dir/@p name */
+static int put_file(const char *dir, const char *name, const char *text)
+{
+    char path[4096];
+    FILE *f;
+
+    snprintf(path, sizeof path, "%s/%s", dir, name);
+    if ((f = fopen(path, "w")) == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    fputs(text, f);
+    return fclose(f) != 0;
+}
+
+/* the .i of @p top/src/f.c, compiled in @p top/src with the base dir
+ * @p top, into @p out of @p size bytes */
+static int preprocess(const char *top, char *out, size_t size)
+{
+    char src[2048], inc[2048], opt[4096], fname[4096];
+    char digest[HASH_HEX_LEN + 1];
+    char **argv;
+    pid_t pid;
+    FILE *f;
+    size_t n;
+    int status, ret;
+
+    snprintf(src, sizeof src, "%s/src", top);
+    snprintf(inc, sizeof inc, "%s/inc", top);
+    snprintf(opt, sizeof opt, "-I%s", inc);
+    snprintf(fname, sizeof fname, "%s/f.c", src);
+    if ((mkdir(top, 0700) && errno != EEXIST)
+        || (mkdir(src, 0700) && errno != EEXIST)
+        || (mkdir(inc, 0700) && errno != EEXIST)
+        || put_file(inc, "h.h", header) || put_file(src, "f.c", source)
+        || chdir(src) != 0) {
+        fprintf(stderr, "failed to set up %s\n", top);
+        return 1;
+    }
+    setenv("PWD", src, 1);
+    setenv("MRCC_BASE_DIR", top, 1);
+
+    if ((argv = calloc(7, sizeof argv[0])) == NULL)
+        return 1;
+    argv[0] = strdup("gcc");
+    argv[1] = strdup("-E");
+    argv[2] = strdup(opt);
+    argv[3] = strdup(fname);
+    argv[4] = strdup("-o");
+    argv[5] = strdup("f.i");
+    if (base_expand_options(&argv) != 0)
+        return 1;
+
+    if ((pid = fork()) == 0) {
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    if (pid == -1 || waitpid(pid, &status, 0) != pid
+        || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s: gcc -E failed\n", top);
+        free_argv(argv);
+        return 1;
+    }
+    ret = base_normalize(argv, "f.i", digest);
+    free_argv(argv);
+    if (ret != 0 || digest[0] == '\0') {
+        fprintf(stderr, "%s: the .i was not normalized\n", top);
+        return 1;
+    }
+
+    if ((f = fopen("f.i", "r")) == NULL)
+        return 1;
+    n = fread(out, 1, size - 1, f);
+    out[n] = '\0';
+    fclose(f);
+    unlink("f.i");
+    unlink("f.c");
+    unlink("../inc/h.h");
+    rmdir("../inc");
+    chdir("/");
+    rmdir(src);
+    rmdir(top);
+    return 0;
+}
+
+int main(void)
+{
+    char tmp[] = "/tmp/basedir_check_XXXXXX";
+    char top[2][4096];
+    static char out[2][65536];
+    int i, failed = 0;
+
+    if (mkdtemp(tmp) == NULL) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < 2; i++) {
+        snprintf(top[i], sizeof top[i], "%s/%c", tmp, 'a' + i);
+        if (preprocess(top[i], out[i], sizeof out[i]) != 0)
+            failed = 1;
+    }
+    rmdir(tmp);
+    if (failed)
+        return EXIT_FAILURE;
+
+    if (strcmp(out[0], out[1]) != 0) {
+        fprintf(stderr, "the .i differ:\n%s\n---\n%s\n", out[0], out[1]);
+        return EXIT_FAILURE;
+    }
+    if (strstr(out[0], tmp) != NULL || strstr(out[0], "\"./f.c\"") == NULL
+        || strstr(out[0], "\"../inc/h.h\"") == NULL) {
+        fprintf(stderr, "the .i names the checkout:\n%s\n", out[0]);
+        return EXIT_FAILURE;
+    }
+    printf("basedir ok\n");
+    return EXIT_SUCCESS;
+}
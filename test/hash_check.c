@@ -0,0 +1,83 @@
+// mrcc - A C Compiler system on MapReduce
+// Zhiqiang Ma, https://www.ericzma.com
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "trace.h"
+#include "hash.h"
+
+/**
+ * @file
+ *
+ * Checks hash.c against the reference vectors of XXH64 (seed 0), and
+ * that hashing in pieces gives what hashing at once does.  The digests
+ * name persisted things (see hash.c), so they must not change by
+ * accident.  Run by "make check".
+ **/
+
+const char *rs_program_name = "hash_check";
+
+static const struct {
+    const char *in;
+    const char *hex;
+} vectors[] = {
+    { "", "ef46db3751d8e999" },
+    { "a", "d24ec4f1a98c6e5b" },
+    { "abc", "44bc2cf5ad770999" },
+};
+
+/* hash @p len bytes of @p buf in pieces of @p step, and compare */
+static int check_pieces(const char *buf, size_t len, size_t step,
+                        const char *want)
+{
+    struct hash_state st;
+    char hex[HASH_HEX_LEN + 1];
+    size_t off, n;
+
+    hash_init(&st);
+    for (off = 0; off < len; off += n) {
+        n = len - off < step ? len - off : step;
+        hash_update(&st, buf + off, n);
+    }
+    hash_final_hex(&st, hex);
+    if (strcmp(hex, want) != 0) {
+        fprintf(stderr, "%zu bytes in pieces of %zu: %s, want %s\n",
+                len, step, hex, want);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    struct hash_state st;
+    char hex[HASH_HEX_LEN + 1];
+    char buf[1000];
+    size_t i, steps[] = { 1, 3, 7, 31, 32, 33, 64, 999 };
+    int failed = 0;
+
+    for (i = 0; i < sizeof vectors / sizeof vectors[0]; i++) {
+        hash_str_hex(vectors[i].in, hex);
+        if (strcmp(hex, vectors[i].hex) != 0) {
+            fprintf(stderr, "\"%s\": %s, want %s\n",
+                    vectors[i].in, hex, vectors[i].hex);
+            failed = 1;
+        }
+    }
+
+    for (i = 0; i < sizeof buf; i++)
+        buf[i] = (char) (i * 131 + 7);
+    hash_init(&st);
+    hash_update(&st, buf, sizeof buf);
+    hash_final_hex(&st, hex);
+    for (i = 0; i < sizeof steps / sizeof steps[0]; i++)
+        failed |= check_pieces(buf, sizeof buf, steps[i], hex);
+
+    if (failed)
+        return EXIT_FAILURE;
+    printf("hash ok\n");
+    return EXIT_SUCCESS;
+}